@@ -52,6 +52,7 @@
 // investment[i][j] = ( equity_L[i][j] - (1 - taxc) * equity_W[i][j] ) / myabs(( (1 - taxc) * psi * equity_W[i][j]));
 // There is a high likelihood of cancellation in the numerator that is then amplified by the denominator.
 // Looking at the results, the problem seems to be negligible if we ignore the rightmost 10% of the loan grid.
+// investment_q_max and investment_relaxation select a bounded and relaxed version of this update, see stabilized_investment().
 
 #include <stdlib.h>
 #include <stdbool.h>
@@ -60,6 +61,9 @@
 #include <math.h>
 
 #include "mca.h"
+#include "mca_checkpoint.h"
+#include "mca_trajectory.h"
+#include "mca_binary.h"
 
 // DEBUG FLAGS
 // Setting a debug flag leads to printing some information at strategic sections of the code.
@@ -112,7 +116,7 @@ void debug() {
 // We need to include this if we use OMP functions in addition to pragmas
 //#include <omp.h>
 
-// Simple helper functions square, myabs, max. myabs named thusly to avoid name collision with C library function.
+// Simple helper functions square, myabs, max, min. myabs named thusly to avoid name collision with C library function.
 
 double square(double x) {
 	return x*x;
@@ -131,6 +135,12 @@ double max(double a, double b) {
 	return b;
 }
 
+double min(double a, double b) {
+	if(a < b)
+		return a;
+	return b;
+}
+
 // create_grid returns a pointer to an initialized array of grid values, used later for the grid of values for the cash or the loan portfolio. The array has
 // length grid_size and is evenly spaced between min and max.
 double* create_grid(double min, double max, int grid_size) {
@@ -142,6 +152,51 @@ double* create_grid(double min, double max, int grid_size) {
 	return grid;
 }
 
+// Compute the distances to the neighbours and their inverses for the points of a non-uniform grid
+void grid_steps(const double *grid, double *step_p, double *step_n, double *inv_step_p, double *inv_step_n, int grid_size) {
+	for(int i = 0; i < grid_size - 1; ++i) {
+		step_p[i] = grid[i+1] - grid[i];
+		step_n[i+1] = step_p[i];
+	}
+	step_n[0] = step_p[0];
+	step_p[grid_size - 1] = step_n[grid_size - 1];
+	for(int i = 0; i < grid_size; ++i) {
+		inv_step_p[i] = 1 / step_p[i];
+		inv_step_n[i] = 1 / step_n[i];
+	}
+}
+
+// fill_grid computes the points of the W or L grid, the distances to the neighbours and their inverses, see the declaration of dW_p in mca.h.
+// If cluster_width is 0, the grid is evenly spaced with step, otherwise the points are given by the sinh transformation
+//		grid[i] = center + cluster_width * sinh(a + (b - a) * i / (grid_size - 1)),
+// where a and b are such that the grid goes from min to max. The spacing is smallest at center, where it is about
+// cluster_width * (b - a) / (grid_size - 1), and grows exponentially with the distance from center in units of cluster_width.
+void fill_grid(double *grid, double *step_p, double *step_n, double *inv_step_p, double *inv_step_n, double min, double max, int grid_size,
+			   double step, double center, double cluster_width) {
+	if(cluster_width == 0) {
+		for(int i = 0; i < grid_size; ++i) {
+			grid[i] = min + i * step;
+			step_p[i] = step;
+			step_n[i] = step;
+			inv_step_p[i] = 1 / step;
+			inv_step_n[i] = 1 / step;
+		}
+	}
+	else {
+		double a = asinh((min - center) / cluster_width);
+		double b = asinh((max - center) / cluster_width);
+		for(int i = 0; i < grid_size; ++i) {
+			grid[i] = center + cluster_width * sinh(a + (b - a) * i / (grid_size - 1));
+			// The sign of W matters for the investment, so a point which is very close to 0 compared to the spacing is put exactly there
+			if(fabs(grid[i]) < 1e-6 * step)
+				grid[i] = 0;
+		}
+		grid[0] = min;
+		grid[grid_size - 1] = max;
+		grid_steps(grid, step_p, step_n, inv_step_p, inv_step_n, grid_size);
+	}
+}
+
 // The following three functions create the result arrays.
 // The equity and defaulting arrays are initialized in the terminal_equity_default() function.
 // The investment array is initialized in the create_investment_grid() function itself.
@@ -169,11 +224,11 @@ double** create_investment_WL_grid() {
 	return grid;
 }
 
-// Create result grid for defaulting flags
-bool** create_defaulting_WL_grid() {
-	bool **grid = malloc(W_grid_size * sizeof(bool*));
+// Create result grid for defaulting flags, bit-packed (see get_flag() in mca.h)
+uint64_t** create_defaulting_WL_grid() {
+	uint64_t **grid = malloc(W_grid_size * sizeof(uint64_t*));
 	for(int i = 0; i < W_grid_size; ++i) {
-		grid[i] = malloc(L_grid_size * sizeof(bool));
+		grid[i] = calloc(FLAG_WORDS(L_grid_size), sizeof(uint64_t));
 	}
 	return grid;
 }
@@ -204,17 +259,17 @@ void print_WL_grid(double **grid) {
 	}
 }
 
-void print_bool_WL_grid(bool **grid) {
+void print_bool_WL_grid(uint64_t **grid) {
 	for(int i = 0; i < W_grid_size; ++i) {
 		for(int j = 0; j < L_grid_size; ++j) {
-			printf("%i\t", grid[i][j]);
+			printf("%i\t", get_flag(grid, i, j));
 		}
 		printf("\n");
 	}
 }
 
 // Compute terminal boundary values
-void terminal_equity_default(double *W_grid, double *L_grid, double **equity_T, bool **defaulting_T) {
+void terminal_equity_default(double *W_grid, double *L_grid, double **equity_T, uint64_t **defaulting_T) {
 	for(int i = 0; i < W_grid_size; ++i) {
 		for(int j = 0; j < L_grid_size; ++j) {
 			if(W_grid[i] >= 0)
@@ -222,14 +277,121 @@ void terminal_equity_default(double *W_grid, double *L_grid, double **equity_T,
 			else
 				equity_T[i][j] = max(W_grid[i] - P + (1 - theta) * L_grid[j], 0);
 			
-			if(equity_T[i][j] == 0)
-				defaulting_T[i][j] = true;
-			else
-				defaulting_T[i][j] = false;
+			set_flag(defaulting_T, i, j, equity_T[i][j] == 0);
 		}
 	}
 }
 
+// Slope of the values a, b, c at three consecutive grid points at the middle point, limited with the monotonized central (MC) limiter:
+// the central slope, but at most twice either one-sided slope, and zero at extrema.
+static inline double mc_slope(double a, double b, double c) {
+	double left = b - a, right = c - b;
+	if(left * right <= 0)
+		return 0;
+	double slope = min(myabs(0.5 * (c - a)), 2 * min(myabs(left), myabs(right)));
+	return right > 0 ? slope : -slope;
+}
+
+// Like mc_slope, per unit length for points with distances h_n and h_p on a non-uniform grid
+static inline double mc_slope_nonuniform(double a, double b, double c, double h_n, double h_p) {
+	double left = (b - a) / h_n, right = (c - b) / h_p;
+	if(left * right <= 0)
+		return 0;
+	double slope = min(myabs((c - a) / (h_n + h_p)), 2 * min(myabs(left), myabs(right)));
+	return right > 0 ? slope : -slope;
+}
+
+// SECOND-ORDER DRIFT TERMS (spatial_order 2)
+// The Markov chain approximates a drift with rate b > 0 towards +h by the one-sided difference b * (V[k+1] - V[k]), which is only first-order
+// accurate. We replace the difference by that of the reconstructed values at the faces upwind, V[k+1] - s[k+1] / 2 and V[k] - s[k] / 2,
+// with the limited slopes s (mc_slope). In smooth regions this is the second-order Fromm scheme, at kinks (like the default boundary) the
+// limiter falls back to the upwind difference. Towards -h, the difference V[k-1] - V[k] becomes V[k-1] + s[k-1] / 2 - V[k] - s[k] / 2.
+//
+// The difference to the upwind differences is added as a deferred correction, computed from the equity of the preceding iteration. The
+// transition probabilities stay those of the Markov chain, so the iteration keeps its monotone structure, and once the iteration has
+// converged, new_equity solves the second-order scheme. Returns the correction for the interior point (i, j). The slopes at the first and
+// last points of the grid are zero, so next to the boundary, the faces on the boundary side keep the upwind values.
+//
+// On non-uniform grids, the slopes are per unit length and the difference V[k+1] - V[k] = h V' + h^2 / 2 V'' + ... over the distance h
+// is corrected by h^2 / 2 times the second derivative estimated from the slopes at k and k+1, which gives the same correction as above
+// on uniform grids.
+static double drift_correction(double **e, int i, int j, double b100p, double b100n, double b010p, double b010n) {
+	if(!uniform_grids) {
+		double s_W_n = i > 1 ? mc_slope_nonuniform(e[i-2][j], e[i-1][j], e[i][j], dW_n[i-1], dW_p[i-1]) : 0;
+		double s_W = mc_slope_nonuniform(e[i-1][j], e[i][j], e[i+1][j], dW_n[i], dW_p[i]);
+		double s_W_p = i < W_grid_size - 2 ? mc_slope_nonuniform(e[i][j], e[i+1][j], e[i+2][j], dW_n[i+1], dW_p[i+1]) : 0;
+		double s_L_n = j > 1 ? mc_slope_nonuniform(e[i][j-2], e[i][j-1], e[i][j], dL_n[j-1], dL_p[j-1]) : 0;
+		double s_L = mc_slope_nonuniform(e[i][j-1], e[i][j], e[i][j+1], dL_n[j], dL_p[j]);
+		double s_L_p = j < L_grid_size - 2 ? mc_slope_nonuniform(e[i][j], e[i][j+1], e[i][j+2], dL_n[j+1], dL_p[j+1]) : 0;
+		return 0.5 * ( - b100p * dW_p[i] * (s_W_p - s_W) - b100n * dW_n[i] * (s_W - s_W_n)
+		               - b010p * dL_p[j] * (s_L_p - s_L) - b010n * dL_n[j] * (s_L - s_L_n) );
+	}
+	double s_W_n = i > 1 ? mc_slope(e[i-2][j], e[i-1][j], e[i][j]) : 0;
+	double s_W = mc_slope(e[i-1][j], e[i][j], e[i+1][j]);
+	double s_W_p = i < W_grid_size - 2 ? mc_slope(e[i][j], e[i+1][j], e[i+2][j]) : 0;
+	double s_L_n = j > 1 ? mc_slope(e[i][j-2], e[i][j-1], e[i][j]) : 0;
+	double s_L = mc_slope(e[i][j-1], e[i][j], e[i][j+1]);
+	double s_L_p = j < L_grid_size - 2 ? mc_slope(e[i][j], e[i][j+1], e[i][j+2]) : 0;
+	return 0.5 * ( - b100p * (s_W_p - s_W) - b100n * (s_W - s_W_n) - b010p * (s_L_p - s_L) - b010n * (s_L - s_L_n) );
+}
+
+// Rates of the moves of the Markov chain at (i, j) for investment q: b100p and b100n towards larger and smaller W, b010p and b010n towards
+// larger and smaller L from the drift, b020p and b020n from the diffusion in L. Used by update_new_equity() and assemble_chain().
+static inline void transition_rates(double q, int i, int j, double *b100p, double *b100n, double *b010p, double *b010n, double *b020p,
+                                    double *b020n) {
+	if(q > 0 && W_grid[i] >= 0) {
+		*b100p = inv_dW_p[i] * (1 - taxc) * (1 - taxe) * ( delta * L_grid[j] + W_grid[i] * (r - lambda) );
+		*b100n = inv_dW_n[i] * (1 - taxc) * (1 - taxe) * ( coupon + myabs(q) + 0.5 * square(q) * psi );
+		*b010p = inv_dL_p[j] * (q);
+		*b010n = inv_dL_n[j] * delta * L_grid[j];
+	}
+	else if(q <= 0 && W_grid[i] >= 0) {
+		*b100p = inv_dW_p[i] * (1 - taxc) * (1 - taxe) * ( delta * L_grid[j] + W_grid[i] * (r - lambda) + myabs(q) );
+
+		*b100n = inv_dW_n[i] * (1 - taxc) * (1 - taxe) * ( coupon + 0.5 * square(q) * psi );
+
+		*b010p = 0; 
+
+		*b010n = inv_dL_n[j] * ( myabs(q) + delta * L_grid[j] );
+	}
+	else if(q > 0 && W_grid[i] < 0) {  
+		*b100p = inv_dW_p[i]* (1 - taxc) * (1 - taxe) * (delta * L_grid[j] );
+
+		*b100n = inv_dW_n[i] * (1 - taxc) * (1 - taxe) * ( myabs(W_grid[i]) * r + coupon  + myabs(q) + 0.5 * square(q) * psi );
+
+		*b010p = inv_dL_p[j] * (q); 
+
+		*b010n = inv_dL_n[j] * (delta  * L_grid[j]);
+	}
+	else { //if(q <= 0 && W_grid[i] < 0) {
+		*b100p = inv_dW_p[i]* (1 - taxc) * (1 - taxe) * ( delta * L_grid[j] + myabs(q) );
+
+		*b100n = inv_dW_n[i] * (1 - taxc) * (1 - taxe) * ( myabs(W_grid[i]) * r + coupon  + 0.5 * square(q) * psi );
+
+		*b010p = 0; 
+
+		*b010n = inv_dL_n[j] * ( myabs(q) + delta*L_grid[j] );
+	}
+
+	// Diffusion in L, b020p towards L + dL_p[j] and b020n towards L - dL_n[j], the same on uniform grids
+	if(uniform_grids) {
+		*b020p = square(1/dL) * (0.5 * square(sigma * L_grid[j]));
+		*b020n = *b020p;
+	}
+	else {
+		*b020p = square(sigma * L_grid[j]) / (dL_p[j] * (dL_p[j] + dL_n[j]));
+		*b020n = square(sigma * L_grid[j]) / (dL_n[j] * (dL_p[j] + dL_n[j]));
+	}
+}
+
+// With boundary_condition 1, equity grows linearly beyond W_max and L_max: the far-field value one step off the grid is that at (i, j) plus
+// the change of equity from the nearest point inwards (i_in, j_in) in the preceding time step, at least 0. Taking the step from the values
+// of the preceding time step keeps it out of the coefficients of the chain, so they all stay non-negative.
+static inline double far_field_step(double **equity, int i, int j, int i_in, int j_in) {
+	double step = equity[i][j] - equity[i_in][j_in];
+	return step > 0 ? step : 0;
+}
+
 // Updates the values new_equity points to.
 // Requires that: equity points to the values computed in the preceding time step,
 // 				  iteration_equity points to the values for equity computed in the preceding iteration step,
@@ -239,7 +401,7 @@ void update_new_equity(double **new_equity, double **equity, double **iteration_
 #else
 void update_new_equity(double **new_equity, double **equity, double **iteration_equity, double **investment, int i, int j) {
 #endif
-	double b100p, b100n, b010p, b010n, b200, b020, b110;
+	double b100p, b100n, b010p, b010n, b200, b020p, b020n, b110;
 	double Qf, disc;
 	// Numerator probabilties
 	// npx{p|nh}y{p|ng} : numerator probability for a {positive | negative} step {h | g} on the xy axis. h indicates a step on the x axis and g indicates a step on the y axis.
@@ -256,7 +418,8 @@ void update_new_equity(double **new_equity, double **equity, double **iteration_
 	b010p = -7777;
 	b010n = -7777;
 	b200 = -7777;
-	b020 = -7777;
+	b020p = -7777;
+	b020n = -7777;
 	b110 = -7777;
 	Qf = -7777;
 	disc = -7777;
@@ -273,45 +436,11 @@ void update_new_equity(double **new_equity, double **equity, double **iteration_
 	pxy = -7777;
 	#endif
 	
-	if(investment[i][j] > 0 && W_grid[i] >= 0) {
-		b100p = (1 / dW) * (1 - taxc) * (1 - taxe) * ( delta * L_grid[j] + W_grid[i] * (r - lambda) );
-		b100n = (1 / dW) * (1 - taxc) * (1 - taxe) * ( coupon + myabs(investment[i][j]) + 0.5 * square(investment[i][j]) * psi );
-		b010p = (1 / dL) * (investment[i][j]);
-		b010n = (1 / dL) * delta * L_grid[j];
-	}
-	else if(investment[i][j] <= 0 && W_grid[i] >= 0) {
-		b100p = (1 / dW ) * (1 - taxc) * (1 - taxe) * ( delta * L_grid[j] + W_grid[i] * (r - lambda) + myabs(investment[i][j]) );
-
-		b100n = (1 / dW ) * (1 - taxc) * (1 - taxe) * ( coupon + 0.5 * square(investment[i][j]) * psi );
-
-		b010p = 0; 
-
-		b010n = 1/dL * ( myabs(investment[i][j]) + delta * L_grid[j] );
-	}
-	else if(investment[i][j] > 0 && W_grid[i] < 0) {  
-		b100p = (1 / dW )* (1 - taxc) * (1 - taxe) * (delta * L_grid[j] );
-
-		b100n = (1 / dW ) * (1 - taxc) * (1 - taxe) * ( myabs(W_grid[i]) * r + coupon  + myabs(investment[i][j]) + 0.5 * square(investment[i][j]) * psi );
-
-		b010p = 1/dL * (investment[i][j]); 
-
-		b010n = 1/dL * (delta  * L_grid[j]);
-	}
-	else { //if(investment[i][j] <= 0 && W_grid[i] < 0) {
-		b100p = (1 / dW )* (1 - taxc) * (1 - taxe) * ( delta * L_grid[j] + myabs(investment[i][j]) );
-
-		b100n = (1 / dW ) * (1 - taxc) * (1 - taxe) * ( myabs(W_grid[i]) * r + coupon  + 0.5 * square(investment[i][j]) * psi );
-
-		b010p = 0; 
-
-		b010n = 1/dL * ( myabs(investment[i][j]) + delta*L_grid[j] );
-	}
-
+	transition_rates(investment[i][j], i, j, &b100p, &b100n, &b010p, &b010n, &b020p, &b020n);
 	b200 = 0;																						// Is this needed?
-	b020 = square(1/dL) * (0.5 * square(sigma * L_grid[j]));    
 	b110 = 0;																						// Is this needed?
 
-	Qf = 1/dT + b100n + b010p + b010n + b100p + 2 * b200 + 2 * b020 - myabs(b110);
+	Qf = 1/dT + b100n + b010p + b010n + b100p + 2 * b200 + (b020p + b020n) - myabs(b110);
 	disc = exp(-rhohat / Qf);
 
 	// Numerator Probabilities 
@@ -320,15 +449,39 @@ void update_new_equity(double **new_equity, double **equity, double **iteration_
 	// p[x+h,y]
 	npxphy = b100p + b200 - 0.5 * myabs(b110);
 	// p[x,y-g]
-	npxyng = b010n + b020 - 0.5 * myabs(b110);
+	npxyng = b010n + b020n - 0.5 * myabs(b110);
 	// p[x,y+g]
-	npxypg = b010p + b020 - 0.5 * myabs(b110);    
+	npxypg = b010p + b020p - 0.5 * myabs(b110);    
         
 	uc = 0;																							// Is this needed?
         
 	ptau = 1 / (Qf * dT);
 
-	if (i == 0 && j == 0) {
+	if (boundary_condition == 1 && (i == 0 || i == (W_grid_size - 1) || j == (L_grid_size - 1))) {
+		// FAR-FIELD BOUNDARY
+		// Far away from the region of interest, equity grows linearly in W and L, so the moves off the grid at W_max and L_max go to the
+		// value at (i, j) plus the step of the preceding time step (see far_field_step()). Below W_min the bank cannot pay its debt, so the
+		// move off the grid at W_min is absorbed with the value 0 like with boundary_condition 0. The move to L < L_min is still dropped,
+		// since L cannot become negative.
+		pxypg = 1/Qf * npxypg;
+		pxphy = 1/Qf * npxphy;
+		pxnhy = 1/Qf * npxnhy;
+		pxyng = j > 0 ? 1/Qf * npxyng : 0;
+		pxy = 1 - pxypg - pxphy - pxnhy - pxyng - ptau;
+		double equity_Wp = i < W_grid_size - 1 ? iteration_equity[i+1][j] : iteration_equity[i][j] + far_field_step(equity, i, j, i - 1, j);
+		double equity_Wn = i > 0 ? iteration_equity[i-1][j] : 0;
+		double equity_Lp = j < L_grid_size - 1 ? iteration_equity[i][j+1] : iteration_equity[i][j] + far_field_step(equity, i, j, i, j - 1);
+		double equity_Ln = j > 0 ? iteration_equity[i][j-1] : 0;
+
+		new_equity[i][j] =  1/Qf * uc +
+			disc * ptau   * equity[i][j] +
+			disc * pxy    * iteration_equity[i][j] +
+			disc * pxphy  * equity_Wp +
+			disc * pxnhy  * equity_Wn +
+			disc * pxypg  * equity_Lp +
+			disc * pxyng  * equity_Ln;
+	}
+	else if (i == 0 && j == 0) {
 		pxy = 1  - ptau;
                 
 		new_equity[i][j] =  1/Qf * uc +
@@ -435,7 +588,8 @@ void update_new_equity(double **new_equity, double **equity, double **iteration_
 			disc * pxypg  * iteration_equity[i][j+1]  +
 			disc * pxyng  * iteration_equity[i][j-1];
 
-            
+		if(spatial_order == 2)
+			new_equity[i][j] += disc / Qf * drift_correction(iteration_equity, i, j, b100p, b100n, b010p, b010n);
 	}
 	#ifdef DEBUG_EQUITY_time
 	if(i == DEBUG_EQUITY_i && j == DEBUG_EQUITY_j && iteration == DEBUG_EQUITY_iteration && t == DEBUG_EQUITY_time) {
@@ -454,7 +608,8 @@ void update_new_equity(double **new_equity, double **equity, double **iteration_
 		printf("%-12s%-12g\n", "b010p:", b010p);
 		printf("%-12s%-12g\n", "b010n:", b010n);
 		printf("%-12s%-12g\n", "b200:", b200);
-		printf("%-12s%-12g\n", "b020:", b020);
+		printf("%-12s%-12g\n", "b020p:", b020p);
+		printf("%-12s%-12g\n", "b020n:", b020n);
 		printf("%-12s%-12g\n", "b110:", b110);
 		printf("%-12s%-12g\n", "Qf:", Qf);
 		printf("%-12s%-12g\n", "disc:", disc);
@@ -473,6 +628,64 @@ void update_new_equity(double **new_equity, double **equity, double **iteration_
 	#endif
 }
 
+// Central difference of the values a, b, c at points with distances h_n and h_p on a non-uniform grid, second-order accurate
+static inline double central_difference(double a, double b, double c, double h_n, double h_p) {
+	return ( h_n * h_n * (c - b) + h_p * h_p * (b - a) ) / ( h_n * h_p * (h_n + h_p) );
+}
+
+// Derivatives of equity e with respect to W and L at (i, j), as used by update_defaulting_investment()
+// uniform is uniform_grids, passed in such that the compiler can move the test out of the loops over the grid.
+static inline void equity_derivatives(double **e, int i, int j, bool uniform, double *e_W, double *e_L) {
+	if(!uniform) {
+		// The same finite differences for distances that vary along the grid
+		if(i == 0)
+			*e_W = ( e[i+1][j] - e[i][j] ) / dW_p[i];
+		else if(i == W_grid_size - 1)
+			*e_W = ( e[i][j] - e[i - 2][j] ) / (W_grid[i] - W_grid[i - 2]);
+		else
+			*e_W = central_difference(e[i-1][j], e[i][j], e[i+1][j], dW_n[i], dW_p[i]);
+
+		if(j == L_grid_size - 1)
+			*e_L = ( e[i][j] - e[i][j-2] ) / (L_grid[j] - L_grid[j-2]);
+		else if(j == 0 || get_flag(defaulting, i, j-1) == true)
+			*e_L = ( e[i][j+1] - e[i][j] ) / dL_p[j];
+		else
+			*e_L = central_difference(e[i][j-1], e[i][j], e[i][j+1], dL_n[j], dL_p[j]);
+		return;
+	}
+
+	// Check for extreme cases on the cash grid, use the appropriate finite difference
+	if(i == 0)
+		*e_W = ( e[i+1][j] - e[i][j] ) / dW;
+	else if(i == W_grid_size - 1)
+		*e_W = ( e[i][j] - e[i - 2][j] ) / (2 * dW);
+	else
+		*e_W = ( e[i+1][j] - e[i-1][j] ) / (2 * dW);
+
+	// Check for extreme cases on the loan grid, use the appropriate finite difference
+	if(j == L_grid_size - 1)
+		*e_L = ( e[i][j] - e[i][j-2] ) / (2 * dL);
+	else if(j == 0 || get_flag(defaulting, i, j-1) == true)										// REPLACE ????
+		*e_L = ( e[i][j+1] - e[i][j] ) / dL;
+	else
+		*e_L = ( e[i][j+1] - e[i][j-1] ) / (2 * dL);
+}
+
+// Investment from the first-order condition, stabilized as selected by investment_q_max and investment_relaxation, given the derivatives of
+// equity and the investment of the preceding iteration.
+// The first-order condition gives investment = (q - 1) / psi, where q = equity_L / ((1 - taxc) * equity_W) is the value of loans in units of
+// cash. Where equity_W vanishes, mostly near W_max, q becomes arbitrarily large and changes sign with equity_W, so investment jumps between
+// iterations and the time step does not converge. With investment_q_max, the denominator is kept at least |equity_L| / investment_q_max,
+// which bounds |q| by investment_q_max and investment by (investment_q_max + 1) / psi, but leaves it unchanged wherever |q| is smaller.
+// With investment_relaxation < 1, investment only moves this fraction of the way from the preceding iteration to the new value.
+static inline double stabilized_investment(double e_W, double e_L, double previous) {
+	double cash_value = myabs((1 - taxc) * e_W);
+	if(investment_q_max > 0)
+		cash_value = max(cash_value, myabs(e_L) / investment_q_max);
+	double target = cash_value > 0 ? ( e_L - (1 - taxc) * e_W ) / (psi * cash_value) : 0;
+	return previous + investment_relaxation * (target - previous);
+}
+
 // Updates the values pointed to by defaulting and investment, after the new_equity values have been updated.
 #if defined(DEBUG_DEFAULTING_INVESTMENT_time) || defined(DEBUG_WRITE_time) || defined(DEBUG_GDB)
 void update_defaulting_investment(int t, int iteration) {
@@ -481,41 +694,31 @@ void update_defaulting_investment() {
 #endif
 	// DEFAULT CONDITION
 	// derivative of equity wrt W == derivative of equity wrt L == 0
+	const bool uniform = uniform_grids;
+	const bool stabilized = investment_q_max > 0 || investment_relaxation < 1;
 	for(int i = 0; i < W_grid_size; ++i) {
 		for(int j = 0; j < L_grid_size; ++j) {
-			// Check for extreme cases on the cash grid, use the appropriate finite difference
-			if(i == 0)
-				equity_W[i][j] = ( new_equity[i+1][j] - new_equity[i][j] ) / dW;
-			else if(i == W_grid_size - 1)
-				equity_W[i][j] = ( new_equity[i][j] - new_equity[i - 2][j] ) / (2 * dW);
-			else
-				equity_W[i][j] = ( new_equity[i+1][j] - new_equity[i-1][j] ) / (2 * dW);
-			
-			double trigger_equity_W = myabs(equity_W[i][j]);
-			
-			// Check for extreme cases on the loan grid, use the appropriate finite difference
-			if(j == L_grid_size - 1)
-				equity_L[i][j] = ( new_equity[i][j] - new_equity[i][j-2] ) / (2 * dL);
-			else if(j == 0 || defaulting[i][j-1] == true)											// REPLACE ????
-				equity_L[i][j] = ( new_equity[i][j+1] - new_equity[i][j] ) / dL;
-			else
-				equity_L[i][j] = ( new_equity[i][j+1] - new_equity[i][j-1] ) / (2 * dL);
-
-			double trigger_equity_L = myabs(equity_L[i][j]);
+			// The derivatives are only needed here, the output grids equity_W and equity_L are filled by compute_equity_derivatives()
+			double equity_W_ij, equity_L_ij;
+			equity_derivatives(new_equity, i, j, uniform, &equity_W_ij, &equity_L_ij);
+			double trigger_equity_W = myabs(equity_W_ij);
+			double trigger_equity_L = myabs(equity_L_ij);
 
 			if(trigger_equity_W > trigger_equity_derivative_tol && trigger_equity_L > trigger_equity_derivative_tol) { // CHECK ????????
-				defaulting[i][j] = false;
+				set_flag(defaulting, i, j, false);
 			}
-			if(defaulting[i][j] == false)
+			if(get_flag(defaulting, i, j) == false && stabilized)
+				investment[i][j] = stabilized_investment(equity_W_ij, equity_L_ij, investment[i][j]);
+			else if(get_flag(defaulting, i, j) == false)
 				//investment[i][j] = ((1 - taxc) * equity_W[i][j] - equity_L[i][j]) / ( - (1 - taxc) * psi * equity_W[i][j]);
-				investment[i][j] = ( equity_L[i][j] - (1 - taxc) * equity_W[i][j] ) / myabs(( (1 - taxc) * psi * equity_W[i][j]));
+				investment[i][j] = ( equity_L_ij - (1 - taxc) * equity_W_ij ) / myabs(( (1 - taxc) * psi * equity_W_ij));
 				//investment[i][j] = exp2(log2(equity_L[i][j]) - log2(psi * (1 - taxc) * equity_W[i][j])) - 1 / psi;
 				//investment[i][j] = equity_L[i][j] / ( psi * (1 - taxc) * equity_W[i][j]) - 1 / psi;
 			else
 				investment[i][j] = 0;
 
 			#ifdef DEBUG_GDB
-			if(equity_W[i][j] < 0 || equity_L[i][j] < 0) {
+			if(equity_W_ij < 0 || equity_L_ij < 0) {
 				debug();
 			}
 			#endif
@@ -524,17 +727,739 @@ void update_defaulting_investment() {
 			if(i == DEBUG_DEFAULTING_INVESTMENT_i && j == DEBUG_DEFAULTING_INVESTMENT_j && iteration == DEBUG_DEFAULTING_INVESTMENT_iteration && t == DEBUG_DEFAULTING_INVESTMENT_time) {
 				printf("DEBUG_DEFAULTING_INVESTMENT for (i, j, iteration, t) = (%i, %i, %i, %i)\n", i, j, iteration, t);
 				printf("%-18s%-12g\n", "New investment:", investment[i][j]);
-				printf("%-18s%-12i\n", "New defaulting:", defaulting[i][j]);
-				printf("%-18s%-12g\n", "equity_W", equity_W[i][j]);
-				printf("%-18s%-12g\n", "trigger_equity_W", trigger_equity_W[i][j]);
-				printf("%-18s%-12g\n", "equity_L", equity_L[i][j]);
-				printf("%-18s%-12g\n", "trigger_equity_L", trigger_equity_L[i][j]);
+				printf("%-18s%-12i\n", "New defaulting:", get_flag(defaulting, i, j));
+				printf("%-18s%-12g\n", "equity_W", equity_W_ij);
+				printf("%-18s%-12g\n", "trigger_equity_W", trigger_equity_W);
+				printf("%-18s%-12g\n", "equity_L", equity_L_ij);
+				printf("%-18s%-12g\n", "trigger_equity_L", trigger_equity_L);
 			}
 			#endif
 		}
 	}
 }
 
+// Fill equity_W and equity_L with the derivatives of the current equity, which are the same as those computed in the last iteration of the
+// last time step, since equity and defaulting are the values of that iteration.
+void compute_equity_derivatives() {
+	for(int i = 0; i < W_grid_size; ++i) {
+		for(int j = 0; j < L_grid_size; ++j) {
+			equity_derivatives(equity, i, j, uniform_grids, &equity_W[i][j], &equity_L[i][j]);
+		}
+	}
+}
+
+// Sum of the n values in a, added in a fixed order: the halves are summed recursively, short runs from left to right
+double pairwise_sum(const double *a, int n) {
+	if(n <= 8) {
+		double sum = 0;
+		for(int k = 0; k < n; ++k)
+			sum += a[k];
+		return sum;
+	}
+	return pairwise_sum(a, n / 2) + pairwise_sum(a + n / 2, n - n / 2);
+}
+
+// CONVERGENCE OF A TIME STEP
+// The iterations of a time step stop once a norm of the change of equity from one iteration to the next is below a tolerance. The norm and
+// its tolerance are selected by convergence_norm:
+// 0: sum of the squared changes over the grid, iteration_tol. The sum grows with the number of grid points, so the same tolerance asks for a
+//    smaller change per point on a finer grid.
+// 1: largest absolute change at any point, max_change_tol
+// 2: root mean square of the changes, rms_change_tol
+// 3: root mean square of the changes relative to that of equity, relative_change_tol
+// The norms 1 to 3 do not depend on the number of grid points, but the iterations contract more slowly on finer grids, so the same change
+// leaves a larger distance to the fixed point. Their tolerances therefore bound the estimated distance instead, see iteration_error().
+
+// Tolerance for the norm selected by convergence_norm
+double convergence_tolerance() {
+	switch(convergence_norm) {
+		case 1: return max_change_tol;
+		case 2: return rms_change_tol;
+		case 3: return relative_change_tol;
+		default: return iteration_tol;
+	}
+}
+
+// Norm of the change of equity in the last iteration selected by convergence_norm, from the row sums and maxima computed in step()
+double convergence_measure() {
+	switch(convergence_norm) {
+		case 1: {
+			double change = 0;
+			for(int i = 0; i < W_grid_size; ++i)
+				change = max(change, row_equity_change_max[i]);
+			return change;
+		}
+		case 2:
+			return sqrt(pairwise_sum(row_equity_change, W_grid_size) / ((double) W_grid_size * L_grid_size));
+		case 3: {
+			double magnitude = pairwise_sum(row_equity_magnitude, W_grid_size);
+			return magnitude > 0 ? sqrt(pairwise_sum(row_equity_change, W_grid_size) / magnitude) : 0;
+		}
+		default:
+			return pairwise_sum(row_equity_change, W_grid_size);
+	}
+}
+
+// PREDICTOR
+// The first iteration of a time step starts from the equity and investment of the preceding time step. Since the solution changes smoothly
+// from one time step to the next, with predictor_order 1 or 2 the iterations start from the linear or quadratic extrapolation of the last two
+// or three time steps instead. The equity of the preceding time step is still in spare_equity at the beginning of a time step (see the end
+// of step()), so the predictor only needs previous_investment and, for predictor_order 2, older_equity. Investment is always extrapolated
+// linearly, and not at all where the bank defaults or while the policy is frozen (see POLICY FREEZE below).
+// The prediction is rejected, and the time step starts over from the preceding time step, if the change of equity in the first iteration
+// is larger than in the first iteration of the last time step that started from the preceding time step (predictor_change), typically one
+// of the first time steps, where the solution changes fastest. Comparing with the last predicted time step instead rejects far too many
+// good predictions, since the first change after a good prediction is tiny. predictor_history counts the time steps since the terminal
+// values, the predictor waits until it has enough of them.
+
+// Allocate the buffers of the predictor for the current grid sizes unless this has been done already
+void setup_predictor() {
+	if(previous_investment == NULL)
+		previous_investment = create_equity_WL_grid();
+	if(predictor_order == 2 && older_equity == NULL)
+		older_equity = create_equity_WL_grid();
+}
+
+// Called at the beginning of a time step with predictor_order > 0. Returns true if iteration_equity and investment have been replaced by the
+// prediction, in which case previous_investment holds the investment of the preceding time step.
+static bool predict() {
+	setup_predictor();
+	double **tmp;
+	if(predictor_order == 2 && predictor_history >= 1) {
+		// older_equity becomes the equity of the preceding time step, spare_equity the one before until it is overwritten
+		tmp = older_equity;
+		older_equity = spare_equity;
+		spare_equity = tmp;
+	}
+	bool predicted = predictor_history >= predictor_order;
+	# pragma omp parallel for schedule(static)
+	for(int i = 0; i < W_grid_size; ++i) {
+		for(int j = 0; j < L_grid_size; ++j) {
+			double last_investment = investment[i][j];
+			if(predicted) {
+				if(predictor_order == 1)
+					new_equity[i][j] = 2 * equity[i][j] - spare_equity[i][j];
+				else
+					new_equity[i][j] = 3 * (equity[i][j] - older_equity[i][j]) + spare_equity[i][j];
+				if(get_flag(defaulting, i, j) == false && frozen_steps < 0)
+					investment[i][j] = 2 * last_investment - previous_investment[i][j];
+			}
+			previous_investment[i][j] = last_investment;
+		}
+	}
+	if(predicted) {
+		iteration_equity = new_equity;
+		new_equity = spare_equity;
+		spare_equity = NULL;
+	}
+	return predicted;
+}
+
+// Undo predict() after the first iteration: iteration_equity points to equity again and investment is that of the preceding time step
+static void reject_prediction() {
+	spare_equity = iteration_equity;
+	iteration_equity = equity;
+	for(int i = 0; i < W_grid_size; ++i)
+		memcpy(investment[i], previous_investment[i], L_grid_size * sizeof(double));
+	++predictions_rejected;
+}
+
+// POLICY FREEZE
+// The moves of the Markov chain at a point are selected by the defaulting flag and the sign of investment there. Once these stay the same from
+// one time step to the next, the policy has settled and mostly the values of investment change, slowly. With policy_freeze_interval > 0,
+// the transition probabilities times disc are then computed once from the investment of the last time step (assemble_chain()) and the
+// following time steps iterate equity with them (apply_chain_row()), without exp(), the transition rates and update_defaulting_investment().
+// On fine grids the boundaries of the regions move across a few points in every time step, so the policy counts as settled if it changed
+// at no more than policy_freeze_changes points.
+// After policy_freeze_interval frozen time steps, a full time step updates investment and defaulting and compares the policy with the one
+// before the frozen time steps. The change of equity in the first iteration serves as a residual monitor: once it grows to more than twice
+// that of the first frozen time step (frozen_change), or a frozen time step does not converge, the full time step comes right away.
+// The drift correction of spatial_order 2 depends on equity nonlinearly, so the policy is never frozen with it. Neither is it with
+// time_scheme 1, whose iterations do not use the chain. The coefficients are stored as one flat array per move, indexed by
+// i * L_grid_size + j, such that the loop over a row only reads contiguous memory.
+
+static double *chain_time, *chain_stay, *chain_W_p, *chain_W_n, *chain_L_p, *chain_L_n;
+
+// Allocate the snapshot of the policy for the current grid sizes unless this has been done already
+void setup_policy_freeze() {
+	if(policy_defaulting == NULL) {
+		policy_defaulting = create_defaulting_WL_grid();
+		policy_sign = create_defaulting_WL_grid();
+	}
+}
+
+// Probabilities of the chain at (i, j) as they enter update_new_equity(), given the probability of the time step (time) and those of the
+// moves (W_p, W_n, L_p, L_n): stay becomes one minus all of them except the moves that update_new_equity() drops, and moves that reach no
+// point of the grid get the coefficient 0. With boundary_condition 1, W_p at W_max and L_p at L_max are kept: they weight the far-field
+// value, i.e. the point itself plus far_field_step(). The result is linear in the arguments, so with one = 0 it maps the tangents of the
+// probabilities (see SENSITIVITIES) in the same way.
+static inline void fold_chain(int i, int j, double one, double time, double *stay, double *W_p, double *W_n, double *L_p, double *L_n) {
+	if(boundary_condition == 1 && (i == 0 || i == (W_grid_size - 1) || j == (L_grid_size - 1))) {
+		if(j == 0)
+			*L_n = 0;
+		*stay = one - *L_p - *W_p - *W_n - *L_n - time;
+		if(i == 0)
+			*W_n = 0;																				// Absorbed with the value 0
+	}
+	else if((i == 0 && j == 0) || (i < W_grid_size - 1 && j == L_grid_size - 1)) {
+		*L_p = *W_p = *W_n = *L_n = 0;
+		*stay = one - time;
+	}
+	else if(i == 0) {
+		*stay = one - *L_p - *W_p - *W_n - *L_n - time;
+		*W_n = 0;																					// Subtracted from stay nevertheless
+	}
+	else {
+		if(i == W_grid_size - 1)
+			*W_p = 0;
+		if(j == 0)
+			*L_n = 0;
+		if(i == W_grid_size - 1 && j == L_grid_size - 1)
+			*L_p = 0;
+		*stay = one - *L_p - *W_p - *W_n - *L_n - time;
+	}
+}
+
+// Compute the coefficients of the frozen time steps from the current investment and grids
+void assemble_chain() {
+	if(chain_time == NULL) {
+		size_t size = (size_t) W_grid_size * L_grid_size * sizeof(double);
+		chain_time = malloc(size);
+		chain_stay = malloc(size);
+		chain_W_p = malloc(size);
+		chain_W_n = malloc(size);
+		chain_L_p = malloc(size);
+		chain_L_n = malloc(size);
+	}
+	# pragma omp parallel for schedule(static)
+	for(int i = 0; i < W_grid_size; ++i) {
+		for(int j = 0; j < L_grid_size; ++j) {
+			double b100p, b100n, b010p, b010n, b020p, b020n;
+			transition_rates(investment[i][j], i, j, &b100p, &b100n, &b010p, &b010n, &b020p, &b020n);
+			double Qf = 1/dT + b100n + b010p + b010n + b100p + (b020p + b020n);
+			double disc = exp(-rhohat / Qf);
+			double ptau = 1 / (Qf * dT);
+			double pxphy = 1/Qf * b100p, pxnhy = 1/Qf * b100n, pxypg = 1/Qf * (b010p + b020p), pxyng = 1/Qf * (b010n + b020n), pxy;
+			fold_chain(i, j, 1, ptau, &pxy, &pxphy, &pxnhy, &pxypg, &pxyng);
+			size_t k = (size_t) i * L_grid_size + j;
+			chain_time[k] = disc * ptau;
+			chain_stay[k] = disc * pxy;
+			chain_W_p[k] = disc * pxphy;
+			chain_W_n[k] = disc * pxnhy;
+			chain_L_p[k] = disc * pxypg;
+			chain_L_n[k] = disc * pxyng;
+		}
+	}
+}
+
+// Frozen counterpart of update_new_equity() for the whole row i. Missing neighbours have the coefficient 0, the row itself stands in for them,
+// except for the far-field moves of boundary_condition 1.
+static void apply_chain_row(int i) {
+	const size_t row = (size_t) i * L_grid_size;
+	const double *restrict c_time = chain_time + row, *restrict c_stay = chain_stay + row;
+	const double *restrict c_W_p = chain_W_p + row, *restrict c_W_n = chain_W_n + row;
+	const double *restrict c_L_p = chain_L_p + row, *restrict c_L_n = chain_L_n + row;
+	const double *restrict e = equity[i], *restrict x = iteration_equity[i];
+	const double *restrict x_W_p = iteration_equity[i < W_grid_size - 1 ? i + 1 : i];
+	const double *restrict x_W_n = iteration_equity[i > 0 ? i - 1 : i];
+	double *restrict y = new_equity[i];
+	const int last = L_grid_size - 1;
+	y[0] = c_time[0] * e[0] + c_stay[0] * x[0] + c_W_p[0] * x_W_p[0] + c_W_n[0] * x_W_n[0] + c_L_p[0] * x[1];
+	for(int j = 1; j < last; ++j)
+		y[j] = c_time[j] * e[j] + c_stay[j] * x[j] + c_W_p[j] * x_W_p[j] + c_W_n[j] * x_W_n[j] + c_L_p[j] * x[j+1] + c_L_n[j] * x[j-1];
+	y[last] = c_time[last] * e[last] + c_stay[last] * x[last] + c_W_p[last] * x_W_p[last] + c_W_n[last] * x_W_n[last] +
+	          c_L_n[last] * x[last-1];
+	if(boundary_condition == 1) {
+		// The far-field moves at W_max and L_max, see fold_chain()
+		if(i == W_grid_size - 1) {
+			for(int j = 0; j <= last; ++j)
+				y[j] += c_W_p[j] * far_field_step(equity, i, j, i - 1, j);
+		}
+		y[last] += c_L_p[last] * (x[last] + far_field_step(equity, i, last, i, last - 1));
+	}
+}
+
+// Number of bits set in x
+static inline int count_flags(uint64_t x) {
+	int count = 0;
+	for(; x; x &= x - 1)
+		++count;
+	return count;
+}
+
+// Called at the end of every time step with policy_freeze_interval > 0. After a frozen time step, counts it and ends the freeze if
+// policy_freeze_interval of them are done or the monitor tripped. After a full time step, freezes the policy if it converged and the defaulting
+// flag or the sign of investment differs from that after the preceding full time step at no more than policy_freeze_changes points. The
+// snapshot then takes the policy of this time step.
+static void update_policy_freeze(bool frozen, bool monitor_tripped) {
+	if(frozen) {
+		++frozen_time_steps;
+		if(++frozen_steps >= policy_freeze_interval || monitor_tripped)
+			frozen_steps = -1;
+		return;
+	}
+	setup_policy_freeze();
+	long long changes = 0;
+	for(int i = 0; i < W_grid_size; ++i) {
+		for(int w = 0; w < FLAG_WORDS(L_grid_size); ++w) {
+			uint64_t signs = 0;
+			for(int j = 64 * w; j < L_grid_size && j < 64 * w + 64; ++j)
+				signs |= (uint64_t) (investment[i][j] > 0) << (j & 63);
+			changes += count_flags((signs ^ policy_sign[i][w]) | (defaulting[i][w] ^ policy_defaulting[i][w]));
+			policy_sign[i][w] = signs;
+			policy_defaulting[i][w] = defaulting[i][w];
+		}
+	}
+	bool settled = policy_snapshot_taken && spatial_order == 1 && time_scheme == 0 && !monitor_tripped && changes <= policy_freeze_changes;
+	policy_snapshot_taken = true;
+	if(settled) {
+		assemble_chain();
+		frozen_steps = 0;
+	}
+}
+
+// Forget the preceding time steps after the terminal values have been set or the state has been replaced: the predictor has nothing to extrapolate
+// from and the policy is not frozen
+static void forget_time_steps() {
+	predictor_history = 0;
+	frozen_steps = -1;
+	policy_snapshot_taken = false;
+}
+
+// ALTERNATING DIRECTION IMPLICIT ITERATIONS (time_scheme 1)
+// update_new_equity() solves the implicit time step of the Markov chain, roughly
+//		(1/dT + rhohat) V - A_W V - A_L V = V_prev / dT,
+// where A_W and A_L are the moves in W and in L, by iterating point by point. An iteration reduces the error by a factor of about
+// 1 / (1 + rhohat * dT) where the rates are large compared with 1/dT, so large time steps need very many iterations. With time_scheme 1, each
+// iteration instead solves the time step for the investment of the preceding iteration in two implicit half-steps,
+//		(1/dT + rhohat/2) V* - A_W V* = V_prev / dT
+//		(1/dT + rhohat/2) V - A_L V = V* / dT
+// (the locally one-dimensional splitting; Peaceman-Rachford would need explicit half-steps, which lose the monotonicity of the chain for
+// large dT). Every half-step is a set of independent tridiagonal systems, one per line of the grid in W or in L, solved by the Thomas
+// algorithm. The lines in W are solved side by side: the loops over i run outside, those over j along the rows inside, where the compiler
+// vectorizes them, and blocks of ADI_BLOCK lines go to the threads. The lines in L are rows and are divided among the threads. Investment and
+// defaulting are updated from the result as before, so the iterations of a time step become a policy iteration, which needs a few of them
+// for any dT. The splitting adds an error of first order in dT, like that of the implicit time step itself.
+// The moves off the grid are treated like in update_new_equity(): dropped, absorbed with the value 0 at W_min, or with boundary_condition 1
+// at W_max and L_max a far-field move. The drift correction of spatial_order 2 is added to the right-hand side of the first half-step. The
+// coefficients are stored like those of the frozen chain, indexed by i * L_grid_size + j.
+
+#define ADI_BLOCK 16
+
+static double *adi_W_lower, *adi_W_diag, *adi_W_upper, *adi_L_lower, *adi_L_diag, *adi_L_upper;
+static double *adi_half;																			// Right-hand side and solution V* of the first half-step
+static double *adi_factor;																			// Eliminated upper coefficients of the Thomas algorithm
+
+// Coefficients of the two half-steps at (i, j) for the current investment and the right-hand side of the first half-step
+static void adi_coefficients(int i, int j) {
+	const int last_i = W_grid_size - 1, last_j = L_grid_size - 1;
+	double b100p, b100n, b010p, b010n, b020p, b020n;
+	transition_rates(investment[i][j], i, j, &b100p, &b100n, &b010p, &b010n, &b020p, &b020n);
+	double b_L_p = b010p + b020p, b_L_n = b010n + b020n;
+
+	// Rates towards the preceding and the next point of the line and the total rate out of (i, j). A far-field move of boundary_condition
+	// 1 does not leave (i, j) and only adds its rate times far_field_step() to the right-hand side.
+	double W_n = 0, W_p = 0, W_out = 0, L_n = 0, L_p = 0, L_out = 0;
+	const bool far_field = boundary_condition == 1;
+	if(far_field || !((i == 0 && j == 0) || (i < last_i && j == last_j))) {
+		if(i > 0) {
+			W_n += b100n;
+			W_out += b100n;
+		}
+		else
+			W_out += b100n;																			// Absorbed with the value 0
+		if(i < last_i) {
+			W_p += b100p;
+			W_out += b100p;
+		}
+		if(j > 0) {
+			L_n += b_L_n;
+			L_out += b_L_n;
+		}
+		if(j < last_j) {
+			L_p += b_L_p;
+			L_out += b_L_p;
+		}
+	}
+
+	size_t k = (size_t) i * L_grid_size + j;
+	adi_W_lower[k] = -W_n;
+	adi_W_diag[k] = 1/dT + 0.5 * rhohat + W_out;
+	adi_W_upper[k] = -W_p;
+	adi_L_lower[k] = -L_n;
+	adi_L_diag[k] = 1/dT + 0.5 * rhohat + L_out;
+	adi_L_upper[k] = -L_p;
+	adi_half[k] = equity[i][j] / dT;
+	if(far_field && i == last_i)
+		adi_half[k] += b100p * far_field_step(equity, i, j, i - 1, j);
+	if(far_field && j == last_j)
+		adi_half[k] += b_L_p * far_field_step(equity, i, j, i, j - 1);
+	if(spatial_order == 2 && i > 0 && i < last_i && j > 0 && j < last_j)
+		adi_half[k] += drift_correction(iteration_equity, i, j, b100p, b100n, b010p, b010n);
+}
+
+// Solve the lines in W through the columns j_begin to j_end - 1 side by side, adi_half holds the right-hand sides and then V*
+static void solve_W_lines(int j_begin, int j_end) {
+	const size_t L = L_grid_size;
+	double *restrict x = adi_half, *restrict f = adi_factor;
+	const double *restrict lower = adi_W_lower, *restrict diag = adi_W_diag, *restrict upper = adi_W_upper;
+	for(int j = j_begin; j < j_end; ++j) {
+		f[j] = upper[j] / diag[j];
+		x[j] = x[j] / diag[j];
+	}
+	for(int i = 1; i < W_grid_size; ++i) {
+		const size_t row = i * L;
+		for(int j = j_begin; j < j_end; ++j) {
+			double m = 1 / (diag[row + j] - lower[row + j] * f[row - L + j]);
+			f[row + j] = upper[row + j] * m;
+			x[row + j] = (x[row + j] - lower[row + j] * x[row - L + j]) * m;
+		}
+	}
+	for(int i = W_grid_size - 2; i >= 0; --i) {
+		const size_t row = i * L;
+		for(int j = j_begin; j < j_end; ++j)
+			x[row + j] -= f[row + j] * x[row + L + j];
+	}
+}
+
+// Solve the line in L through row i, from V* into new_equity
+static void solve_L_line(int i) {
+	const size_t row = (size_t) i * L_grid_size;
+	const double *restrict lower = adi_L_lower + row, *restrict diag = adi_L_diag + row, *restrict upper = adi_L_upper + row;
+	const double *restrict half = adi_half + row;
+	double *restrict f = adi_factor + row, *restrict y = new_equity[i];
+	f[0] = upper[0] / diag[0];
+	y[0] = half[0] / dT / diag[0];
+	for(int j = 1; j < L_grid_size; ++j) {
+		double m = 1 / (diag[j] - lower[j] * f[j-1]);
+		f[j] = upper[j] * m;
+		y[j] = (half[j] / dT - lower[j] * y[j-1]) * m;
+	}
+	for(int j = L_grid_size - 2; j >= 0; --j)
+		y[j] -= f[j] * y[j+1];
+}
+
+// One iteration with time_scheme 1: fill new_equity with the solution of the time step for the current investment
+static void adi_iteration() {
+	if(adi_half == NULL) {
+		size_t size = (size_t) W_grid_size * L_grid_size * sizeof(double);
+		adi_W_lower = malloc(size);
+		adi_W_diag = malloc(size);
+		adi_W_upper = malloc(size);
+		adi_L_lower = malloc(size);
+		adi_L_diag = malloc(size);
+		adi_L_upper = malloc(size);
+		adi_half = malloc(size);
+		adi_factor = malloc(size);
+	}
+	# pragma omp parallel for schedule(static)
+	for(int i = 0; i < W_grid_size; ++i) {
+		for(int j = 0; j < L_grid_size; ++j)
+			adi_coefficients(i, j);
+	}
+	const int blocks = (L_grid_size + ADI_BLOCK - 1) / ADI_BLOCK;
+	# pragma omp parallel for schedule(static)
+	for(int block = 0; block < blocks; ++block) {
+		int j_end = (block + 1) * ADI_BLOCK;
+		solve_W_lines(block * ADI_BLOCK, j_end < L_grid_size ? j_end : L_grid_size);
+	}
+	# pragma omp parallel for schedule(static)
+	for(int i = 0; i < W_grid_size; ++i)
+		solve_L_line(i);
+}
+
+// SENSITIVITIES
+// With --sensitivity, the solver computes the derivatives of equity with respect to the chosen parameters in the same backward pass, in
+// forward mode: every value the solver computes from the parameters, i.e. terminal equity, the rates, probabilities and discount factor of
+// the Markov chain and investment, carries its derivatives along (a dual number), and every value of equity and investment on the grid has a
+// tangent per parameter. The tangents go through the iterations of the time steps with the values and are rotated with them in step(), so
+// once the iterations have converged, the tangent of equity is the derivative of the solution of the discrete scheme, which finite
+// differences of two solves approach for small bumps and tight tolerances. The defaulting flags and the cases of the computation (upwind
+// directions, bounds of stabilized_investment()) are piecewise constant in the parameters and have no tangent.
+// The tangents of a grid point are stored next to each other, one lane per parameter at ((i * L_grid_size + j) * sensitivity_count + k), so
+// the values the lanes depend on are computed once per point and the loops over the lanes are contiguous, where the compiler vectorizes them.
+// Only the point-wise iterations with spatial_order 1 on fixed grids are differentiated, and investment has to be bounded by investment_q_max,
+// see setup_sensitivities().
+
+static double *equity_tangent, *iteration_tangent, *new_tangent, *spare_tangent;					// Like equity, iteration_equity, ...
+static double *investment_tangent;
+
+// Finite differences of equity_derivatives() in W and in L, in L also where the point below defaults, see difference_stencil()
+struct stencil {
+	int index[3];
+	double weight[3];
+};
+static struct stencil *W_stencil, *L_stencil, *L_forward_stencil;
+
+// Derivatives of the parameters, and of the values derived from them, with respect to the parameter of each lane
+static struct {
+	double r[SENSITIVITY_PARAMETERS], lambda[SENSITIVITY_PARAMETERS], sigma[SENSITIVITY_PARAMETERS], delta[SENSITIVITY_PARAMETERS];
+	double psi[SENSITIVITY_PARAMETERS], taxe[SENSITIVITY_PARAMETERS], taxi[SENSITIVITY_PARAMETERS], taxc[SENSITIVITY_PARAMETERS];
+	double P[SENSITIVITY_PARAMETERS], theta[SENSITIVITY_PARAMETERS], premium[SENSITIVITY_PARAMETERS];
+	double coupon[SENSITIVITY_PARAMETERS], rhohat[SENSITIVITY_PARAMETERS];
+	double tax[SENSITIVITY_PARAMETERS];																// Of (1 - taxc) * (1 - taxe)
+} seed;
+
+static inline double* lanes(double *tangent, int i, int j) {
+	return tangent + ((size_t) i * L_grid_size + j) * sensitivity_count;
+}
+
+// Weights of the finite difference of equity_derivatives() at the point k of the grid with n points and the distances step_p and step_n, or
+// step if uniform: the derivative is the sum of weight[m] times the value at index[m]. With forward, the difference is one-sided towards
+// k + 1 except at the last point, like that in L where the point below defaults.
+static struct stencil difference_stencil(const double *grid, const double *step_p, const double *step_n, double step, int n, bool uniform,
+                                         int k, bool forward) {
+	struct stencil s = {{k, k, k}, {0, 0, 0}};
+	if(k == n - 1) {
+		s.index[0] = k - 2;
+		s.weight[2] = uniform ? 1 / (2 * step) : 1 / (grid[k] - grid[k - 2]);
+		s.weight[0] = - s.weight[2];
+	}
+	else if(k == 0 || forward) {
+		s.index[2] = k + 1;
+		s.weight[2] = uniform ? 1 / step : 1 / step_p[k];
+		s.weight[1] = - s.weight[2];
+	}
+	else {
+		double h_n = uniform ? step : step_n[k], h_p = uniform ? step : step_p[k], d = h_n * h_p * (h_n + h_p);
+		s.index[0] = k - 1, s.index[2] = k + 1;
+		s.weight[0] = - h_p * h_p / d, s.weight[1] = (h_p * h_p - h_n * h_n) / d, s.weight[2] = h_n * h_n / d;
+	}
+	return s;
+}
+
+// Checks that the numerical method supports the sensitivities, allocates the tangents and sets those of the parameters, of the terminal
+// values of terminal_equity_default() and of the initial investment. Returns 0 if successful, 1 if the selected numerical method is not
+// supported.
+static int setup_sensitivities() {
+	const char *unsupported = predictor_order > 0 ? "predictor_order" : policy_freeze_interval > 0 ? "policy_freeze_interval" :
+		time_scheme != 0 ? "time_scheme" : spatial_order != 1 ? "spatial_order" : NULL;
+	if(unsupported != NULL) {
+		printf("Option --sensitivity does not support %s other than the default\n", unsupported);
+		return 1;
+	}
+	if(resume) {
+		printf("Option --sensitivity does not support --resume, the checkpoint does not hold the tangents\n");
+		return 1;
+	}
+	if(investment_q_max == 0) {
+		// Where equity_W vanishes, the derivative of the unbounded investment is unbounded as well, and the tangents overflow
+		printf("Option --sensitivity requires investment_q_max\n");
+		return 1;
+	}
+
+	const int K = sensitivity_count;
+	if(equity_tangent == NULL) {
+		size_t size = (size_t) W_grid_size * L_grid_size * K * sizeof(double);
+		equity_tangent = malloc(size);
+		new_tangent = malloc(size);
+		spare_tangent = malloc(size);
+		investment_tangent = malloc(size);
+		equity_sensitivity = malloc(K * sizeof(double**));
+		for(int k = 0; k < K; ++k)
+			equity_sensitivity[k] = create_equity_WL_grid();
+		W_stencil = malloc(W_grid_size * sizeof(struct stencil));
+		L_stencil = malloc(L_grid_size * sizeof(struct stencil));
+		L_forward_stencil = malloc(L_grid_size * sizeof(struct stencil));
+	}
+	for(int i = 0; i < W_grid_size; ++i)
+		W_stencil[i] = difference_stencil(W_grid, dW_p, dW_n, dW, W_grid_size, uniform_grids, i, false);
+	for(int j = 0; j < L_grid_size; ++j) {
+		L_stencil[j] = difference_stencil(L_grid, dL_p, dL_n, dL, L_grid_size, uniform_grids, j, false);
+		L_forward_stencil[j] = difference_stencil(L_grid, dL_p, dL_n, dL, L_grid_size, uniform_grids, j, true);
+	}
+	iteration_tangent = equity_tangent;
+
+	memset(&seed, 0, sizeof seed);
+	double *const seeds[SENSITIVITY_PARAMETERS] = {seed.r, seed.lambda, seed.sigma, seed.delta, seed.psi, seed.taxe, seed.taxi, seed.taxc,
+	                                               seed.P, seed.theta, seed.premium};
+	for(int k = 0; k < K; ++k) {
+		seeds[sensitivity_parameter[k]][k] = 1;
+		seed.coupon[k] = (seed.r[k] + seed.premium[k]) * P + (r + premium) * seed.P[k];
+		seed.rhohat[k] = (1 - taxi) * seed.r[k] - r * seed.taxi[k];
+		seed.tax[k] = - (1 - taxe) * seed.taxc[k] - (1 - taxc) * seed.taxe[k];
+	}
+
+	for(int i = 0; i < W_grid_size; ++i) {
+		for(int j = 0; j < L_grid_size; ++j) {
+			double *d_equity = lanes(equity_tangent, i, j), *d_investment = lanes(investment_tangent, i, j);
+			for(int k = 0; k < K; ++k) {
+				if(equity[i][j] == 0)
+					d_equity[k] = 0;
+				else if(W_grid[i] >= 0)
+					d_equity[k] = - W_grid[i] * seed.taxe[k] - seed.P[k];
+				else
+					d_equity[k] = - seed.P[k] - L_grid[j] * seed.theta[k];
+				d_investment[k] = L_grid[j] * seed.delta[k];
+			}
+		}
+	}
+	return 0;
+}
+
+// Tangent of update_new_equity() for the row i: fills new_tangent from equity_tangent, iteration_tangent and investment_tangent, with the
+// values update_new_equity() uses in the same iteration. The probabilities are folded like in assemble_chain(), which for boundary_condition 1
+// is the same as the far field of update_new_equity(). The folding is linear, so instead of folding the tangents of the probabilities of
+// every lane, the values are folded once per point: y[m] is the value the move m (time, W_p, W_n, L_p, L_n) ends up weighting, and the sum of
+// the folded probabilities times the values is that of the probabilities of the moves times y, plus the value at (i, j).
+static void update_new_tangent_row(int i) {
+	const int K = sensitivity_count;
+	const double tax = (1 - taxc) * (1 - taxe);
+	const double W = W_grid[i], W_positive = W >= 0 ? W : 0, W_negative = W < 0 ? myabs(W) : 0;
+	const bool has_W_p = i < W_grid_size - 1, has_W_n = i > 0;
+	const double inv_dT = 1/dT, diffusion = uniform_grids ? square(1/dL) * sigma : sigma;			// With the factors of b020p
+	for(int j = 0; j < L_grid_size; ++j) {
+		const double q = investment[i][j], L = L_grid[j];
+		const bool positive = q > 0;
+		double b100p, b100n, b010p, b010n, b020p, b020n;
+		transition_rates(q, i, j, &b100p, &b100n, &b010p, &b010n, &b020p, &b020n);
+		const double inv_Qf = 1 / (inv_dT + b100n + b010p + b010n + b100p + (b020p + b020n));
+		const double disc = exp(-rhohat * inv_Qf);
+		double p[5] = {inv_Qf * inv_dT, inv_Qf * b100p, inv_Qf * b100n, inv_Qf * (b010p + b020p), inv_Qf * (b010n + b020n)};
+		double c[5] = {p[0], p[1], p[2], p[3], p[4]}, c_stay;
+		fold_chain(i, j, 1, c[0], &c_stay, &c[1], &c[2], &c[3], &c[4]);
+
+		const double e_time = equity[i][j], e_stay = iteration_equity[i][j];
+		// The far-field moves of boundary_condition 1 go to the point itself plus the step, whose tangent is that of the preceding time step
+		const bool far_W = boundary_condition == 1 && !has_W_p, far_L = boundary_condition == 1 && j == L_grid_size - 1;
+		const double step_W = far_W ? far_field_step(equity, i, j, i - 1, j) : 0, step_L = far_L ? far_field_step(equity, i, j, i, j - 1) : 0;
+		const double e_W_p = has_W_p ? iteration_equity[i+1][j] : far_W ? e_stay + step_W : 0;
+		const double e_W_n = has_W_n ? iteration_equity[i-1][j] : 0;
+		const double e_L_p = j < L_grid_size - 1 ? iteration_equity[i][j+1] : far_L ? e_stay + step_L : 0;
+		const double e_L_n = j > 0 ? iteration_equity[i][j-1] : 0;
+		// In the interior, stay is one minus the other probabilities and nothing else is folded
+		double y[5] = {e_time - e_stay, e_W_p - e_stay, e_W_n - e_stay, e_L_p - e_stay, e_L_n - e_stay};
+		if(!has_W_p || !has_W_n || j == 0 || j == L_grid_size - 1) {
+			for(int m = 0; m < 5; ++m) {
+				double u[5] = {0, 0, 0, 0, 0}, u_stay;
+				u[m] = 1;
+				fold_chain(i, j, 0, u[0], &u_stay, &u[1], &u[2], &u[3], &u[4]);
+				y[m] = u[0] * e_time + u_stay * e_stay + u[1] * e_W_p + u[2] * e_W_n + u[3] * e_L_p + u[4] * e_L_n;
+			}
+		}
+		const double Y = p[0] * y[0] + p[1] * y[1] + p[2] * y[2] + p[3] * y[3] + p[4] * y[4];
+		const double S = e_stay + Y;																// Value of update_new_equity() divided by disc
+
+		// The terms of the rates in transition_rates(), their partial derivatives by investment and those of b020p and b020n by sigma
+		const double base_p = delta * L + W_positive * (r - lambda) + (positive ? 0 : myabs(q));
+		const double base_n = coupon + W_negative * r + (positive ? myabs(q) : 0) + 0.5 * square(q) * psi;
+		const double base_p_q = positive ? 0 : -1, base_n_q = (positive ? 1 : 0) + q * psi;
+		const double L_p_q = positive ? inv_dL_p[j] : 0;
+		double diffusion_p = diffusion * square(L), diffusion_n = diffusion_p;
+		if(!uniform_grids) {
+			diffusion_p *= 2 / (dL_p[j] * dL_n[j] * (dL_p[j] + dL_n[j]));
+			diffusion_n = diffusion_p * dL_p[j];
+			diffusion_p *= dL_n[j];
+		}
+		const double scale = disc * inv_Qf, half_q2 = 0.5 * square(q);
+		const double c_time = disc * c[0], c_W_p = disc * c[1], c_W_n = disc * c[2], c_L_p = disc * c[3], c_L_n = disc * c[4];
+		c_stay *= disc;
+
+		const double *d_q = lanes(investment_tangent, i, j), *d_time = lanes(equity_tangent, i, j);
+		const double *d_stay = lanes(iteration_tangent, i, j);
+		const double *d_W_p = has_W_p ? lanes(iteration_tangent, i + 1, j) : d_stay;
+		const double *d_W_n = has_W_n ? lanes(iteration_tangent, i - 1, j) : d_stay;
+		const double *d_L_p = j < L_grid_size - 1 ? lanes(iteration_tangent, i, j + 1) : d_stay;
+		const double *d_L_n = j > 0 ? lanes(iteration_tangent, i, j - 1) : d_stay;
+		double *d_new = lanes(new_tangent, i, j);
+		for(int k = 0; k < K; ++k) {
+			double db100p = inv_dW_p[i] * ( seed.tax[k] * base_p +
+				tax * ( L * seed.delta[k] + W_positive * (seed.r[k] - seed.lambda[k]) + base_p_q * d_q[k] ) );
+			double db100n = inv_dW_n[i] * ( seed.tax[k] * base_n +
+				tax * ( seed.coupon[k] + W_negative * seed.r[k] + base_n_q * d_q[k] + half_q2 * seed.psi[k] ) );
+			double db010p = L_p_q * d_q[k];
+			double db010n = inv_dL_n[j] * ( L * seed.delta[k] + base_p_q * d_q[k] );
+			double db020p = diffusion_p * seed.sigma[k], db020n = diffusion_n * seed.sigma[k];
+			double dQf = db100n + db010p + db010n + db100p + (db020p + db020n);
+			// disc * (1 + d log(disc)) * S + disc * (sum of the tangents of the probabilities of the moves times y), plus the coefficients
+			// times the tangents of the values
+			d_new[k] = scale * ( (rhohat * inv_Qf * dQf - seed.rhohat[k]) * S +
+			                     db100p * y[1] + db100n * y[2] + (db010p + db020p) * y[3] + (db010n + db020n) * y[4] - dQf * Y ) +
+			           c_time * d_time[k] + c_stay * d_stay[k] + c_W_p * d_W_p[k] + c_W_n * d_W_n[k] + c_L_p * d_L_p[k] + c_L_n * d_L_n[k];
+		}
+		if(step_W > 0) {
+			const double *d_W_in = lanes(equity_tangent, i - 1, j);
+			for(int k = 0; k < K; ++k)
+				d_new[k] += c_W_p * (d_time[k] - d_W_in[k]);
+		}
+		if(step_L > 0) {
+			const double *d_L_in = lanes(equity_tangent, i, j - 1);
+			for(int k = 0; k < K; ++k)
+				d_new[k] += c_L_p * (d_time[k] - d_L_in[k]);
+		}
+	}
+}
+
+// Tangent of update_defaulting_investment(), called after it with the defaulting flags it has set: updates investment_tangent from
+// new_tangent
+static void update_investment_tangent() {
+	const int K = sensitivity_count;
+	const bool uniform = uniform_grids;
+	const double relaxation = investment_q_max > 0 || investment_relaxation < 1 ? investment_relaxation : 1;
+	const double inv_psi = 1 / psi;
+	# pragma omp parallel for schedule(static)
+	for(int i = 0; i < W_grid_size; ++i) {
+		const struct stencil *W_s = &W_stencil[i];
+		for(int j = 0; j < L_grid_size; ++j) {
+			double *d_q = lanes(investment_tangent, i, j);
+			if(get_flag(defaulting, i, j)) {
+				for(int k = 0; k < K; ++k)
+					d_q[k] = 0;
+				continue;
+			}
+			double e_W, e_L;
+			equity_derivatives(new_equity, i, j, uniform, &e_W, &e_L);
+			const struct stencil *L_s = j > 0 && get_flag(defaulting, i, j - 1) ? &L_forward_stencil[j] : &L_stencil[j];
+			const double *d_W0 = lanes(new_tangent, W_s->index[0], j), *d_W1 = lanes(new_tangent, i, j);
+			const double *d_W2 = lanes(new_tangent, W_s->index[2], j);
+			const double *d_L0 = lanes(new_tangent, i, L_s->index[0]), *d_L2 = lanes(new_tangent, i, L_s->index[2]);
+
+			// Investment is (e_L - u) / (psi * cash_value) with u = (1 - taxc) * e_W and cash_value = |u|, or |e_L| / investment_q_max
+			// where that is larger, relaxed as in stabilized_investment()
+			double u = (1 - taxc) * e_W, cash_value = myabs(u);
+			double bound = investment_q_max > 0 ? myabs(e_L) / investment_q_max : 0;
+			bool bounded = bound > cash_value;
+			if(bounded)
+				cash_value = bound;
+			const double inv_denominator = cash_value > 0 ? 1 / (psi * cash_value) : 0, inv_cash_value = psi * inv_denominator;
+			const double target = (e_L - u) * inv_denominator;
+			const double cash_value_L = bounded ? (e_L < 0 ? -1 : 1) / investment_q_max : 0;		// Partial derivatives of cash_value
+			const double cash_value_u = bounded ? 0 : (u < 0 ? -1 : 1);
+			for(int k = 0; k < K; ++k) {
+				double de_W = W_s->weight[0] * d_W0[k] + W_s->weight[1] * d_W1[k] + W_s->weight[2] * d_W2[k];
+				double de_L = L_s->weight[0] * d_L0[k] + L_s->weight[1] * d_W1[k] + L_s->weight[2] * d_L2[k];
+				double du = (1 - taxc) * de_W - seed.taxc[k] * e_W;
+				double dcash_value = cash_value_L * de_L + cash_value_u * du;
+				double dtarget = (de_L - du) * inv_denominator - target * (seed.psi[k] * inv_psi + dcash_value * inv_cash_value);
+				d_q[k] += relaxation * (dtarget - d_q[k]);
+			}
+		}
+	}
+}
+
+// Fill equity_sensitivity from the tangents of the current equity
+static void store_sensitivities() {
+	for(int i = 0; i < W_grid_size; ++i) {
+		for(int j = 0; j < L_grid_size; ++j) {
+			const double *d_equity = lanes(equity_tangent, i, j);
+			for(int k = 0; k < sensitivity_count; ++k)
+				equity_sensitivity[k][i][j] = d_equity[k];
+		}
+	}
+}
+
+// Distance to the fixed point of the iterations estimated from the norms of the changes in the last and the preceding iteration: for a
+// contraction with rate rho, it is at most change / (1 - rho), and rho is estimated by change / previous_change. On finer grids rho is
+// closer to 1, so the tolerance asks for a smaller change. Only used with convergence_norm 1 to 3, with 0 the change itself is compared.
+// In the first iteration there is no rate yet, and where investment oscillates (near W_max without investment_q_max) the change does not
+// decrease at all. In both cases the change itself is compared as well, so the iterations neither take a second iteration by force nor
+// run to iteration_max only because the rate cannot be estimated.
+static inline double iteration_error(double change, double previous_change) {
+	if(convergence_norm == 0 || !(change < previous_change))
+		return change;
+	return change * previous_change / (previous_change - change);
+}
+
 // Perform a time step
 #if defined(DEBUG_EQUITY_time) || defined(DEBUG_DEFAULTING_INVESTMENT_time) || defined(DEBUG_WRITE_time) || defined(DEBUG_GDB)
 void step(int t) {
@@ -543,7 +1468,14 @@ void step() {
 #endif
 	// The following three variables are declared outside the loop so that we print information about them after the loop if necessary
 	int iteration = 1;
-	double sum_squared_equity_change;																
+	double equity_change, previous_change = 0;
+	const int norm = convergence_norm;
+	const double tolerance = convergence_tolerance();
+	const bool frozen = frozen_steps >= 0;
+	const bool implicit = time_scheme == 1;
+	const bool tangents = sensitivity_count > 0;
+	bool monitor_tripped = false;
+	bool predicted = predictor_order > 0 && predict();
 	double **tmp;																					
 	for(; iteration <= iteration_max; ++iteration) {
 		// We try to find the optimal investment decision iteratively.
@@ -554,56 +1486,104 @@ void step() {
 		printf("Entering iteration %i\n", iteration);
 		#endif
 		
-		sum_squared_equity_change = 0;
-
 		// PARALLELIZED
 		// update_new_equity() needs equity to point to equity of previous time step, iteration_equity to point to equity of previous iteration step, and
 		// investment to point to investment of previous iteration step.  This means we can simply loop over the cash loan grid with parallel for loops.
 		//
-		// Explanation: Each thread has a private copy of sum_squared_equity_change that gets reduced to one in the end by adding, the collapse(2) allows for
-		// parallelizing both loops in one go (it simply transforms the nested loop into one loop, and parallelizes that. schedule(static) divides the loop into
-		// equal-sized chunks for each thread, which produces little overhead and works well if every loop iteration is similarly intensive.
+		// Explanation: The rows of the grid are divided among the threads. Each row is done by one thread, which sums the squared changes of the row
+		// in the order of the grid. The row sums are then added in a fixed tree by pairwise_sum(), so that equity_change, and with it
+		// the iteration at which we leave the loop, do not depend on the number of threads. An OpenMP reduction would add the partial sums of the
+		// threads in an order that depends on the number of threads and the scheduling. schedule(static) divides the loop into equal-sized chunks
+		// for each thread, which produces little overhead and works well if every loop iteration is similarly intensive.
 		//
 		// The schedule(static) in the following does not actually seem to have an effect!
 		// I was only able to affect the value reported by get_omp_schedule() by setting it in a serial part of the code.
 		// If you perform changes, be sure to inspect with the OMP runtime functions.
 		// However, performance did not change at all between different scheduling settings or chunk sizes.
 		
-		# pragma omp parallel for reduction(+:sum_squared_equity_change) schedule(static) collapse(2)
+		// With time_scheme 1, adi_iteration() solves for the whole grid at once, and the loop only sums up the changes
+		if(implicit)
+			adi_iteration();
+		# pragma omp parallel for schedule(static)
 		for(int i = 0; i < W_grid_size; ++i) {
+			if(frozen)
+				apply_chain_row(i);
+			else if(!implicit) {
+				for(int j = 0; j < L_grid_size; ++j) {
+					// Compute new equity values for each position (i, j) in the cash-loan grid
+					// The equity value depends also on the optimal investment strategy.
+					// In the first iteration this is the investment guess from the previously computed point in time.
+					// In later iterations we use the investment determined in the preceding iteration.
+					#if defined(DEBUG_EQUITY_time) || defined(DEBUG_WRITE_time) || defined(DEBUG_GDB)
+					update_new_equity(new_equity, equity, iteration_equity, investment, i, j, t, iteration);
+					#else
+					update_new_equity(new_equity, equity, iteration_equity, investment, i, j);
+					#endif
+
+					//#ifdef DEBUG_PRINT_EQUITY_UPDATE
+					//printf("Pos. (%i, %i) -- New:\t%f\tPrev:\t%f\n", i, j, new_equity[i][j], iteration_equity[i][j]);
+					//#endif
+				}
+				if(tangents)
+					update_new_tangent_row(i);
+			}
+			double row_change = 0, row_max = 0, row_magnitude = 0;
 			for(int j = 0; j < L_grid_size; ++j) {
-				// Compute new equity values for each position (i, j) in the cash-loan grid
-				// The equity value depends also on the optimal investment strategy.
-				// In the first iteration this is the investment guess from the previously computed point in time.
-				// In later iterations we use the investment determined in the preceding iteration.
-				#if defined(DEBUG_EQUITY_time) || defined(DEBUG_WRITE_time) || defined(DEBUG_GDB)
-				update_new_equity(new_equity, equity, iteration_equity, investment, i, j, t, iteration);
-				#else
-				update_new_equity(new_equity, equity, iteration_equity, investment, i, j);
-				#endif
-
-				//#ifdef DEBUG_PRINT_EQUITY_UPDATE
-				//printf("Pos. (%i, %i) -- New:\t%f\tPrev:\t%f\n", i, j, new_equity[i][j], iteration_equity[i][j]);
-				//#endif
-				sum_squared_equity_change += square(new_equity[i][j] - iteration_equity[i][j]);
+				row_change += square(new_equity[i][j] - iteration_equity[i][j]);
+				if(norm != 0) {
+					row_max = max(row_max, myabs(new_equity[i][j] - iteration_equity[i][j]));
+					row_magnitude += square(new_equity[i][j]);
+				}
+			}
+			row_equity_change[i] = row_change;
+			row_equity_change_max[i] = row_max;
+			row_equity_magnitude[i] = row_magnitude;
+		}
+		equity_change = convergence_measure();
+		if(iteration == 1 && predictor_order > 0) {
+			if(predicted && equity_change > predictor_change) {
+				// The prediction made things worse, start over from the preceding time step. The iteration is counted nevertheless.
+				reject_prediction();
+				predicted = false;
+				++iterations_performed;
+				--iteration;
+				continue;
 			}
+			if(!predicted)
+				predictor_change = equity_change;
+		}
+		if(iteration == 1 && frozen) {
+			if(frozen_steps == 0)
+				frozen_change = equity_change;
+			else if(equity_change > 2 * frozen_change)
+				monitor_tripped = true;
 		}
 		
 		// POSSIBLY PARALLELIZE THIS AS WELL, SAME AS ABOVE.
 		// BE CAREFUL, the update_defaulting_investment() code also uses defaulting[i][j-1] !!!
 
-		// In any case, we need these for the next iteration or the next time step.
-		#if defined(DEBUG_DEFAULTING_INVESTMENT_time) || defined(DEBUG_WRITE_time) || defined(DEBUG_GDB)
-		update_defaulting_investment(t, iteration);
-		#else
-		update_defaulting_investment();
-		#endif
+		// In any case, we need these for the next iteration or the next time step, unless the policy is frozen.
+		if(!frozen) {
+			#if defined(DEBUG_DEFAULTING_INVESTMENT_time) || defined(DEBUG_WRITE_time) || defined(DEBUG_GDB)
+			update_defaulting_investment(t, iteration);
+			#else
+			update_defaulting_investment();
+			#endif
+			if(tangents)
+				update_investment_tangent();
+		}
 
 		// Update iteration_equity
 		// A the end of each iteration in the outer loop, iteration_equity points to the most recently computed equity value.
+		// In the first iteration, iteration_equity points to equity, which we need for the whole time step, so we continue with spare_equity.
 		tmp = iteration_equity;
 		iteration_equity = new_equity;
-		new_equity = tmp;
+		new_equity = tmp == equity ? spare_equity : tmp;
+		if(tangents) {
+			double *tangent = iteration_tangent;
+			iteration_tangent = new_tangent;
+			new_tangent = tangent == equity_tangent ? spare_tangent : tangent;
+		}
 
 		#ifdef DEBUG_PRINT_EQUITY_UPDATE
 		printf("Equity after iteration %i:\n", iteration);
@@ -621,7 +1601,7 @@ void step() {
 		#endif
 
 		#ifdef DEBUG_PRINT_ITERATION_INNER
-		printf("End iteration %i\t Change:%f\n", iteration, sum_squared_equity_change);
+		printf("End iteration %i\t Change:%f\n", iteration, equity_change);
 		#endif
 
 		#if defined(DEBUG_WRITE_time) && defined(DEBUG_WRITE_iteration)
@@ -637,12 +1617,21 @@ void step() {
 		#endif
 
 		// If equity value does not change much, break.
-		if(sum_squared_equity_change < iteration_tol)
+		if(iteration_error(equity_change, previous_change) < tolerance)
 			break;
+		previous_change = equity_change;
 	}
 	#ifdef DEBUG_PRINT_ITERATION
-	printf("-- Exited after iteration: %i\t-- Change:%f\n", iteration, sum_squared_equity_change);
+	printf("-- Exited after iteration: %i\t-- Change:%f\n", iteration, equity_change);
 	#endif
+	++time_steps_solved;
+	if(policy_freeze_interval > 0)
+		update_policy_freeze(frozen, monitor_tripped || iteration > iteration_max);
+	if(iteration > iteration_max) {
+		++time_steps_at_iteration_max;
+		iteration = iteration_max;
+	}
+	iterations_performed += iteration;
 
 	#ifdef DEBUG_PRINT_FINAL_TWO_EQUITY_ITERATIONS
 	printf("Equity value of last iteration:\n");
@@ -653,12 +1642,29 @@ void step() {
 
 	// When exiting the iteration loop, iteration_equity contains the most recently computed equity value.
 	// We also need iteration_equity to contain these values for the first iteration of the next time step.
-	// Therefore we need to copy values.
-	for(int i = 0; i < W_grid_size; ++i) {															
-		for(int j = 0; j < L_grid_size; ++j) {
-			equity[i][j] = iteration_equity[i][j];
-		}
+	// Instead of copying, equity now points to the same grid, and the grid of the preceding time step becomes the spare grid.
+	spare_equity = equity;
+	equity = iteration_equity;
+	if(tangents) {
+		spare_tangent = equity_tangent;
+		equity_tangent = iteration_tangent;
 	}
+	if(predictor_history < 2)
+		++predictor_history;
+}
+
+// Print how many iterations the time steps needed and the convergence criterion
+void print_iteration_counts() {
+	static const char *const norm_names[] = {"sum of squared changes", "largest change", "root mean square change",
+		"relative root mean square change"};
+	printf("Iterations: %.2f per time step, %lld of %lld time steps stopped at iteration_max without converging.\n",
+		time_steps_solved > 0 ? (double) iterations_performed / time_steps_solved : 0, time_steps_at_iteration_max, time_steps_solved);
+	printf("Convergence criterion: %s of equity%s below %g\n", norm_names[convergence_norm],
+		convergence_norm != 0 ? " divided by one minus its rate of decrease" : "", convergence_tolerance());
+	if(predictor_order > 0)
+		printf("Predictor of order %i, rejected in %lld time steps.\n", predictor_order, predictions_rejected);
+	if(policy_freeze_interval > 0)
+		printf("Policy frozen in %lld of %lld time steps.\n", frozen_time_steps, time_steps_solved);
 }
 
 // Used for printing information when debugging
@@ -680,18 +1686,21 @@ void print_intermediate_result(double t) {
 	printf("Defaulting flag at time %f\n", t);
 	for(int i = 0; i < W_grid_size; ++i) {
 		for(int j = 0; j < L_grid_size; ++j) {
-			printf("%i\t", defaulting[i][j]);
+			printf("%i\t", get_flag(defaulting, i, j));
 		}
 		printf("\n");
 	}
 }
 
-// Functions that performs the time steps from T to T_min
-void traverse_time() {
+// Functions that performs the time steps first_step to last_step, where time step i goes from T - (i - 1) * dT to T - i * dT.
+// The full backward solve from T to T_min consists of the time steps 1 to T_grid_size - 1.
+// A checkpoint is written after every checkpoint_interval-th time step if a checkpoint file was given, a snapshot for the trajectory file
+// after every trajectory_interval-th time step.
+void traverse_time(int first_step, int last_step) {
 	#ifdef DEBUG_PRINT_TIME
 	double t;
 	#endif
-	for(int i = 1; i < T_grid_size; ++i) {
+	for(int i = first_step; i <= last_step; ++i) {
 		#ifdef DEBUG_PRINT_TIME
 		t = T - i *dT;
 		printf("---- Time step:%-16f to %-16f\n", t+dT, t);
@@ -701,15 +1710,32 @@ void traverse_time() {
 		#else
 		step();
 		#endif
+		// The investment of the last time step is part of the result, so the last time step is always a full one
+		if(i == T_grid_size - 2)
+			frozen_steps = -1;
 		#ifdef DEBUG_PRINT_TIME_INTERMEDIATE_RESULT
 		print_intermediate_result(t);
 		#endif
+		if(checkpoint_file != NULL && i % checkpoint_interval == 0)
+			write_checkpoint(i);
+		if(trajectory_file != NULL && i % trajectory_interval == 0)
+			record_trajectory(i);
 	}
+	compute_equity_derivatives();
+	if(sensitivity_count > 0)
+		store_sensitivities();
 	#ifdef DEBUG_GDB
 	printf("Debug dummy: %i\n", debug_gdb_dummy);
 	#endif
 }
 
+// Fill W_grid, L_grid and the distances between the grid points
+void setup_WL_grids() {
+	uniform_grids = W_cluster_width == 0 && L_cluster_width == 0;
+	fill_grid(W_grid, dW_p, dW_n, inv_dW_p, inv_dW_n, W_min, W_max, W_grid_size, dW, W_cluster_center, W_cluster_width);
+	fill_grid(L_grid, dL_p, dL_n, inv_dL_p, inv_dL_n, L_min, L_max, L_grid_size, dL, L_cluster_center, L_cluster_width);
+}
+
 // Set up global variables and data structures for mca, except those related to P -- only coupon at the moment
 // This funciton can then be invoked both by mca_standalone and mca_find_EP to set up common global variables and data structures.
 void mca_initial_setup() {
@@ -721,18 +1747,60 @@ void mca_initial_setup() {
 	dT = T / ( T_grid_size - 1);
 
 	// Set up data structures
-	W_grid = create_grid(W_min, W_max, W_grid_size);
-	L_grid = create_grid(L_min, L_max, L_grid_size);
+	W_grid = malloc(W_grid_size * sizeof(double));
+	dW_p = malloc(W_grid_size * sizeof(double));
+	dW_n = malloc(W_grid_size * sizeof(double));
+	inv_dW_p = malloc(W_grid_size * sizeof(double));
+	inv_dW_n = malloc(W_grid_size * sizeof(double));
+	L_grid = malloc(L_grid_size * sizeof(double));
+	dL_p = malloc(L_grid_size * sizeof(double));
+	dL_n = malloc(L_grid_size * sizeof(double));
+	inv_dL_p = malloc(L_grid_size * sizeof(double));
+	inv_dL_n = malloc(L_grid_size * sizeof(double));
+	setup_WL_grids();
 
 	equity = create_equity_WL_grid();
 	defaulting = create_defaulting_WL_grid();
 	investment = create_investment_WL_grid();
 
 	new_equity = create_equity_WL_grid();
-	iteration_equity = create_equity_WL_grid();
+	spare_equity = create_equity_WL_grid();
+	iteration_equity = equity;
+	row_equity_change = malloc(W_grid_size * sizeof(double));
+	row_equity_change_max = malloc(W_grid_size * sizeof(double));
+	row_equity_magnitude = malloc(W_grid_size * sizeof(double));
 
 	equity_W = create_equity_WL_grid();
 	equity_L = create_equity_WL_grid();
+
+	time_steps_solved = 0;
+	time_steps_at_iteration_max = 0;
+	iterations_performed = 0;
+	predictions_rejected = 0;
+	frozen_time_steps = 0;
+}
+
+// Set up the global variables for a new parameter set, reusing the data structures of mca_initial_setup() for the previous parameter set,
+// which must have had the same grid sizes. Also resets the initial guess for investment.
+void mca_reuse_setup() {
+	rhohat = (1 - taxi) * r;
+
+	dW = ( W_max - W_min ) / ( W_grid_size - 1);
+	dL = ( L_max - L_min ) / ( L_grid_size - 1);
+	dT = T / ( T_grid_size - 1);
+
+	setup_WL_grids();
+	for(int i = 0; i < W_grid_size; ++i) {
+		for(int j = 0; j < L_grid_size; ++j) {
+			investment[i][j] = delta * L_grid[j];
+		}
+	}
+
+	time_steps_solved = 0;
+	time_steps_at_iteration_max = 0;
+	iterations_performed = 0;
+	predictions_rejected = 0;
+	frozen_time_steps = 0;
 }
 
 // Funciton to set up coupon
@@ -743,20 +1811,74 @@ void setup_coupon() {
 // Free memory after mca_standalone
 void clean_up_standalone() {
 	free(W_grid);
+	free(dW_p);
+	free(dW_n);
+	free(inv_dW_p);
+	free(inv_dW_n);
 	free(L_grid);
+	free(dL_p);
+	free(dL_n);
+	free(inv_dL_p);
+	free(inv_dL_n);
 		
 	destroy_WL_grid((void**) equity);
 	destroy_WL_grid((void**) defaulting);
 	destroy_WL_grid((void**) investment);
 
 	destroy_WL_grid((void**) new_equity);
-	destroy_WL_grid((void**) iteration_equity);
+	destroy_WL_grid((void**) spare_equity);
+	free(row_equity_change);
+	free(row_equity_change_max);
+	free(row_equity_magnitude);
 	destroy_WL_grid((void**) equity_W);
 	destroy_WL_grid((void**) equity_L);
+	if(previous_investment != NULL)
+		destroy_WL_grid((void**) previous_investment);
+	if(older_equity != NULL)
+		destroy_WL_grid((void**) older_equity);
+	previous_investment = NULL;
+	older_equity = NULL;
+	if(policy_defaulting != NULL) {
+		destroy_WL_grid((void**) policy_defaulting);
+		destroy_WL_grid((void**) policy_sign);
+	}
+	policy_defaulting = NULL;
+	policy_sign = NULL;
+	free(chain_time);
+	free(chain_stay);
+	free(chain_W_p);
+	free(chain_W_n);
+	free(chain_L_p);
+	free(chain_L_n);
+	chain_time = NULL;
+	free(adi_W_lower);
+	free(adi_W_diag);
+	free(adi_W_upper);
+	free(adi_L_lower);
+	free(adi_L_diag);
+	free(adi_L_upper);
+	free(adi_half);
+	free(adi_factor);
+	adi_half = NULL;
+	if(equity_tangent != NULL) {
+		for(int k = 0; k < sensitivity_count; ++k)
+			destroy_WL_grid((void**) equity_sensitivity[k]);
+		free(equity_sensitivity);
+	}
+	free(equity_tangent);
+	free(new_tangent);
+	free(spare_tangent);
+	free(investment_tangent);
+	free(W_stencil);
+	free(L_stencil);
+	free(L_forward_stencil);
+	equity_tangent = NULL;
 }
 
 // Function called by the main function of mca_standalone.exe
-void mca_standalone() {
+// Returns 0 if successful, 1 if resuming from the checkpoint file failed, the trajectory file could not be written or the sensitivities are not
+// supported with the selected numerical method.
+int mca_standalone() {
 	#ifdef DEBUG_PRINT_PARAMS
 	printf("%-32s%-12g\n", "r", r);
 	printf("%-32s%-12g\n", "lambda", lambda);
@@ -784,29 +1906,53 @@ void mca_standalone() {
 	// Setup global variables and data structures, except the variables related to P (coupon and rhohat)
 	mca_initial_setup();
 
+	return mca_standalone_solve();
+}
+
+// Solve for the current parameters, with the data structures set up by mca_initial_setup() or mca_reuse_setup()
+// Returns 0 if successful, 1 if resuming from the checkpoint file failed, the trajectory file could not be written or the sensitivities are not
+// supported with the selected numerical method.
+int mca_standalone_solve() {
 	// Set up remaining variables
 	setup_coupon();
 
 	// Compute terminal equity and default flag
 	terminal_equity_default(W_grid, L_grid, equity, defaulting);
+	forget_time_steps();
+	if(sensitivity_count > 0 && setup_sensitivities())
+		return 1;
 
-	// iteration_equity has to initialized to the current equity value before every time step
-	for(int i = 0; i < W_grid_size; ++i) {
-		for(int j = 0; j < L_grid_size; ++j) {
-			iteration_equity[i][j] = equity[i][j];
-		}
-	}
 
 	#ifdef DEBUG_PRINT_TERMINAL_VALUES
 	print_intermediate_result(T);
 	#endif
+
+	// Replace the terminal values by the state saved in the checkpoint
+	P_index = -1;
+	int first_step = 1;
+	if(resume) {
+		int time_step, P_index_resume;
+		if(read_checkpoint(false, &time_step, &P_index_resume))
+			return 1;
+		first_step = time_step + 1;
+	}
+	if(trajectory_file != NULL) {
+		if(open_trajectory_recorder())
+			return 1;
+		if(first_step == 1)
+			record_trajectory(0);
+	}
 	
 	// Step throug it
-	traverse_time();
+	traverse_time(first_step, T_grid_size - 1);
+	return close_trajectory_recorder();
 }
 
 // Function called by the main function of mca_part.exe
-void mca_part(int time_steps) {
+// Performs the time steps up to time_steps. If a checkpoint file was given, the state after the last time step is saved as well, such that
+// mca_standalone or mca_part can resume from it.
+// Returns 0 if successful, 1 if resuming from the checkpoint file failed or the trajectory file could not be written.
+int mca_part(int time_steps) {
 	#ifdef DEBUG_PRINT_PARAMS
 	printf("%-32s%-12g\n", "r", r);
 	printf("%-32s%-12g\n", "lambda", lambda);
@@ -839,39 +1985,34 @@ void mca_part(int time_steps) {
 
 	// Compute terminal equity and default flag
 	terminal_equity_default(W_grid, L_grid, equity, defaulting);
+	forget_time_steps();
 
-	// iteration_equity has to initialized to the current equity value before every time step
-	for(int i = 0; i < W_grid_size; ++i) {
-		for(int j = 0; j < L_grid_size; ++j) {
-			iteration_equity[i][j] = equity[i][j];
-		}
-	}
 
 	#ifdef DEBUG_PRINT_TERMINAL_VALUES
 	print_intermediate_result(T);
 	#endif
+
+	// Replace the terminal values by the state saved in the checkpoint
+	P_index = -1;
+	int first_step = 1;
+	if(resume) {
+		int time_step, P_index_resume;
+		if(read_checkpoint(false, &time_step, &P_index_resume))
+			return 1;
+		first_step = time_step + 1;
+	}
+	if(trajectory_file != NULL) {
+		if(open_trajectory_recorder())
+			return 1;
+		if(first_step == 1)
+			record_trajectory(0);
+	}
 	
 	// Step throug it partly
-	#ifdef DEBUG_PRINT_TIME
-	double t;
-	#endif
-	for(int tau = 1; tau <= time_steps; ++tau) {
-		#ifdef DEBUG_PRINT_TIME
-		t = T - tau *dT;
-		printf("---- Time step:%-16f to %-16f\n", t+dT, t);
-		#endif
-		#if defined(DEBUG_EQUITY_time) || defined(DEBUG_DEFAULTING_INVESTMENT_time) || defined(DEBUG_WRITE_time) || defined(DEBUG_GDB)
-		step(tau);
-		#else
-		step();
-		#endif
-		#ifdef DEBUG_PRINT_TIME_INTERMEDIATE_RESULT
-		print_intermediate_result(t);
-		#endif
-	}
-	#ifdef DEBUG_GDB
-	printf("Debug dummy: %i\n", debug_gdb_dummy);
-	#endif
+	traverse_time(first_step, time_steps);
+	if(checkpoint_file != NULL && time_steps % checkpoint_interval != 0)
+		write_checkpoint(time_steps);
+	return close_trajectory_recorder();
 }
 
 // Free memory after mca_find_EP
@@ -909,9 +2050,20 @@ void mca_find_EP_setup() {
 	}
 }
 
+// Like mca_reuse_setup(), for mca_find_EP with the same P grid size as the previous parameter set
+void mca_find_EP_reuse_setup() {
+	mca_reuse_setup();
+	dP = ( P_max - P_min ) / ( P_grid_size - 1);
+	for(int p = 0; p < P_grid_size; ++p) {
+		P_grid[p] = P_min + p * (( P_max - P_min ) / ( P_grid_size - 1));
+	}
+}
+
 // Perform one interation on the P grid for mca_find_EP
-void mca_find_EP_iteration(int p) {
+// If first_step > 1, we continue from the state restored from a checkpoint instead of starting at the terminal values.
+void mca_find_EP_iteration(int p, int first_step) {
 	P = P_grid[p];
+	P_index = p;
 	#ifdef DEBUG_PRINT_PARAMS_EP_ITERATION
 	printf("Entering EP iteration with P = %-12g\n", P);
 	#endif
@@ -919,14 +2071,12 @@ void mca_find_EP_iteration(int p) {
 	// Update the global variables that depend on P
 	setup_coupon();
 	
-	// Compute terminal equity and default flag
-	terminal_equity_default(W_grid, L_grid, equity, defaulting);
+	if(first_step == 1) {
+		// Compute terminal equity and default flag
+		terminal_equity_default(W_grid, L_grid, equity, defaulting);
+		forget_time_steps();
 
-	// iteration_equity has to initialized to the current equity value before every time step
-	for(int i = 0; i < W_grid_size; ++i) {
-		for(int j = 0; j < L_grid_size; ++j) {
-			iteration_equity[i][j] = equity[i][j];
-		}
+		record_trajectory(0);
 	}
 
 	#ifdef DEBUG_PRINT_TERMINAL_VALUES_EP_ITERATION
@@ -934,7 +2084,7 @@ void mca_find_EP_iteration(int p) {
 	#endif
 	
 	// Step throug it
-	traverse_time();
+	traverse_time(first_step, T_grid_size - 1);
 }
 
 // void find_optimal_equity_in_col(int column, int *maxi, double *maxx) {
@@ -961,8 +2111,32 @@ int find_optimal_equity_in_col(int column) {
 	return maxi;
 }
 		
+// After mca_find_EP_iteration(p), pick the optimal cash position for every column of the WL grid and store the results in row p of the PL grids
+void store_optimal_equity_for_P(int p) {
+	int maxi;
+	for(int j = 0; j < L_grid_size; ++j) {
+		maxi = find_optimal_equity_in_col(j);
+		if(get_flag(defaulting, maxi, j) == false) {
+			optimal_equity[p][j] = equity[maxi][j];
+			optimal_cash[p][j] = W_grid[maxi];
+			optimal_investment[p][j] = investment[maxi][j];
+			optimal_defaulting[p][j] = 0;
+			optimal_equity_W[p][j] = equity_W[maxi][j];
+			optimal_equity_L[p][j] = equity_L[maxi][j];
+		} else {
+			optimal_equity[p][j] = 0;
+			optimal_cash[p][j] = 0;
+			optimal_investment[p][j] = 0;
+			optimal_defaulting[p][j] = 1;
+			optimal_equity_W[p][j] = equity_W[maxi][j];
+			optimal_equity_L[p][j] = equity_L[maxi][j];
+		}
+	}
+}
+
 // Function called by the main function of mca_find_EP.exe
-void mca_find_EP() {
+// Returns 0 if successful, 1 if resuming from the checkpoint file failed or the trajectory file or the cube file could not be written.
+int mca_find_EP() {
 	#ifdef DEBUG_FIND_EP_PRINT_PARAMS
 	printf("%-32s%-12g\n", "r", r);
 	printf("%-32s%-12g\n", "lambda", lambda);
@@ -990,35 +2164,243 @@ void mca_find_EP() {
 	printf("%-32s%-12g\n", "equity_cost", equity_cost);
 	#endif
 	
-	//int maxi;
-	//double maxx;
-	int maxi;
-	
 	mca_find_EP_setup();
+
+	return mca_find_EP_solve();
+}
+
+// Solve for every P on the P grid, with the data structures set up by mca_find_EP_setup() or mca_find_EP_reuse_setup()
+// Returns 0 if successful, 1 if resuming from the checkpoint file failed or the trajectory file or the cube file could not be written.
+int mca_find_EP_solve() {
+	if(cube_file != NULL && open_cube_writer())
+		return 1;
+	// Continue with the P and the time step saved in the checkpoint
+	int first_P = 0;
+	int first_step = 1;
+	if(resume) {
+		int time_step;
+		if(read_checkpoint(true, &time_step, &first_P)) {
+			close_cube_writer();
+			return 1;
+		}
+		first_step = time_step + 1;
+	}
+	if(trajectory_file != NULL && open_trajectory_recorder()) {
+		close_cube_writer();
+		return 1;
+	}
 		
-	for(int p = 0; p < P_grid_size; ++p) {
+	int status = 0;
+	for(int p = first_P; p < P_grid_size; ++p) {
 		#ifdef DEBUG_FIND_EP_PRINT_P_LOOP
 		printf("Entering P iteration #%i with P = %-12g\n", p, P_min + p * dP);
 		#endif
-		mca_find_EP_iteration(p);
-		for(int j = 0; j < L_grid_size; ++j) {
-			maxi = find_optimal_equity_in_col(j);
-			if(defaulting[maxi][j] == false) {
-				optimal_equity[p][j] = equity[maxi][j];
-				optimal_cash[p][j] = W_grid[maxi];
-				optimal_investment[p][j] = investment[maxi][j];
-				optimal_defaulting[p][j] = 0;
-				optimal_equity_W[p][j] = equity_W[maxi][j];
-				optimal_equity_L[p][j] = equity_L[maxi][j];
-			} else {
-				optimal_equity[p][j] = 0;
-				optimal_cash[p][j] = 0;
-				optimal_investment[p][j] = 0;
-				optimal_defaulting[p][j] = 1;
-				optimal_equity_W[p][j] = equity_W[maxi][j];
-				optimal_equity_L[p][j] = equity_L[maxi][j];
-			}
+		mca_find_EP_iteration(p, p == first_P ? first_step : 1);
+		store_optimal_equity_for_P(p);
+		if(cube_file != NULL && write_cube_slice(p)) {
+			status = 1;
+			break;
 		}
 	}
+	status |= close_cube_writer();
+	return close_trajectory_recorder() || status;
 }
 		
+
+// ADAPTIVE SEARCH FOR THE OPTIMAL PRINCIPAL
+// mca_find_EP() solves the model for every value on the P grid, even though we are eventually only interested in the P with maximal equity.
+// mca_optimize_P() instead brackets the maximum with a coarse scan of the P grid and then refines the bracket with a golden-section search.
+// - The search runs on the indices of P_grid, so that the answer coincides with the dense sweep whenever the optimal equity is unimodal in P
+//   between the bracketing points. Ties are resolved towards the smaller P, as in a dense argmax.
+// - A single call to mca_find_EP_iteration() yields the results for all values of L, so the searches for the different columns are performed in
+//   lockstep and every P is solved at most once.
+// - With aggregate == true we maximize the sum of the optimal equity over all L instead, and report the results for a common P.
+// The solver itself is already parallelized with OpenMP and keeps its state in global variables, so the evaluations are performed one at a time.
+
+#define P_BRACKET_POINTS 5																			// Number of points of the coarse scan used for bracketing
+const double golden_fraction = 0.38196601125010515;													// (3 - sqrt(5)) / 2
+
+bool *P_evaluated;																					// P_evaluated[p] is true once P_grid[p] has been solved
+bool **P_touched;																					// P_touched[c][p] is true if the search for column c used P_grid[p]
+int P_touched_columns;																				// Number of separate searches (1 for the aggregate objective)
+
+// Solve the model for P_grid[p] and store the optimal values for every L, unless this has already been done.
+void evaluate_P(int p) {
+	if(P_evaluated[p])
+		return;
+	#ifdef DEBUG_FIND_EP_PRINT_P_LOOP
+	printf("Evaluating P iteration #%i with P = %-12g\n", p, P_grid[p]);
+	#endif
+	mca_find_EP_iteration(p, 1);
+	store_optimal_equity_for_P(p);
+	P_evaluated[p] = true;
+	++P_evaluations;
+}
+
+// Objective of the search for a column of the PL grid, column == -1 refers to the aggregate objective
+double P_objective(int p, int column) {
+	if(column >= 0)
+		return optimal_equity[p][column];
+	double sum = 0;
+	for(int j = 0; j < L_grid_size; ++j)
+		sum += optimal_equity[p][j];
+	return sum;
+}
+
+// Evaluate all P flagged in needed and clear the flags again
+void evaluate_needed_P(bool *needed) {
+	for(int p = 0; p < P_grid_size; ++p) {
+		if(needed[p]) {
+			evaluate_P(p);
+			needed[p] = false;
+		}
+	}
+}
+
+// Free memory after mca_optimize_P
+void clean_up_optimize_P() {
+	int columns = P_touched_columns;
+	for(int c = 0; c < columns; ++c)
+		free(P_touched[c]);
+	free(P_touched);
+	free(P_evaluated);
+	for(int j = 0; j < L_grid_size; ++j)
+		free(optimal_P_per_L[j]);
+	free(optimal_P_per_L);
+	clean_up_find_EP();
+}
+
+// Function called by the main function of mca_optimize_P.exe
+void mca_optimize_P(bool aggregate) {
+	mca_find_EP_setup();
+
+	int columns = aggregate ? 1 : L_grid_size;
+	P_touched_columns = columns;
+	P_evaluations = 0;
+	P_evaluated = calloc(P_grid_size, sizeof(bool));
+	P_touched = malloc(columns * sizeof(bool*));
+	for(int c = 0; c < columns; ++c)
+		P_touched[c] = calloc(P_grid_size, sizeof(bool));
+	bool *needed = calloc(P_grid_size, sizeof(bool));
+	int *lo = malloc(columns * sizeof(int));
+	int *hi = malloc(columns * sizeof(int));
+	int *x1 = malloc(columns * sizeof(int));
+	int *x2 = malloc(columns * sizeof(int));
+
+	// BRACKETING
+	// Coarse scan of the P grid, shared by all columns. The bracket of a column are the neighbours of its best coarse point.
+	int bracket_points = P_grid_size < P_BRACKET_POINTS ? P_grid_size : P_BRACKET_POINTS;
+	int coarse[P_BRACKET_POINTS];
+	for(int k = 0; k < bracket_points; ++k) {
+		coarse[k] = bracket_points == 1 ? 0 : (int) ((double) k * (P_grid_size - 1) / (bracket_points - 1) + 0.5);
+		needed[coarse[k]] = true;
+		for(int c = 0; c < columns; ++c)
+			P_touched[c][coarse[k]] = true;
+	}
+	evaluate_needed_P(needed);
+	for(int c = 0; c < columns; ++c) {
+		int column = aggregate ? -1 : c;
+		int best = 0;
+		for(int k = 1; k < bracket_points; ++k) {
+			if(P_objective(coarse[k], column) > P_objective(coarse[best], column))
+				best = k;
+		}
+		lo[c] = best > 0 ? coarse[best - 1] : coarse[0];
+		hi[c] = best < bracket_points - 1 ? coarse[best + 1] : coarse[bracket_points - 1];
+	}
+
+	// REFINEMENT
+	// Golden-section search on the indices, performed in lockstep for all columns whose bracket still contains more than three points. The
+	// first round solves two interior points x1 < x2 of the bracket. In every further round, the bracket is cut next to the worse of them and
+	// the better one stays inside, so only one new point has to be solved: the golden section of the new bracket on the other side of it.
+	for(int c = 0; c < columns; ++c) {
+		if(hi[c] - lo[c] > 2) {
+			int offset = (int) (golden_fraction * (hi[c] - lo[c]) + 0.5);
+			if(offset < 1)
+				offset = 1;
+			x1[c] = lo[c] + offset;
+			x2[c] = hi[c] - offset;
+			if(x2[c] <= x1[c])
+				x2[c] = x1[c] + 1;
+			needed[x1[c]] = needed[x2[c]] = true;
+			P_touched[c][x1[c]] = P_touched[c][x2[c]] = true;
+		}
+	}
+	evaluate_needed_P(needed);
+	bool active = true;
+	while(active) {
+		active = false;
+		for(int c = 0; c < columns; ++c) {
+			if(hi[c] - lo[c] <= 2)
+				continue;
+			int column = aggregate ? -1 : c;
+			int kept;
+			if(P_objective(x1[c], column) >= P_objective(x2[c], column)) {
+				hi[c] = x2[c] - 1;
+				kept = x1[c];
+			}
+			else {
+				lo[c] = x1[c] + 1;
+				kept = x2[c];
+			}
+			if(hi[c] - lo[c] <= 2)
+				continue;
+			int offset = (int) (golden_fraction * (hi[c] - lo[c]) + 0.5);
+			if(offset < 1)
+				offset = 1;
+			int added = kept - lo[c] < hi[c] - kept ? hi[c] - offset : lo[c] + offset;
+			if(added == kept)
+				added = lo[c] + hi[c] - kept;
+			if(added == kept)
+				added = kept < hi[c] ? kept + 1 : kept - 1;
+			x1[c] = kept < added ? kept : added;
+			x2[c] = kept < added ? added : kept;
+			needed[added] = true;
+			P_touched[c][added] = true;
+			active = true;
+		}
+		evaluate_needed_P(needed);
+	}
+
+	// The remaining points of every bracket
+	for(int c = 0; c < columns; ++c) {
+		for(int p = lo[c]; p <= hi[c]; ++p) {
+			needed[p] = true;
+			P_touched[c][p] = true;
+		}
+	}
+	evaluate_needed_P(needed);
+
+	// RESULTS
+	// For every column, the best of all P its search has used. Each row holds L, P, equity, cash, investment, defaulting flag and number of solves.
+	optimal_P_per_L = malloc(L_grid_size * sizeof(double*));
+	for(int j = 0; j < L_grid_size; ++j)
+		optimal_P_per_L[j] = malloc(OPTIMAL_P_COLUMNS * sizeof(double));
+	for(int c = 0; c < columns; ++c) {
+		int column = aggregate ? -1 : c;
+		int best = -1;
+		int evaluations = 0;
+		for(int p = 0; p < P_grid_size; ++p) {
+			if(P_touched[c][p]) {
+				++evaluations;
+				if(best < 0 || P_objective(p, column) > P_objective(best, column))
+					best = p;
+			}
+		}
+		for(int j = (aggregate ? 0 : c); j < (aggregate ? L_grid_size : c + 1); ++j) {
+			optimal_P_per_L[j][0] = L_grid[j];
+			optimal_P_per_L[j][1] = P_grid[best];
+			optimal_P_per_L[j][2] = optimal_equity[best][j];
+			optimal_P_per_L[j][3] = optimal_cash[best][j];
+			optimal_P_per_L[j][4] = optimal_investment[best][j];
+			optimal_P_per_L[j][5] = optimal_defaulting[best][j];
+			optimal_P_per_L[j][6] = evaluations;
+		}
+	}
+
+	free(needed);
+	free(lo);
+	free(hi);
+	free(x1);
+	free(x2);
+}
@@ -4,15 +4,30 @@
 #define MCA_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 // Functions exposed to the main executables
 
-void mca_standalone();
-void mca_part();
-void mca_find_EP();
+int mca_standalone();
+int mca_part(int time_steps);
+int mca_find_EP();
 void clean_up_standalone();
 void clean_up_find_EP();
 
+// Used by mca_sweep to solve several parameter sets with the same data structures
+void mca_initial_setup();
+void mca_reuse_setup();
+int mca_standalone_solve();
+void mca_find_EP_setup();
+void mca_find_EP_reuse_setup();
+int mca_find_EP_solve();
+void mca_optimize_P(bool aggregate);
+void clean_up_optimize_P();
+
+// Version of the numerical method, has to be increased whenever a change of the solver changes its results, such that results in the cache
+// (see mca_cache.h) computed by an older version are not used anymore
+#define MCA_SOLVER_VERSION 1
+
 // GLOBAL VARIABLES COMPRISE PARAMETERS AND DERIVED VALUES
 double r;																							// Risk-free rate
 double lambda;																						// Opportunity cost for cash
@@ -52,8 +67,35 @@ int iteration_max;																					// Maximum number of iterations to perfor
 double iteration_tol;																				// When equity value changes less than the iteration tolerance, complete the time step
 double trigger_equity_derivative_tol;																// Used in update_default_investment funciton in mca.c
 
+// Optional parameters selecting the numerical method, see optional_parameters in mca_io.c for the defaults
+int spatial_order;																					// 1: upwind Markov chain, 2: limited second-order drift terms
+int boundary_condition;																				// 0: no moves off the grid, 1: linear growth beyond W_max and L_max
+double W_cluster_width;																				// 0: uniform W grid, otherwise points are concentrated
+double W_cluster_center;																			// in a region of about this width around the center
+double L_cluster_width;																				// Same for L
+double L_cluster_center;
+double investment_q_max;																			// 0: investment from the first-order condition as is, otherwise
+double investment_relaxation;																		// bounded and relaxed, see stabilized_investment() in mca.c
+int convergence_norm;																				// Norm of the change of equity that ends a time step, see
+double max_change_tol;																				// convergence_measure() in mca.c: 0 sum of squares (iteration_tol),
+double rms_change_tol;																				// 1 largest change, 2 root mean square, 3 relative root mean square,
+double relative_change_tol;																			// each with its own tolerance, see iteration_error()
+int predictor_order;																				// 0: start the iterations from the preceding time step, 1 or 2: from
+																									// the extrapolation of the last time steps, see predict() in mca.c
+int policy_freeze_interval;																			// 0: every time step updates the policy, otherwise at most this many
+																									// time steps use the frozen policy, see POLICY FREEZE in mca.c
+int policy_freeze_changes;																			// Points at which the policy may change for it to be frozen
+int time_scheme;																					// 0: iterate the Markov chain point by point, 1: solve the time
+																									// step in alternating implicit half-steps in W and L, see
+																									// ALTERNATING DIRECTION IMPLICIT ITERATIONS in mca.c
+
 // Cash and Loan grids
 double *W_grid, *L_grid;
+// Distance to the next and to the preceding grid point, dW and dL everywhere on uniform grids. At the first and last points, the distance
+// to the missing neighbour is that to the existing one.
+double *dW_p, *dW_n, *dL_p, *dL_n;
+double *inv_dW_p, *inv_dW_n, *inv_dL_p, *inv_dL_n;													// 1 / dW_p[i] and so on, used for the transition rates
+bool uniform_grids;																					// false if W_cluster_width or L_cluster_width is set
 
 // Principal grid (for find_EP)
 double *P_grid;
@@ -61,15 +103,115 @@ double *P_grid;
 // Result arrays for mca
 
 // These double pointers store the results
+// equity_W and equity_L are only computed at the end of traverse_time(), the solver computes the derivatives it needs on the fly.
 double **equity, **investment, **equity_W, **equity_L;
-bool **defaulting;
+uint64_t **defaulting;																				// Bit-packed, use get_flag() and set_flag()
 
 // We need to keep track of the equity values computed in the the preceding time step as well.
 double **new_equity;
 // We also need to keep track of the equity value of the preceding value iteration step
+// Between time steps, iteration_equity points to the same grid as equity. The grids are rotated by pointer in step(), spare_equity is the
+// third grid needed for that.
 double **iteration_equity;
+double **spare_equity;
+// Sum of the squared changes of equity in each row of the grid in the current iteration, see step()
+double *row_equity_change;
+// Largest absolute change and sum of the squared equity in each row, only computed if convergence_norm is not 0
+double *row_equity_change_max;
+double *row_equity_magnitude;
+
+// State of the predictor, see predict() in mca.c. Between time steps spare_equity holds the equity of the preceding time step.
+double **older_equity;																				// Equity two time steps back, only for predictor_order 2
+double **previous_investment;																		// Investment of the preceding time step
+int predictor_history;																				// Time steps available for the extrapolation, at most 2
+double predictor_change;																			// Change of equity in the first iteration of the last time step
+																									// that started without prediction
+void setup_predictor();
+
+// State of the policy freeze, see POLICY FREEZE in mca.c
+int frozen_steps;																					// Frozen time steps since assemble_chain(), -1 if not frozen
+double frozen_change;																				// Change of equity in the first iteration of the first frozen time step
+uint64_t **policy_defaulting, **policy_sign;														// Defaulting flags and investment > 0 after the last full time step
+bool policy_snapshot_taken;																			// Whether policy_defaulting and policy_sign hold that policy
+void setup_policy_freeze();
+void assemble_chain();
+
+// Iteration counts of step(), reset by mca_initial_setup() and mca_reuse_setup(), see print_iteration_counts()
+long long time_steps_solved;																		// Number of time steps performed
+long long time_steps_at_iteration_max;																// Time steps that stopped at iteration_max without converging
+long long iterations_performed;																		// Iterations of all time steps
+long long predictions_rejected;																		// Time steps in which predict() made the first change larger
+long long frozen_time_steps;																		// Time steps performed with a frozen policy
+void print_iteration_counts();
+
+// Bit-packed flags on the WL grid: row i holds FLAG_WORDS(L_grid_size) words, flag j is bit j % 64 of word j / 64
+#define FLAG_WORDS(n) (((n) + 63) / 64)
+
+static inline bool get_flag(uint64_t *const *flags, int i, int j) {
+	return (flags[i][j >> 6] >> (j & 63)) & 1;
+}
+
+static inline void set_flag(uint64_t **flags, int i, int j, bool value) {
+	if(value)
+		flags[i][j >> 6] |= (uint64_t) 1 << (j & 63);
+	else
+		flags[i][j >> 6] &= ~((uint64_t) 1 << (j & 63));
+}
 
 // Result arrays for mca_find_EP //
 double **optimal_equity, **optimal_cash, **optimal_investment, **optimal_defaulting, **optimal_equity_W, **optimal_equity_L;
 
+// Checkpointing, set by read_options() in mca_io.c and used in mca_checkpoint.c
+char *checkpoint_file;																				// NULL if no checkpoints should be written
+int checkpoint_interval;																			// Number of time steps between two checkpoints
+bool resume;																						// Continue from checkpoint_file
+int P_index;																						// Index of P in P_grid, -1 for mca_standalone and mca_part
+
+// Trajectory recording, set by read_options() in mca_io.c and used in mca_trajectory.c
+char *trajectory_file;																				// NULL if no trajectory should be recorded
+int trajectory_interval;																			// Number of time steps between two snapshots
+double trajectory_tolerance;																		// Quantization step for equity and investment, 0 for raw doubles
+
+// Sharding of mca_sweep and mca_richardson, set by read_options() in mca_io.c
+int shard_index;																					// Solve the points with index shard_index modulo shard_count
+int shard_count;
+
+// Richardson extrapolation, set by read_options() in mca_io.c and used in mca_richardson.c
+double richardson_order;																			// 0 to estimate the order from the grids
+
+// Sensitivities, set by read_options() in mca_io.c and computed alongside the solution in mca.c, see SENSITIVITIES in mca.c
+enum sensitivity_parameter {
+	SENSITIVITY_R, SENSITIVITY_LAMBDA, SENSITIVITY_SIGMA, SENSITIVITY_DELTA, SENSITIVITY_PSI, SENSITIVITY_TAXE, SENSITIVITY_TAXI,
+	SENSITIVITY_TAXC, SENSITIVITY_P, SENSITIVITY_THETA, SENSITIVITY_PREMIUM, SENSITIVITY_PARAMETERS
+};
+int sensitivity_count;																				// Number of parameters, 0 if no sensitivities are computed
+enum sensitivity_parameter sensitivity_parameter[SENSITIVITY_PARAMETERS];							// The parameters in the order of the option
+double ***equity_sensitivity;																		// Derivative of equity with respect to each parameter,
+																									// filled at the end of traverse_time()
+
+// Cube files, set by read_options() in mca_io.c, written by mca_find_EP and read by mca_cube, see CUBE FILES in mca_binary.h
+char *cube_file;																					// NULL if no cube should be written
+double cube_equity_cost;																			// Objective of mca_cube, see mca_cube.c: cost per unit of
+double cube_cash_penalty;																			// equity raised (NAN for equity_cost of the cube), penalty
+double cube_W_lower;																				// per unit of |W| and the range of W to choose from
+double cube_W_upper;
+
+// Monte Carlo simulation, set by read_options() in mca_io.c and used in mca_simulate.c
+uint64_t simulation_seed;																			// Key of the random number streams of the paths
+int simulation_bins;																				// Number of bins of the histograms
+int simulation_steps;																				// Time steps of the paths, 0 for those of the solver
+
+// Result cache, set by read_options() in mca_io.c and used in mca_cache.c
+char *cache_directory;																				// NULL if the cache should not be used
+long long cache_size_limit;																			// Maximal size of the cache in bytes
+
+// Output format, set by read_options() in mca_io.c
+char *binary_file;																					// Binary result file of --binary=file, NULL to write CSV files
+
+// Result arrays for mca_optimize_P //
+// One row per value of L holding L, optimal P, equity, cash, investment, defaulting flag and the number of P evaluated for this L
+#define OPTIMAL_P_COLUMNS 7
+double **optimal_P_per_L;
+int P_evaluations;																					// Total number of P for which the model was solved
+
 #endif
@@ -0,0 +1,110 @@
+// Benchmark for writing CSV files
+// Compares write_array (shortest round-trip formatting, one write per row) with the previous implementation, which wrote every value with
+// fprintf("%.*e") at maximum precision, and checks that every value reads back exactly.
+
+// Usage:
+// mca_bench_io.exe [n] [directory]
+//
+// n			-- Size of the n x n grid to write, default 1000
+// directory	-- Directory for the two output files, default the current directory
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <time.h>
+
+#include "mca_io.h"
+
+// The previous write_array
+static int write_array_printf(char *filename, double **a, int x, int y) {
+	FILE *fp = fopen(filename, "w");
+	if(fp == NULL)
+		return 1;
+	for(int i = 0; i < x; ++i) {
+		int j;
+		for(j = 0; j < y - 1; ++j) {
+			fprintf(fp, "%.*e,", DBL_DECIMAL_DIG, a[i][j]);
+		}
+		fprintf(fp, "%.*e\n", DBL_DECIMAL_DIG, a[i][j]);
+	}
+	return fclose(fp) ? 1 : 0;
+}
+
+static long file_size(char *filename) {
+	FILE *fp = fopen(filename, "rb");
+	if(fp == NULL)
+		return -1;
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fclose(fp);
+	return size;
+}
+
+// Read the file back and count the values that differ from a
+static long count_mismatches(char *filename, double **a, int x, int y) {
+	FILE *fp = fopen(filename, "r");
+	if(fp == NULL)
+		return -1;
+	long mismatches = 0;
+	for(int i = 0; i < x; ++i) {
+		for(int j = 0; j < y; ++j) {
+			double value;
+			if(fscanf(fp, j < y - 1 ? "%lf," : "%lf\n", &value) != 1 || value != a[i][j])
+				++mismatches;
+		}
+	}
+	fclose(fp);
+	return mismatches;
+}
+
+int main(int argc, char* argv[]) {
+	int n = argc > 1 ? atoi(argv[1]) : 1000;
+	char *directory = argc > 2 ? argv[2] : ".";
+	if(n < 1) {
+		printf("Invalid grid size %s\n", argv[1]);
+		return 1;
+	}
+	char old_file[1024], new_file[1024];
+	snprintf(old_file, sizeof old_file, "%s/bench_printf.csv", directory);
+	snprintf(new_file, sizeof new_file, "%s/bench_shortest.csv", directory);
+
+	// A smooth surface on a grid, similar to the equity values computed by the solver, with a few values that are short in decimal
+	double **a = malloc(n * sizeof(double*));
+	for(int i = 0; i < n; ++i) {
+		a[i] = malloc(n * sizeof(double));
+		for(int j = 0; j < n; ++j) {
+			double W = -25 + 100.0 * i / (n - 1);
+			double L = 300.0 * j / (n - 1);
+			a[i][j] = i % 10 == 0 ? W : fmax(W, 0) + 0.8 * L - 40 * (1 - exp(-0.01 * L)) + 5 * log1p(exp(-W / 5));
+		}
+	}
+
+	clock_t start = clock();
+	if(write_array_printf(old_file, a, n, n)) {
+		printf("Error writing file %s\n", old_file);
+		return 3;
+	}
+	double old_seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+	start = clock();
+	if(write_array(new_file, a, n, n)) {
+		return 3;
+	}
+	double new_seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+	long old_size = file_size(old_file);
+	long new_size = file_size(new_file);
+	printf("%-24s%12s%12s%16s%12s\n", "", "seconds", "MB/s", "values/s", "MB");
+	printf("%-24s%12.3f%12.1f%16.3g%12.2f\n", "fprintf(%.17e)", old_seconds, old_size / old_seconds / 1e6, (double) n * n / old_seconds, old_size / 1e6);
+	printf("%-24s%12.3f%12.1f%16.3g%12.2f\n", "write_array", new_seconds, new_size / new_seconds / 1e6, (double) n * n / new_seconds, new_size / 1e6);
+	printf("Speedup %.1fx, size %.0f%% of the previous output\n", old_seconds / new_seconds, 100.0 * new_size / old_size);
+
+	long mismatches = count_mismatches(new_file, a, n, n);
+	printf("Values not reading back exactly: %li\n", mismatches);
+
+	for(int i = 0; i < n; ++i)
+		free(a[i]);
+	free(a);
+	return mismatches != 0;
+}
@@ -0,0 +1,503 @@
+// This file defines the writer and the reader of binary result files, see mca_binary.h for the layout.
+// int write_binary_result(...);									-- write axes, arrays and all parameters with a single fwrite
+// struct binary_result* open_binary_result(const char *filename);	-- map a binary result file into memory
+// void close_binary_result(struct binary_result *res);				-- unmap it again
+// and accessors for parameters, axes and arrays by name.
+// int write_standalone_result(char *filename);						-- write the results of mca_standalone and mca_part
+// int write_find_EP_result(char *filename);						-- write the results of mca_find_EP
+// int open_cube_writer();											-- lay out cube_file, or reopen it when resuming
+// int write_cube_slice(int p);										-- write the results for P_grid[p] into the cube
+// int close_cube_writer();
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mca.h"
+#include "mca_io.h"
+#include "mca_binary.h"
+
+static const char binary_magic[8] = "MCARES";
+
+static size_t align(size_t offset) {
+	return (offset + BINARY_ALIGNMENT - 1) / BINARY_ALIGNMENT * BINARY_ALIGNMENT;
+}
+
+static void copy_name(char *dst, const char *name) {
+	memset(dst, 0, BINARY_NAME_LENGTH);
+	strncpy(dst, name, BINARY_NAME_LENGTH - 1);
+}
+
+// Writes axes, arrays and the values of all parameters in parameters[] (see mca_io.c) to filename.
+// The whole file is assembled in memory and written with a single call to fwrite.
+// Returns 0 if successful, 1 in case of write error, 2 in case of error closing the file.
+int write_binary_result(char *filename, const struct binary_axis *axes, int axis_count, const struct binary_array *arrays, int array_count) {
+	// Compute the layout
+	size_t offset = sizeof(struct binary_header) + parameters_count * sizeof(struct binary_parameter_entry) +
+		axis_count * sizeof(struct binary_axis_entry) + array_count * sizeof(struct binary_array_entry);
+	size_t *axis_offsets = malloc(axis_count * sizeof(size_t));
+	size_t *array_offsets = malloc(array_count * sizeof(size_t));
+	size_t *array_sizes = malloc(array_count * sizeof(size_t));
+	for(int a = 0; a < axis_count; ++a) {
+		offset = align(offset);
+		axis_offsets[a] = offset;
+		offset += axes[a].length * sizeof(double);
+	}
+	for(int a = 0; a < array_count; ++a) {
+		size_t n = (size_t) axes[arrays[a].axes[0]].length * axes[arrays[a].axes[1]].length;
+		offset = align(offset);
+		array_offsets[a] = offset;
+		array_sizes[a] = (arrays[a].flags != NULL || arrays[a].packed) ? (n + 7) / 8 : n * sizeof(double);
+		offset += array_sizes[a];
+	}
+	size_t file_size = align(offset);
+	char *buffer = calloc(file_size, 1);
+
+	// Tables
+	struct binary_header *header = (struct binary_header*) buffer;
+	memcpy(header->magic, binary_magic, sizeof header->magic);
+	header->version = BINARY_RESULT_VERSION;
+	header->parameter_count = parameters_count;
+	header->axis_count = axis_count;
+	header->array_count = array_count;
+	header->file_size = file_size;
+
+	struct binary_parameter_entry *parameter_entries = (struct binary_parameter_entry*) (header + 1);
+	for(int k = 0; k < parameters_count; ++k) {
+		copy_name(parameter_entries[k].name, parameters[k].name);
+		parameter_entries[k].value = parameters[k].is_int ? *(int*) parameters[k].value : *(double*) parameters[k].value;
+	}
+
+	struct binary_axis_entry *axis_entries = (struct binary_axis_entry*) (parameter_entries + parameters_count);
+	for(int a = 0; a < axis_count; ++a) {
+		copy_name(axis_entries[a].name, axes[a].name);
+		axis_entries[a].length = axes[a].length;
+		axis_entries[a].offset = axis_offsets[a];
+		memcpy(buffer + axis_offsets[a], axes[a].values, axes[a].length * sizeof(double));
+	}
+
+	struct binary_array_entry *array_entries = (struct binary_array_entry*) (axis_entries + axis_count);
+	for(int a = 0; a < array_count; ++a) {
+		const struct binary_array *array = &arrays[a];
+		int x = axes[array->axes[0]].length;
+		int y = axes[array->axes[1]].length;
+		bool packed = array->flags != NULL || array->packed;
+		copy_name(array_entries[a].name, array->name);
+		array_entries[a].type = packed ? BINARY_TYPE_FLAGS : BINARY_TYPE_DOUBLE;
+		array_entries[a].rank = 2;
+		array_entries[a].axes[0] = array->axes[0];
+		array_entries[a].axes[1] = array->axes[1];
+		array_entries[a].axes[2] = -1;
+		array_entries[a].offset = array_offsets[a];
+		array_entries[a].size = array_sizes[a];
+
+		char *dst = buffer + array_offsets[a];
+		if(!packed) {
+			for(int i = 0; i < x; ++i)
+				memcpy(dst + (size_t) i * y * sizeof(double), array->values[i], y * sizeof(double));
+		} else {
+			uint8_t *bits = (uint8_t*) dst;
+			size_t k = 0;
+			for(int i = 0; i < x; ++i) {
+				for(int j = 0; j < y; ++j, ++k) {
+					bool flag = array->flags != NULL ? get_flag(array->flags, i, j) : array->values[i][j] != 0;
+					if(flag)
+						bits[k >> 3] |= 1 << (k & 7);
+				}
+			}
+		}
+	}
+	free(axis_offsets);
+	free(array_offsets);
+	free(array_sizes);
+
+	FILE *fp = fopen(filename, "wb");
+	if(fp == NULL) {
+		printf("Error writing file %s\n", filename);
+		free(buffer);
+		return 1;
+	}
+	size_t written = fwrite(buffer, 1, file_size, fp);
+	free(buffer);
+	if(written != file_size) {
+		printf("Error writing file %s\n", filename);
+		fclose(fp);
+		return 1;
+	}
+	if(fclose(fp)) {
+		printf("I/O error when closing file %s\n", filename);
+		return 2;
+	}
+	return 0;
+}
+
+// Maps filename into memory (reads it on Windows) and checks the tables. Returns NULL if the file cannot be read or is not a valid result file.
+struct binary_result* open_binary_result(const char *filename) {
+	struct binary_result *res = calloc(1, sizeof(struct binary_result));
+	#ifdef _WIN32
+	FILE *fp = fopen(filename, "rb");
+	if(fp == NULL) {
+		free(res);
+		return NULL;
+	}
+	fseek(fp, 0, SEEK_END);
+	res->size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	char *data = malloc(res->size);
+	if(fread(data, 1, res->size, fp) != res->size) {
+		fclose(fp);
+		free(data);
+		free(res);
+		return NULL;
+	}
+	fclose(fp);
+	res->data = data;
+	res->mapped = false;
+	#else
+	int fd = open(filename, O_RDONLY);
+	if(fd < 0) {
+		free(res);
+		return NULL;
+	}
+	struct stat st;
+	if(fstat(fd, &st) || st.st_size < (off_t) sizeof(struct binary_header)) {
+		close(fd);
+		free(res);
+		return NULL;
+	}
+	res->size = st.st_size;
+	void *data = mmap(NULL, res->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED) {
+		free(res);
+		return NULL;
+	}
+	res->data = data;
+	res->mapped = true;
+	#endif
+
+	res->header = (const struct binary_header*) res->data;
+	const struct binary_header *h = res->header;
+	if(res->size < sizeof(struct binary_header) || memcmp(h->magic, binary_magic, sizeof h->magic) || h->version != BINARY_RESULT_VERSION ||
+	   h->file_size != res->size) {
+		close_binary_result(res);
+		return NULL;
+	}
+	size_t tables = sizeof(struct binary_header) + (size_t) h->parameter_count * sizeof(struct binary_parameter_entry) +
+		(size_t) h->axis_count * sizeof(struct binary_axis_entry) + (size_t) h->array_count * sizeof(struct binary_array_entry);
+	if(tables > res->size) {
+		close_binary_result(res);
+		return NULL;
+	}
+	res->parameters = (const struct binary_parameter_entry*) (h + 1);
+	res->axes = (const struct binary_axis_entry*) (res->parameters + h->parameter_count);
+	res->arrays = (const struct binary_array_entry*) (res->axes + h->axis_count);
+	for(uint32_t a = 0; a < h->axis_count; ++a) {
+		if(res->axes[a].offset + res->axes[a].length * sizeof(double) > res->size) {
+			close_binary_result(res);
+			return NULL;
+		}
+	}
+	for(uint32_t a = 0; a < h->array_count; ++a) {
+		if(res->arrays[a].offset + res->arrays[a].size > res->size) {
+			close_binary_result(res);
+			return NULL;
+		}
+	}
+	return res;
+}
+
+void close_binary_result(struct binary_result *res) {
+	if(res == NULL)
+		return;
+	#ifdef _WIN32
+	free((void*) res->data);
+	#else
+	munmap((void*) res->data, res->size);
+	#endif
+	free(res);
+}
+
+// Looks up parameter name, returns false if there is no such parameter
+bool binary_result_parameter(const struct binary_result *res, const char *name, double *value) {
+	for(uint32_t k = 0; k < res->header->parameter_count; ++k) {
+		if(!strncmp(res->parameters[k].name, name, BINARY_NAME_LENGTH)) {
+			*value = res->parameters[k].value;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Returns the values of axis name and sets length, or NULL if there is no such axis
+const double* binary_result_axis(const struct binary_result *res, const char *name, int *length) {
+	for(uint32_t a = 0; a < res->header->axis_count; ++a) {
+		if(!strncmp(res->axes[a].name, name, BINARY_NAME_LENGTH)) {
+			if(length != NULL)
+				*length = res->axes[a].length;
+			return (const double*) (res->data + res->axes[a].offset);
+		}
+	}
+	return NULL;
+}
+
+static const struct binary_array_entry* find_array(const struct binary_result *res, const char *name, uint32_t type) {
+	for(uint32_t a = 0; a < res->header->array_count; ++a) {
+		if(res->arrays[a].type == type && !strncmp(res->arrays[a].name, name, BINARY_NAME_LENGTH))
+			return &res->arrays[a];
+	}
+	return NULL;
+}
+
+// Returns the array of doubles name, or NULL if there is no such array. If entry is not NULL, it is set to the table entry (axes and size).
+const double* binary_result_array(const struct binary_result *res, const char *name, const struct binary_array_entry **entry) {
+	const struct binary_array_entry *e = find_array(res, name, BINARY_TYPE_DOUBLE);
+	if(entry != NULL)
+		*entry = e;
+	return e != NULL ? (const double*) (res->data + e->offset) : NULL;
+}
+
+// Returns the bit-packed flags name (read them with binary_flag), or NULL if there are no such flags
+const uint8_t* binary_result_flags(const struct binary_result *res, const char *name, const struct binary_array_entry **entry) {
+	const struct binary_array_entry *e = find_array(res, name, BINARY_TYPE_FLAGS);
+	if(entry != NULL)
+		*entry = e;
+	return e != NULL ? (const uint8_t*) (res->data + e->offset) : NULL;
+}
+
+// Results of mca_standalone and mca_part on the WL grid
+int write_standalone_result(char *filename) {
+	struct binary_axis axes[] = {
+		{"W", W_grid, W_grid_size},
+		{"L", L_grid, L_grid_size}
+	};
+	struct binary_array arrays[5 + SENSITIVITY_PARAMETERS] = {
+		{"equity", equity, NULL, false, {0, 1}},
+		{"investment", investment, NULL, false, {0, 1}},
+		{"defaulting", NULL, defaulting, true, {0, 1}},
+		{"equity_W", equity_W, NULL, false, {0, 1}},
+		{"equity_L", equity_L, NULL, false, {0, 1}}
+	};
+	// With --sensitivity, the derivatives of equity follow as d_equity_d_<parameter>
+	char names[SENSITIVITY_PARAMETERS][BINARY_NAME_LENGTH];
+	for(int k = 0; k < sensitivity_count; ++k) {
+		snprintf(names[k], BINARY_NAME_LENGTH, "d_equity_d_%s", sensitivity_names[sensitivity_parameter[k]]);
+		arrays[5 + k] = (struct binary_array) {names[k], equity_sensitivity[k], NULL, false, {0, 1}};
+	}
+	return write_binary_result(filename, axes, 2, arrays, 5 + sensitivity_count);
+}
+
+// Results of mca_find_EP on the PL grid
+int write_find_EP_result(char *filename) {
+	struct binary_axis axes[] = {
+		{"P", P_grid, P_grid_size},
+		{"L", L_grid, L_grid_size}
+	};
+	struct binary_array arrays[] = {
+		{"optimal_equity", optimal_equity, NULL, false, {0, 1}},
+		{"optimal_cash", optimal_cash, NULL, false, {0, 1}},
+		{"optimal_investment", optimal_investment, NULL, false, {0, 1}},
+		{"optimal_defaulting", optimal_defaulting, NULL, true, {0, 1}},
+		{"optimal_equity_W", optimal_equity_W, NULL, false, {0, 1}},
+		{"optimal_equity_L", optimal_equity_L, NULL, false, {0, 1}}
+	};
+	return write_binary_result(filename, axes, 2, arrays, 6);
+}
+
+// CUBE WRITER
+// The tables and the axes are written when the cube is opened, the arrays are filled in place by write_cube_slice(). The slices of the arrays
+// of doubles are contiguous, those of the flags start in the middle of a byte unless W_grid_size * L_grid_size is a multiple of 8, so the
+// bytes at their ends are read back and only the bits of the slice are changed.
+
+#define CUBE_ARRAYS 6
+#define CUBE_DEFAULTING 2
+#define CUBE_SOLVED 5
+
+static const char *const cube_array_names[CUBE_ARRAYS] = {"equity", "investment", "defaulting", "equity_W", "equity_L", "solved"};
+static FILE *cube_fp = NULL;
+static uint64_t cube_offsets[CUBE_ARRAYS];
+
+// fseek takes a long, which only has 32 bits on Windows
+static int seek_cube(uint64_t offset) {
+	#ifdef _WIN32
+	return _fseeki64(cube_fp, offset, SEEK_SET);
+	#else
+	return fseek(cube_fp, (long) offset, SEEK_SET);
+	#endif
+}
+
+// Sets the n bits from bit first on of the flags at offset to the flags of the WL grid flags, or all of them if flags is NULL.
+// Returns 0 if successful, 1 in case of read or write error.
+static int write_cube_flags(uint64_t offset, uint64_t first, uint64_t n, uint64_t **flags) {
+	uint64_t begin = first >> 3;
+	size_t length = ((first + n + 7) >> 3) - begin;
+	uint8_t *bytes = malloc(length);
+	if(seek_cube(offset + begin) || fread(bytes, 1, length, cube_fp) != length) {
+		free(bytes);
+		return 1;
+	}
+	for(uint64_t k = 0; k < n; ++k) {
+		uint64_t bit = first + k - (begin << 3);
+		if(flags == NULL || get_flag(flags, k / L_grid_size, k % L_grid_size))
+			bytes[bit >> 3] |= 1 << (bit & 7);
+		else
+			bytes[bit >> 3] &= ~(1 << (bit & 7));
+	}
+	int status = seek_cube(offset + begin) || fwrite(bytes, 1, length, cube_fp) != length;
+	free(bytes);
+	return status;
+}
+
+// Lays out cube_file for P_grid and the grids given by the parameters. With --resume, an existing cube for the same grids is opened instead,
+// so that the values of P solved before the checkpoint are kept.
+// Returns 0 if successful, 1 if the file cannot be written or, when resuming, holds a cube for other grids.
+int open_cube_writer() {
+	struct binary_axis axes[3] = {
+		{"P", P_grid, P_grid_size},
+		{"W", W_grid, W_grid_size},
+		{"L", L_grid, L_grid_size}
+	};
+	uint64_t slice = (uint64_t) W_grid_size * L_grid_size;
+
+	// Compute the layout
+	size_t parameters_end = sizeof(struct binary_header) + parameters_count * sizeof(struct binary_parameter_entry);
+	size_t offset = parameters_end + 3 * sizeof(struct binary_axis_entry) + CUBE_ARRAYS * sizeof(struct binary_array_entry);
+	size_t axis_offsets[3];
+	for(int a = 0; a < 3; ++a) {
+		offset = align(offset);
+		axis_offsets[a] = offset;
+		offset += axes[a].length * sizeof(double);
+	}
+	uint64_t sizes[CUBE_ARRAYS];
+	for(int a = 0; a < CUBE_ARRAYS; ++a) {
+		if(a == CUBE_DEFAULTING)
+			sizes[a] = (P_grid_size * slice + 7) / 8;
+		else if(a == CUBE_SOLVED)
+			sizes[a] = (P_grid_size + 7) / 8;
+		else
+			sizes[a] = P_grid_size * slice * sizeof(double);
+		offset = align(offset);
+		cube_offsets[a] = offset;
+		offset += sizes[a];
+	}
+	uint64_t file_size = align(offset);
+	size_t data_start = cube_offsets[0];
+	char *buffer = calloc(data_start, 1);
+
+	// Tables and axes
+	struct binary_header *header = (struct binary_header*) buffer;
+	memcpy(header->magic, binary_magic, sizeof header->magic);
+	header->version = BINARY_RESULT_VERSION;
+	header->parameter_count = parameters_count;
+	header->axis_count = 3;
+	header->array_count = CUBE_ARRAYS;
+	header->file_size = file_size;
+
+	struct binary_parameter_entry *parameter_entries = (struct binary_parameter_entry*) (header + 1);
+	for(int k = 0; k < parameters_count; ++k) {
+		copy_name(parameter_entries[k].name, parameters[k].name);
+		parameter_entries[k].value = parameters[k].is_int ? *(int*) parameters[k].value : *(double*) parameters[k].value;
+	}
+
+	struct binary_axis_entry *axis_entries = (struct binary_axis_entry*) (parameter_entries + parameters_count);
+	for(int a = 0; a < 3; ++a) {
+		copy_name(axis_entries[a].name, axes[a].name);
+		axis_entries[a].length = axes[a].length;
+		axis_entries[a].offset = axis_offsets[a];
+		memcpy(buffer + axis_offsets[a], axes[a].values, axes[a].length * sizeof(double));
+	}
+
+	struct binary_array_entry *array_entries = (struct binary_array_entry*) (axis_entries + 3);
+	for(int a = 0; a < CUBE_ARRAYS; ++a) {
+		copy_name(array_entries[a].name, cube_array_names[a]);
+		array_entries[a].type = (a == CUBE_DEFAULTING || a == CUBE_SOLVED) ? BINARY_TYPE_FLAGS : BINARY_TYPE_DOUBLE;
+		array_entries[a].rank = a == CUBE_SOLVED ? 1 : 3;
+		array_entries[a].axes[0] = 0;
+		array_entries[a].axes[1] = a == CUBE_SOLVED ? -1 : 1;
+		array_entries[a].axes[2] = a == CUBE_SOLVED ? -1 : 2;
+		array_entries[a].offset = cube_offsets[a];
+		array_entries[a].size = sizes[a];
+	}
+
+	// When resuming, everything but the parameters has to be the same. P is not, mca_find_EP overwrites it.
+	if(resume) {
+		struct binary_result *res = open_binary_result(cube_file);
+		if(res != NULL) {
+			bool same = res->size >= data_start && !memcmp(res->data, buffer, sizeof(struct binary_header)) &&
+			            !memcmp(res->data + parameters_end, buffer + parameters_end, data_start - parameters_end);
+			close_binary_result(res);
+			free(buffer);
+			if(!same) {
+				printf("Cube file %s holds a cube for other grids\n", cube_file);
+				return 1;
+			}
+			cube_fp = fopen(cube_file, "r+b");
+			if(cube_fp == NULL) {
+				printf("Error writing file %s\n", cube_file);
+				return 1;
+			}
+			return 0;
+		}
+	}
+
+	// The arrays are left to the file system to fill with zeros
+	cube_fp = fopen(cube_file, "w+b");
+	if(cube_fp == NULL) {
+		printf("Error writing file %s\n", cube_file);
+		free(buffer);
+		return 1;
+	}
+	bool failed = fwrite(buffer, 1, data_start, cube_fp) != data_start || seek_cube(file_size - 1) || fputc(0, cube_fp) == EOF;
+	free(buffer);
+	if(failed || fflush(cube_fp)) {
+		printf("Error writing file %s\n", cube_file);
+		fclose(cube_fp);
+		cube_fp = NULL;
+		return 1;
+	}
+	return 0;
+}
+
+// Writes equity, investment, defaulting, equity_W and equity_L at t = 0 for P_grid[p] into the cube, and then marks p as solved.
+// Returns 0 if successful, 1 in case of write error.
+int write_cube_slice(int p) {
+	uint64_t slice = (uint64_t) W_grid_size * L_grid_size;
+	double **grids[CUBE_ARRAYS] = {equity, investment, NULL, equity_W, equity_L, NULL};
+	bool failed = false;
+	for(int a = 0; a < CUBE_ARRAYS && !failed; ++a) {
+		if(grids[a] == NULL)
+			continue;
+		failed = seek_cube(cube_offsets[a] + p * slice * sizeof(double));
+		for(int i = 0; i < W_grid_size && !failed; ++i)
+			failed = fwrite(grids[a][i], sizeof(double), L_grid_size, cube_fp) != (size_t) L_grid_size;
+	}
+	failed = failed || write_cube_flags(cube_offsets[CUBE_DEFAULTING], p * slice, slice, defaulting) || fflush(cube_fp) ||
+	         write_cube_flags(cube_offsets[CUBE_SOLVED], p, 1, NULL) || fflush(cube_fp);
+	if(failed) {
+		printf("Error writing file %s\n", cube_file);
+		return 1;
+	}
+	return 0;
+}
+
+// Returns 0 if successful, 1 in case of error closing the file
+int close_cube_writer() {
+	if(cube_fp == NULL)
+		return 0;
+	int status = fclose(cube_fp);
+	cube_fp = NULL;
+	if(status) {
+		printf("I/O error when closing file %s\n", cube_file);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,122 @@
+#ifndef MCA_BINARY_H
+#define MCA_BINARY_H
+
+// BINARY RESULT FILES
+// A binary result file holds the complete result of a run in one file: the parameter set, the grid axes and the result arrays.
+// Arrays of doubles are stored as raw doubles, flags (defaulting) are bit-packed. All blocks are aligned to 64 bytes, so the file can be
+// memory-mapped and the arrays used in place.
+//
+// Layout:
+// struct binary_header
+// struct binary_parameter_entry[parameter_count]
+// struct binary_axis_entry[axis_count]
+// struct binary_array_entry[array_count]
+// data blocks at the offsets given in the entries
+//
+// An array of rank 2 with axes {a, b} has dimensions length(a) x length(b) and is stored row by row, i.e. element (x, y) is at index
+// x * length(b) + y. Likewise, element (x, y, z) of an array of rank 3 with axes {a, b, c} is at index (x * length(b) + y) * length(c) + z.
+// Unused axes are -1. For flags, element k is bit k % 8 of byte k / 8.
+//
+// Example for reading the equity surface written by mca_standalone:
+//	struct binary_result *res = open_binary_result("result.mcab");
+//	int W_size, L_size;
+//	const double *W = binary_result_axis(res, "W", &W_size);
+//	const double *L = binary_result_axis(res, "L", &L_size);
+//	const double *E = binary_result_array(res, "equity", NULL);		// E[i * L_size + j] is the equity at (W[i], L[j])
+//	close_binary_result(res);
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define BINARY_RESULT_VERSION 1
+#define BINARY_NAME_LENGTH 40
+#define BINARY_ALIGNMENT 64
+#define BINARY_TYPE_DOUBLE 0
+#define BINARY_TYPE_FLAGS 1
+
+struct binary_header {
+	char magic[8];																					// "MCARES\0\0"
+	uint32_t version;
+	uint32_t parameter_count;
+	uint32_t axis_count;
+	uint32_t array_count;
+	uint64_t file_size;
+};
+
+struct binary_parameter_entry {
+	char name[BINARY_NAME_LENGTH];
+	double value;																					// Integer parameters are stored as doubles as well
+};
+
+struct binary_axis_entry {
+	char name[BINARY_NAME_LENGTH];
+	uint64_t length;
+	uint64_t offset;
+};
+
+struct binary_array_entry {
+	char name[BINARY_NAME_LENGTH];
+	uint32_t type;																					// BINARY_TYPE_DOUBLE or BINARY_TYPE_FLAGS
+	uint32_t rank;
+	int32_t axes[3];																				// Indices into the axis entries
+	uint32_t reserved;
+	uint64_t offset;
+	uint64_t size;																					// In bytes
+};
+
+// WRITING
+// An axis to be written, values has length elements
+struct binary_axis {
+	const char *name;
+	const double *values;
+	int length;
+};
+
+// A two-dimensional array to be written, given by its rows. Exactly one of values and flags is used.
+// If packed is true, values are stored as flags (value != 0), flags are always stored as flags.
+struct binary_array {
+	const char *name;
+	double **values;
+	uint64_t **flags;																				// Bit-packed, see get_flag() in mca.h
+	bool packed;
+	int axes[2];																					// Indices into the axes passed to write_binary_result
+};
+
+int write_binary_result(char *filename, const struct binary_axis *axes, int axis_count, const struct binary_array *arrays, int array_count);
+int write_standalone_result(char *filename);
+int write_find_EP_result(char *filename);
+
+// CUBE FILES
+// With --cube=file, mca_find_EP keeps the complete results at t = 0 for every P instead of only the optimal cash position: a binary result
+// file with the axes P, W and L and the arrays equity, investment, defaulting (flags), equity_W and equity_L of rank 3, e.g. equity
+// (p, i, j) is the equity at (P[p], W[i], L[j]). The flags solved of rank 1 on the axis P tell which values of P are in the file.
+// The file is laid out when the solver starts and every P is written into its place as soon as it has been solved, so an interrupted or
+// resumed run keeps the values of P it has finished. mca_cube maps the file and chooses the cash position with other objectives.
+int open_cube_writer();
+int write_cube_slice(int p);
+int close_cube_writer();
+
+// READING
+struct binary_result {
+	const char *data;
+	size_t size;
+	bool mapped;
+	const struct binary_header *header;
+	const struct binary_parameter_entry *parameters;
+	const struct binary_axis_entry *axes;
+	const struct binary_array_entry *arrays;
+};
+
+struct binary_result* open_binary_result(const char *filename);
+void close_binary_result(struct binary_result *res);
+bool binary_result_parameter(const struct binary_result *res, const char *name, double *value);
+const double* binary_result_axis(const struct binary_result *res, const char *name, int *length);
+const double* binary_result_array(const struct binary_result *res, const char *name, const struct binary_array_entry **entry);
+const uint8_t* binary_result_flags(const struct binary_result *res, const char *name, const struct binary_array_entry **entry);
+
+static inline bool binary_flag(const uint8_t *flags, size_t k) {
+	return (flags[k >> 3] >> (k & 7)) & 1;
+}
+
+#endif
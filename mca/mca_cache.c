@@ -0,0 +1,247 @@
+// This file defines the result cache, see mca_cache.h:
+// bool cache_lookup(bool find_EP);									-- load the result for the current parameters from the cache
+// void cache_store(bool find_EP);									-- add the result of the solver to the cache
+//
+// The cache is used by the executables if cache_directory is not NULL (set by read_options() in mca_io.c). Errors of the cache are reported,
+// but never fail the run: the worst case is solving the model again.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <utime.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define make_directory(path) _mkdir(path)
+#define process_id() _getpid()
+#else
+#include <unistd.h>
+#define make_directory(path) mkdir(path, 0777)
+#define process_id() getpid()
+#endif
+
+#include "mca.h"
+#include "mca_io.h"
+#include "mca_binary.h"
+#include "mca_cache.h"
+
+#define CACHE_PATH_LENGTH 1024
+#define CACHE_LOCK_TIMEOUT 600																			// Seconds after which a lock is considered stale
+
+static uint64_t cache_key;
+static bool cache_key_set = false;
+
+// Path of the cache entry for the current key
+static void entry_path(char *path, bool find_EP) {
+	snprintf(path, CACHE_PATH_LENGTH, "%s/%016llx-v%i-%s.mcab", cache_directory, (unsigned long long) cache_key, MCA_SOLVER_VERSION,
+	         find_EP ? "find_EP" : "standalone");
+}
+
+// Checks that the parameters in the cache entry are the current parameters, in case two parameter sets have the same hash.
+// mca_find_EP overwrites P, so we do not compare it for mca_find_EP.
+static bool same_parameters(const struct binary_result *res, bool find_EP) {
+	for(int k = 0; k < parameters_count; ++k) {
+		double value;
+		if(find_EP && !strcmp(parameters[k].name, "P"))
+			continue;
+		if(!binary_result_parameter(res, parameters[k].name, &value))
+			return false;
+		if(value != (parameters[k].is_int ? *(int*) parameters[k].value : *(double*) parameters[k].value))
+			return false;
+	}
+	return true;
+}
+
+// Copies array name with dimensions x and y from the cache entry into grid. Returns false if the array is missing or has the wrong size.
+static bool load_array(const struct binary_result *res, const char *name, double **grid, int x, int y) {
+	const struct binary_array_entry *entry;
+	const double *values = binary_result_array(res, name, &entry);
+	if(values == NULL || entry->size != (uint64_t) x * y * sizeof(double))
+		return false;
+	for(int i = 0; i < x; ++i)
+		memcpy(grid[i], values + (size_t) i * y, y * sizeof(double));
+	return true;
+}
+
+// Like load_array for flags, which are stored in grid either bit-packed or, if grid_double is given, as doubles 0 and 1
+static bool load_flags(const struct binary_result *res, const char *name, uint64_t **grid, double **grid_double, int x, int y) {
+	const struct binary_array_entry *entry;
+	const uint8_t *flags = binary_result_flags(res, name, &entry);
+	if(flags == NULL || entry->size != ((uint64_t) x * y + 7) / 8)
+		return false;
+	for(int i = 0; i < x; ++i) {
+		for(int j = 0; j < y; ++j) {
+			bool flag = binary_flag(flags, (size_t) i * y + j);
+			if(grid_double != NULL)
+				grid_double[i][j] = flag;
+			else
+				set_flag(grid, i, j, flag);
+		}
+	}
+	return true;
+}
+
+// Looks up the result for the current parameters. Has to be called right after reading the parameters, since the key for cache_store() is
+// computed here as well. If the result is in the cache, the data structures are set up as by mca_standalone() or mca_find_EP() and filled
+// with the result. Returns true if the result was loaded from the cache.
+bool cache_lookup(bool find_EP) {
+	if(cache_directory == NULL)
+		return false;
+	cache_key = hash_parameters();
+	cache_key_set = true;
+	if(trajectory_file != NULL)
+		return false;																			// We need to run the solver to record the trajectory
+	if(sensitivity_count > 0)
+		return false;																			// The entries do not necessarily hold the sensitivities
+	if(cube_file != NULL)
+		return false;																			// The entries only hold the optimal cash positions
+
+	char path[CACHE_PATH_LENGTH];
+	entry_path(path, find_EP);
+	struct binary_result *res = open_binary_result(path);
+	if(res == NULL)
+		return false;
+	if(!same_parameters(res, find_EP)) {
+		close_binary_result(res);
+		return false;
+	}
+
+	bool loaded;
+	if(find_EP) {
+		mca_find_EP_setup();
+		loaded = load_array(res, "optimal_equity", optimal_equity, P_grid_size, L_grid_size) &&
+		         load_array(res, "optimal_cash", optimal_cash, P_grid_size, L_grid_size) &&
+		         load_array(res, "optimal_investment", optimal_investment, P_grid_size, L_grid_size) &&
+		         load_flags(res, "optimal_defaulting", NULL, optimal_defaulting, P_grid_size, L_grid_size) &&
+		         load_array(res, "optimal_equity_W", optimal_equity_W, P_grid_size, L_grid_size) &&
+		         load_array(res, "optimal_equity_L", optimal_equity_L, P_grid_size, L_grid_size);
+		double P_last;
+		if(binary_result_parameter(res, "P", &P_last))
+			P = P_last;
+	} else {
+		mca_initial_setup();
+		loaded = load_array(res, "equity", equity, W_grid_size, L_grid_size) &&
+		         load_array(res, "investment", investment, W_grid_size, L_grid_size) &&
+		         load_flags(res, "defaulting", defaulting, NULL, W_grid_size, L_grid_size) &&
+		         load_array(res, "equity_W", equity_W, W_grid_size, L_grid_size) &&
+		         load_array(res, "equity_L", equity_L, W_grid_size, L_grid_size);
+	}
+	close_binary_result(res);
+	if(!loaded) {
+		printf("Ignoring invalid cache entry %s\n", path);
+		if(find_EP)
+			clean_up_find_EP();
+		else
+			clean_up_standalone();
+		return false;
+	}
+
+	// Mark the entry as recently used
+	utime(path, NULL);
+	printf("Loaded result from cache entry %s\n", path);
+	return true;
+}
+
+// A file in the cache directory
+struct cache_entry {
+	char name[CACHE_PATH_LENGTH];
+	time_t used;
+	long long size;
+};
+
+static int compare_entries(const void *a, const void *b) {
+	time_t x = ((const struct cache_entry*) a)->used;
+	time_t y = ((const struct cache_entry*) b)->used;
+	return (x > y) - (x < y);
+}
+
+// Deletes the least recently used entries until the cache fits into cache_size_limit. Only one process evicts at a time: the lock is a
+// directory, since creating a directory either succeeds or fails atomically. If another process holds the lock, we leave the eviction to it.
+static void evict() {
+	char lock[CACHE_PATH_LENGTH];
+	snprintf(lock, sizeof lock, "%s/lock", cache_directory);
+	if(make_directory(lock)) {
+		struct stat st;
+		if(errno != EEXIST || stat(lock, &st) || difftime(time(NULL), st.st_mtime) < CACHE_LOCK_TIMEOUT)
+			return;
+		// The process holding the lock has died
+		rmdir(lock);
+		if(make_directory(lock))
+			return;
+	}
+
+	DIR *dir = opendir(cache_directory);
+	if(dir == NULL) {
+		rmdir(lock);
+		return;
+	}
+	struct cache_entry *entries = NULL;
+	int count = 0, capacity = 0;
+	long long total = 0;
+	struct dirent *d;
+	while((d = readdir(dir)) != NULL) {
+		size_t length = strlen(d->d_name);
+		if(length > 4 && !strcmp(d->d_name + length - 4, ".tmp")) {
+			// Left behind by a process that was killed while adding an entry
+			char name[CACHE_PATH_LENGTH];
+			struct stat st;
+			snprintf(name, sizeof name, "%s/%s", cache_directory, d->d_name);
+			if(!stat(name, &st) && difftime(time(NULL), st.st_mtime) > CACHE_LOCK_TIMEOUT)
+				remove(name);
+			continue;
+		}
+		if(length < 5 || strcmp(d->d_name + length - 5, ".mcab"))
+			continue;
+		if(count == capacity) {
+			capacity = capacity ? 2 * capacity : 64;
+			entries = realloc(entries, capacity * sizeof(struct cache_entry));
+		}
+		struct stat st;
+		snprintf(entries[count].name, CACHE_PATH_LENGTH, "%s/%s", cache_directory, d->d_name);
+		if(stat(entries[count].name, &st))
+			continue;
+		entries[count].used = st.st_mtime;
+		entries[count].size = st.st_size;
+		total += st.st_size;
+		++count;
+	}
+	closedir(dir);
+
+	qsort(entries, count, sizeof(struct cache_entry), compare_entries);
+	for(int k = 0; k < count && total > cache_size_limit; ++k) {
+		if(!remove(entries[k].name))
+			total -= entries[k].size;
+	}
+	free(entries);
+	rmdir(lock);
+}
+
+// Adds the result of mca_standalone() or mca_find_EP() for the parameters of the preceding cache_lookup() to the cache
+void cache_store(bool find_EP) {
+	if(cache_directory == NULL || !cache_key_set)
+		return;
+	if(make_directory(cache_directory) && errno != EEXIST) {
+		printf("Could not create cache directory %s\n", cache_directory);
+		return;
+	}
+
+	// Write to a file only this process uses, and rename it once it is complete, such that other processes never see a partial entry
+	char path[CACHE_PATH_LENGTH], temporary[CACHE_PATH_LENGTH + 32];
+	entry_path(path, find_EP);
+	snprintf(temporary, sizeof temporary, "%s.%li.tmp", path, (long) process_id());
+	int status = find_EP ? write_find_EP_result(temporary) : write_standalone_result(temporary);
+	if(status || rename(temporary, path)) {
+		// On Windows, rename fails if another process has added the same entry in the meantime
+		remove(temporary);
+		return;
+	}
+	evict();
+}
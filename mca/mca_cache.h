@@ -0,0 +1,18 @@
+#ifndef MCA_CACHE_H
+#define MCA_CACHE_H
+
+// RESULT CACHE
+// Results of mca_standalone and mca_find_EP are kept in a cache directory as binary result files (see mca_binary.h), named by the hash of all
+// parameters, the solver version and the kind of program. If the result for the same parameters is in the cache, it is loaded instead of
+// solving the model again.
+//
+// The cache is bounded in size: after adding a result, the least recently used results are deleted until the cache fits. Several processes
+// may use the same cache directory at the same time: results are written to a temporary file and renamed, and only one process at a time
+// evicts results, guarded by a lock directory.
+
+#include <stdbool.h>
+
+bool cache_lookup(bool find_EP);
+void cache_store(bool find_EP);
+
+#endif
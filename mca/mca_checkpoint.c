@@ -0,0 +1,319 @@
+// This file defines the functions for checkpointing the solver:
+// void init_checkpoint();											-- remember the hash of the parameters, call right after reading the parameter file
+// void write_checkpoint(int time_step);							-- save the state after time step time_step in the background
+// int wait_for_checkpoint();										-- wait until the last checkpoint is on disk
+// int read_checkpoint(bool find_EP, int *time_step, int *P_index);	-- restore the state from the checkpoint file
+
+// A checkpoint holds the full state of the solver after a completed time step: the WL grids for equity, investment and the bit-packed
+// defaulting flags, the index of the time step and of P (mca_find_EP only), as well as the PL result grids of mca_find_EP. With
+// predictor_order, it also holds the state of the predictor (see predict() in mca.c): the equity of the preceding time steps and the
+// investment of the preceding time step. With policy_freeze_interval, it holds the snapshot of the policy and the state of the freeze (see
+// POLICY FREEZE in mca.c), but not the coefficients of the frozen chain: investment does not change while the policy is frozen, so
+// assemble_chain() recomputes them exactly. The hash of the parameters makes sure that we do not resume a run with different parameters.
+// iteration_equity and new_equity are not saved: at the end of a time step iteration_equity equals equity and new_equity is overwritten anyway.
+// Neither are the derivatives of equity, which traverse_time() computes from equity and defaulting once the last time step is done.
+//
+// Writing a checkpoint copies the state into a buffer and hands the buffer to a writer thread, so that the solver only pays for the copy.
+// The writer writes to a temporary file and renames it to the checkpoint file once it is complete, such that the checkpoint file is always
+// a complete checkpoint, even if the program is killed while writing.
+//
+// Resuming is bit-exact, also with a different number of OpenMP threads (step() sums the changes of equity in a fixed order).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "mca.h"
+#include "mca_io.h"
+#include "mca_checkpoint.h"
+
+#define CHECKPOINT_VERSION 6
+
+struct checkpoint_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t find_EP;																				// 1 if written by mca_find_EP, 0 otherwise
+	uint64_t parameters_hash;
+	int32_t W_grid_size;
+	int32_t L_grid_size;
+	int32_t P_grid_size;
+	int32_t T_grid_size;
+	int32_t time_step;																				// Last completed time step
+	int32_t P_index;
+	int32_t predictor_history;
+	int32_t frozen_steps;
+	double predictor_change;
+	int32_t policy_snapshot_taken;
+	int32_t reserved;
+	double frozen_change;
+};
+
+static const char checkpoint_magic[8] = "MCACKPT";
+
+static uint64_t checkpoint_parameters_hash;
+
+// State of the writer thread
+static pthread_t writer;
+static bool writer_running = false;
+static int writer_status = 0;
+static char *buffer = NULL;
+static size_t buffer_size = 0;
+
+void init_checkpoint() {
+	checkpoint_parameters_hash = hash_parameters();
+}
+
+// Size of the checkpoint for the current grid sizes
+static size_t checkpoint_size(bool find_EP) {
+	size_t WL = (size_t) W_grid_size * L_grid_size;
+	size_t flags = (size_t) W_grid_size * FLAG_WORDS(L_grid_size) * sizeof(uint64_t);
+	size_t size = sizeof(struct checkpoint_header) + 2 * WL * sizeof(double) + flags;
+	if(find_EP)
+		size += 6 * (size_t) P_grid_size * L_grid_size * sizeof(double);
+	if(predictor_order > 0)
+		size += (predictor_order + 1) * WL * sizeof(double);
+	if(policy_freeze_interval > 0)
+		size += 2 * flags;
+	return size;
+}
+
+static char* put_WL_grid(char *dst, double **grid) {
+	for(int i = 0; i < W_grid_size; ++i) {
+		memcpy(dst, grid[i], L_grid_size * sizeof(double));
+		dst += L_grid_size * sizeof(double);
+	}
+	return dst;
+}
+
+static char* put_PL_grid(char *dst, double **grid) {
+	for(int p = 0; p < P_grid_size; ++p) {
+		memcpy(dst, grid[p], L_grid_size * sizeof(double));
+		dst += L_grid_size * sizeof(double);
+	}
+	return dst;
+}
+
+static char* put_flags(char *dst, uint64_t **flags) {
+	for(int i = 0; i < W_grid_size; ++i) {
+		memcpy(dst, flags[i], FLAG_WORDS(L_grid_size) * sizeof(uint64_t));
+		dst += FLAG_WORDS(L_grid_size) * sizeof(uint64_t);
+	}
+	return dst;
+}
+
+static const char* get_WL_grid(const char *src, double **grid) {
+	for(int i = 0; i < W_grid_size; ++i) {
+		memcpy(grid[i], src, L_grid_size * sizeof(double));
+		src += L_grid_size * sizeof(double);
+	}
+	return src;
+}
+
+static const char* get_PL_grid(const char *src, double **grid) {
+	for(int p = 0; p < P_grid_size; ++p) {
+		memcpy(grid[p], src, L_grid_size * sizeof(double));
+		src += L_grid_size * sizeof(double);
+	}
+	return src;
+}
+
+static const char* get_flags(const char *src, uint64_t **flags) {
+	for(int i = 0; i < W_grid_size; ++i) {
+		memcpy(flags[i], src, FLAG_WORDS(L_grid_size) * sizeof(uint64_t));
+		src += FLAG_WORDS(L_grid_size) * sizeof(uint64_t);
+	}
+	return src;
+}
+
+// Body of the writer thread: write the buffer to a temporary file and rename it to the checkpoint file
+static void* write_buffer(void *arg) {
+	(void) arg;
+	char tmp_file[1024];
+	snprintf(tmp_file, sizeof tmp_file, "%s.tmp", checkpoint_file);
+	writer_status = 1;
+	FILE *fp = fopen(tmp_file, "wb");
+	if(fp == NULL)
+		return NULL;
+	if(fwrite(buffer, 1, buffer_size, fp) != buffer_size || fflush(fp)) {
+		fclose(fp);
+		return NULL;
+	}
+	#ifdef _WIN32
+	_commit(_fileno(fp));
+	#else
+	fsync(fileno(fp));
+	#endif
+	if(fclose(fp))
+		return NULL;
+	#ifdef _WIN32
+	remove(checkpoint_file);																		// rename does not replace existing files on Windows
+	#endif
+	if(rename(tmp_file, checkpoint_file))
+		return NULL;
+	writer_status = 0;
+	return NULL;
+}
+
+// Wait for the writer thread. Returns 0 if the last checkpoint was written successfully, 1 otherwise.
+int wait_for_checkpoint() {
+	if(writer_running) {
+		pthread_join(writer, NULL);
+		writer_running = false;
+		if(writer_status)
+			printf("Error writing checkpoint file %s\n", checkpoint_file);
+	}
+	return writer_status;
+}
+
+// Save the state after time step time_step. A failed checkpoint is reported, but does not stop the solver.
+void write_checkpoint(int time_step) {
+	bool find_EP = P_index >= 0;
+
+	// The buffer is reused, so we need to wait for the preceding checkpoint
+	wait_for_checkpoint();
+
+	size_t size = checkpoint_size(find_EP);
+	if(size != buffer_size) {
+		free(buffer);
+		buffer = malloc(size);
+		buffer_size = size;
+	}
+
+	struct checkpoint_header header;
+	memset(&header, 0, sizeof header);
+	memcpy(header.magic, checkpoint_magic, sizeof header.magic);
+	header.version = CHECKPOINT_VERSION;
+	header.find_EP = find_EP;
+	header.parameters_hash = checkpoint_parameters_hash;
+	header.W_grid_size = W_grid_size;
+	header.L_grid_size = L_grid_size;
+	header.P_grid_size = P_grid_size;
+	header.T_grid_size = T_grid_size;
+	header.time_step = time_step;
+	header.P_index = P_index;
+	header.predictor_history = predictor_history;
+	header.predictor_change = predictor_change;
+	header.frozen_steps = frozen_steps;
+	header.policy_snapshot_taken = policy_snapshot_taken;
+	header.frozen_change = frozen_change;
+
+	char *dst = buffer;
+	memcpy(dst, &header, sizeof header);
+	dst += sizeof header;
+	dst = put_WL_grid(dst, equity);
+	dst = put_WL_grid(dst, investment);
+	dst = put_flags(dst, defaulting);
+	if(find_EP) {
+		dst = put_PL_grid(dst, optimal_equity);
+		dst = put_PL_grid(dst, optimal_cash);
+		dst = put_PL_grid(dst, optimal_investment);
+		dst = put_PL_grid(dst, optimal_defaulting);
+		dst = put_PL_grid(dst, optimal_equity_W);
+		dst = put_PL_grid(dst, optimal_equity_L);
+	}
+	if(predictor_order > 0) {
+		dst = put_WL_grid(dst, spare_equity);
+		dst = put_WL_grid(dst, previous_investment);
+		if(predictor_order == 2)
+			dst = put_WL_grid(dst, older_equity);
+	}
+	if(policy_freeze_interval > 0) {
+		setup_policy_freeze();
+		dst = put_flags(dst, policy_defaulting);
+		dst = put_flags(dst, policy_sign);
+	}
+
+	if(pthread_create(&writer, NULL, write_buffer, NULL)) {
+		printf("Could not start thread for writing checkpoint file %s\n", checkpoint_file);
+		return;
+	}
+	writer_running = true;
+}
+
+// Restore the state from the checkpoint file. The data structures have to be set up already.
+// Sets time_step to the last completed time step and P_index to the index of P the checkpoint was taken at.
+// Returns 0 if successful, 1 if the file cannot be read or does not belong to this run.
+int read_checkpoint(bool find_EP, int *time_step, int *P_index_resume) {
+	FILE *fp = fopen(checkpoint_file, "rb");
+	if(fp == NULL) {
+		printf("Error, could not open checkpoint file %s for reading.\n", checkpoint_file);
+		return 1;
+	}
+	size_t size = checkpoint_size(find_EP);
+	char *data = malloc(size);
+	size_t read = fread(data, 1, size, fp);
+	fclose(fp);
+
+	struct checkpoint_header header;
+	if(read < sizeof header) {
+		printf("Checkpoint file %s is too short.\n", checkpoint_file);
+		goto free_after_error;
+	}
+	memcpy(&header, data, sizeof header);
+	if(memcmp(header.magic, checkpoint_magic, sizeof header.magic) || header.version != CHECKPOINT_VERSION) {
+		printf("%s is not a checkpoint file of this version.\n", checkpoint_file);
+		goto free_after_error;
+	}
+	if(header.find_EP != find_EP || header.parameters_hash != checkpoint_parameters_hash || header.W_grid_size != W_grid_size ||
+	   header.L_grid_size != L_grid_size || header.P_grid_size != P_grid_size || header.T_grid_size != T_grid_size) {
+		printf("Checkpoint file %s was written by a different program or with different parameters.\n", checkpoint_file);
+		goto free_after_error;
+	}
+	if(read != size) {
+		printf("Checkpoint file %s is too short.\n", checkpoint_file);
+		goto free_after_error;
+	}
+
+	const char *src = data + sizeof header;
+	src = get_WL_grid(src, equity);
+	src = get_WL_grid(src, investment);
+	src = get_flags(src, defaulting);
+	if(find_EP) {
+		src = get_PL_grid(src, optimal_equity);
+		src = get_PL_grid(src, optimal_cash);
+		src = get_PL_grid(src, optimal_investment);
+		src = get_PL_grid(src, optimal_defaulting);
+		src = get_PL_grid(src, optimal_equity_W);
+		src = get_PL_grid(src, optimal_equity_L);
+	}
+	if(predictor_order > 0) {
+		setup_predictor();
+		src = get_WL_grid(src, spare_equity);
+		src = get_WL_grid(src, previous_investment);
+		if(predictor_order == 2)
+			src = get_WL_grid(src, older_equity);
+		predictor_history = header.predictor_history;
+		predictor_change = header.predictor_change;
+	}
+	if(policy_freeze_interval > 0) {
+		setup_policy_freeze();
+		src = get_flags(src, policy_defaulting);
+		src = get_flags(src, policy_sign);
+		policy_snapshot_taken = header.policy_snapshot_taken;
+		frozen_steps = header.frozen_steps;
+		frozen_change = header.frozen_change;
+		if(frozen_steps >= 0)
+			assemble_chain();
+	}
+
+	// At the end of a time step, iteration_equity points to equity
+	iteration_equity = equity;
+
+	*time_step = header.time_step;
+	*P_index_resume = header.P_index;
+	free(data);
+	return 0;
+
+	free_after_error :
+		free(data);
+		return 1;
+}
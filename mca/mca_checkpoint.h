@@ -0,0 +1,11 @@
+#ifndef MCA_CHECKPOINT_H
+#define MCA_CHECKPOINT_H
+
+#include <stdbool.h>
+
+void init_checkpoint();
+void write_checkpoint(int time_step);
+int wait_for_checkpoint();
+int read_checkpoint(bool find_EP, int *time_step, int *P_index_resume);
+
+#endif
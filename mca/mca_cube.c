@@ -0,0 +1,222 @@
+// Usage:
+// mca_cube.exe cube.mcab optimal_E.csv optimal_W.csv optimal_I.csv optimal_D.csv optimal_equity_W.csv optimal_equity_L.csv [options]
+// mca_cube.exe cube.mcab --binary=result.mcab [options]
+//
+// cube.mcab				-- Cube file written by mca_find_EP with --cube=file (see CUBE FILES in mca_binary.h)
+// optimal_E.csv			-- Output files, as for mca_find_EP
+// ...
+// result.mcab				-- Binary result file with the same arrays as that of mca_find_EP, instead of the CSV files
+//
+// Options (see read_options() in mca_io.c):
+// --equity-cost=x			-- cost per unit of equity raised, by default equity_cost of the parameters the cube was computed with
+// --cash-penalty=x			-- penalty per unit of |W|, default 0
+// --W-lower=x --W-upper=x	-- only choose the cash position W from this range, by default from the whole grid
+// --binary=file
+//
+// For every P and L, mca_find_EP chooses the cash position W with the largest equity(W) - max(W, 0), the value of the bank net of the cash the
+// shareholders put in. mca_cube chooses W from the cube instead, with the largest
+//		equity(W) - (1 + equity_cost) max(W, 0) - cash_penalty |W|
+// among the points of the W grid in [W_lower, W_upper]. The results at the chosen W are written like those of mca_find_EP, so with
+// --equity-cost=0 and the other options left out, they are exactly the same. Values of P missing from the cube give NaN.
+//
+// The cube is mapped into memory and only read through, so evaluating another objective takes seconds instead of solving the model again.
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+// FLAG TO SPECIFIY WHETHER WE SHOULD TIME THE EXECUTION
+#define TIMING
+#ifdef TIMING
+#include <time.h>
+#endif
+
+#include "mca_io.h"
+#include "mca.h"
+#include "mca_binary.h"
+
+static double** create_rows(int x, int y) {
+	double **a = malloc(x * sizeof(double*));
+	for(int i = 0; i < x; ++i)
+		a[i] = malloc(y * sizeof(double));
+	return a;
+}
+
+static void destroy_rows(double **a, int x) {
+	for(int i = 0; i < x; ++i)
+		free(a[i]);
+	free(a);
+}
+
+// Returns the array of rank 3 on the axes P, W and L of the cube, or NULL if the cube does not hold it
+static const void* cube_array(const struct binary_result *res, const char *name, bool flags) {
+	const struct binary_array_entry *entry;
+	const void *values = flags ? (const void*) binary_result_flags(res, name, &entry) : (const void*) binary_result_array(res, name, &entry);
+	uint64_t n = (uint64_t) P_grid_size * W_grid_size * L_grid_size;
+	if(values == NULL || entry->rank != 3 || entry->size != (flags ? (n + 7) / 8 : n * sizeof(double))) {
+		printf("Cube has no array %s for its axes\n", name);
+		return NULL;
+	}
+	return values;
+}
+
+int main(int argc, char* argv[]) {
+	argc = read_options(argc, argv);
+	if(argc < 0) {
+		return 1;
+	}
+	if(check_output_arguments(argc, 2, 6)) {
+		return 1;
+	}
+	char *cube_name = argv[1];
+
+	#ifdef TIMING
+	time_t start, end;
+	time(&start);
+	#endif
+
+	struct binary_result *res = open_binary_result(cube_name);
+	if(res == NULL) {
+		printf("Error reading cube file %s\n", cube_name);
+		return 2;
+	}
+	// The parameters of the cube, so that the result file records them like one written by mca_find_EP
+	for(int k = 0; k < parameters_count; ++k) {
+		double value;
+		if(binary_result_parameter(res, parameters[k].name, &value)) {
+			if(parameters[k].is_int)
+				*(int*) parameters[k].value = (int) value;
+			else
+				*(double*) parameters[k].value = value;
+		}
+	}
+	if(!isnan(cube_equity_cost))
+		equity_cost = cube_equity_cost;
+	const double *P_axis = binary_result_axis(res, "P", &P_grid_size);
+	const double *W_axis = binary_result_axis(res, "W", &W_grid_size);
+	const double *L_axis = binary_result_axis(res, "L", &L_grid_size);
+	const struct binary_array_entry *solved_entry;
+	const uint8_t *solved = binary_result_flags(res, "solved", &solved_entry);
+	if(P_axis == NULL || W_axis == NULL || L_axis == NULL || solved == NULL || solved_entry->size != ((uint64_t) P_grid_size + 7) / 8) {
+		printf("Error reading cube file %s\n", cube_name);
+		close_binary_result(res);
+		return 2;
+	}
+	const double *cube_equity = cube_array(res, "equity", false);
+	const double *cube_investment = cube_array(res, "investment", false);
+	const uint8_t *cube_defaulting = cube_array(res, "defaulting", true);
+	const double *cube_equity_W = cube_array(res, "equity_W", false);
+	const double *cube_equity_L = cube_array(res, "equity_L", false);
+	if(cube_equity == NULL || cube_investment == NULL || cube_defaulting == NULL || cube_equity_W == NULL || cube_equity_L == NULL) {
+		close_binary_result(res);
+		return 2;
+	}
+
+	// The cash positions to choose from and what they cost the shareholders
+	int first_W = 0;
+	while(first_W < W_grid_size && W_axis[first_W] < cube_W_lower)
+		++first_W;
+	int last_W = W_grid_size - 1;
+	while(last_W >= first_W && W_axis[last_W] > cube_W_upper)
+		--last_W;
+	if(first_W > last_W) {
+		printf("No point of the W grid lies in the range given by --W-lower and --W-upper\n");
+		close_binary_result(res);
+		return 1;
+	}
+	double *cost = malloc(W_grid_size * sizeof(double));
+	for(int i = first_W; i <= last_W; ++i)
+		cost[i] = (1 + equity_cost) * fmax(W_axis[i], 0) + cube_cash_penalty * fabs(W_axis[i]);
+
+	P_grid = (double*) P_axis;
+	L_grid = (double*) L_axis;
+	optimal_equity = create_rows(P_grid_size, L_grid_size);
+	optimal_cash = create_rows(P_grid_size, L_grid_size);
+	optimal_investment = create_rows(P_grid_size, L_grid_size);
+	optimal_defaulting = create_rows(P_grid_size, L_grid_size);
+	optimal_equity_W = create_rows(P_grid_size, L_grid_size);
+	optimal_equity_L = create_rows(P_grid_size, L_grid_size);
+
+	// The W grid is walked row by row for all L at once, which reads the slice of every P through in order, see
+	// find_optimal_equity_in_col() in mca.c for the choice for a single L
+	int missing = 0;
+	#pragma omp parallel for schedule(dynamic) reduction(+:missing)
+	for(int p = 0; p < P_grid_size; ++p) {
+		if(!binary_flag(solved, p)) {
+			for(int j = 0; j < L_grid_size; ++j) {
+				optimal_equity[p][j] = optimal_cash[p][j] = optimal_investment[p][j] = NAN;
+				optimal_defaulting[p][j] = optimal_equity_W[p][j] = optimal_equity_L[p][j] = NAN;
+			}
+			++missing;
+			continue;
+		}
+		size_t slice = (size_t) p * W_grid_size * L_grid_size;
+		double *best = malloc(L_grid_size * sizeof(double));
+		int *best_i = malloc(L_grid_size * sizeof(int));
+		const double *row = cube_equity + slice + (size_t) first_W * L_grid_size;
+		for(int j = 0; j < L_grid_size; ++j) {
+			best[j] = row[j] - cost[first_W];
+			best_i[j] = first_W;
+		}
+		for(int i = first_W + 1; i <= last_W; ++i) {
+			row = cube_equity + slice + (size_t) i * L_grid_size;
+			for(int j = 0; j < L_grid_size; ++j) {
+				double value = row[j] - cost[i];
+				if(value > best[j]) {
+					best[j] = value;
+					best_i[j] = i;
+				}
+			}
+		}
+		for(int j = 0; j < L_grid_size; ++j) {
+			size_t k = slice + (size_t) best_i[j] * L_grid_size + j;
+			if(!binary_flag(cube_defaulting, k)) {
+				optimal_equity[p][j] = cube_equity[k];
+				optimal_cash[p][j] = W_axis[best_i[j]];
+				optimal_investment[p][j] = cube_investment[k];
+				optimal_defaulting[p][j] = 0;
+			} else {
+				optimal_equity[p][j] = 0;
+				optimal_cash[p][j] = 0;
+				optimal_investment[p][j] = 0;
+				optimal_defaulting[p][j] = 1;
+			}
+			optimal_equity_W[p][j] = cube_equity_W[k];
+			optimal_equity_L[p][j] = cube_equity_L[k];
+		}
+		free(best);
+		free(best_i);
+	}
+	free(cost);
+	if(missing > 0)
+		printf("%i out of %i values of P are missing from the cube, their results are NaN.\n", missing, P_grid_size);
+
+	#ifdef TIMING
+	time(&end);
+	printf("Time: %.2lf seconds to run.\n", difftime(end, start));
+	#endif
+
+	int status = 0;
+	if(binary_file != NULL) {
+		status = write_find_EP_result(binary_file) ? 3 : 0;
+	} else {
+		write_array_async(argv[2], optimal_equity, P_grid_size, L_grid_size);
+		write_array_async(argv[3], optimal_cash, P_grid_size, L_grid_size);
+		write_array_async(argv[4], optimal_investment, P_grid_size, L_grid_size);
+		write_array_async(argv[5], optimal_defaulting, P_grid_size, L_grid_size);
+		write_array_async(argv[6], optimal_equity_W, P_grid_size, L_grid_size);
+		write_array_async(argv[7], optimal_equity_L, P_grid_size, L_grid_size);
+		status = flush_output() ? 3 : 0;
+	}
+
+	destroy_rows(optimal_equity, P_grid_size);
+	destroy_rows(optimal_cash, P_grid_size);
+	destroy_rows(optimal_investment, P_grid_size);
+	destroy_rows(optimal_defaulting, P_grid_size);
+	destroy_rows(optimal_equity_W, P_grid_size);
+	destroy_rows(optimal_equity_L, P_grid_size);
+	close_binary_result(res);
+	return status;
+}
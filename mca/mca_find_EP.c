@@ -1,7 +1,8 @@
 // Valerio Morelli, August 2016
 
 // Usage:
-// mca_find_EP.exe params.csv optimal_E.csv optimal_W.csv optimal_I.csv optimal_D.csv optimal_equity_W.csv optimal_equity_L.csv
+// mca_find_EP.exe params.csv optimal_E.csv optimal_W.csv optimal_I.csv optimal_D.csv optimal_equity_W.csv optimal_equity_L.csv [options]
+// mca_find_EP.exe params.csv --binary=result.mcab [options]
 //
 // params.csv				-- Parameters to use
 // optimal_E.csv			-- Output files for equity, cash, investment, defaulting flag, derivative of equity with respect to W and L
@@ -10,7 +11,14 @@
 // optimal_D.csv
 // optimal_equity_W.csv
 // optimal_equity_L.csv
-
+// result.mcab				-- Binary result file with all outputs, the grid axes and the parameters (see mca_binary.h), instead of the CSV files
+//
+// With --cube=file, the complete results at t = 0 for every P are written to file as well, see CUBE FILES in mca_binary.h. mca_cube chooses the
+// cash position from them with other objectives, without solving the model again.
+//
+// Options (see read_options() in mca_io.c):
+// --binary=file --checkpoint=file --checkpoint-interval=n --resume --trajectory=file --trajectory-every=n --trajectory-tol=x
+// --cube=file --cache=directory --cache-size=n --no-cache
 
 // Any debug flags have to be specfied in mca.c.
 
@@ -26,61 +34,75 @@
 
 #include "mca_io.h"
 #include "mca.h"
+#include "mca_checkpoint.h"
+#include "mca_binary.h"
+#include "mca_cache.h"
 
 int main(int argc, char* argv[]) {
-	if(argc < 8) {
-		printf("Not enough arguments, expected seven.\n");
+	argc = read_options(argc, argv);
+	if(argc < 0) {
+		return 1;
+	}
+	if(check_output_arguments(argc, 2, 6)) {
+		return 1;
+	}
+	if(sensitivity_count > 0) {
+		printf("mca_find_EP does not support --sensitivity\n");
 		return 1;
 	}
 	char *para_file = argv[1];
-	char *optimal_equity_file = argv[2];
-	char *optimal_cash_file = argv[3];
-	char *optimal_investment_file = argv[4];
-	char *optimal_defaulting_file = argv[5];
-	char *optimal_equity_W_file = argv[6];
-	char *optimal_equity_L_file = argv[7];	
 	if(read_args_find_EP(para_file)) {
 		return 2;
 	}
+	init_checkpoint();
 
 	#ifdef TIMING
 	time_t start, end;
 	time(&start);
 	#endif
 
-	mca_find_EP();
+	if(!cache_lookup(true)) {
+		if(mca_find_EP()) {
+			clean_up_find_EP();
+			return 4;
+		}
+		wait_for_checkpoint();
+		cache_store(true);
+		print_iteration_counts();
+	}
 
 	#ifdef TIMING
 	time(&end);
 	printf("Time: %.2lf seconds to run.\n", difftime(end, start));
 	#endif
 
-	if(write_array(optimal_equity_file, optimal_equity, P_grid_size, L_grid_size)) {
+	if(binary_file != NULL) {
+		if(write_find_EP_result(binary_file)) {
+			clean_up_find_EP();
+			return 3;
+		}
 		clean_up_find_EP();
-		return 3;
-	}
-	if(write_array(optimal_cash_file, optimal_cash, P_grid_size, L_grid_size)) {
-		clean_up_find_EP();
-		return 3;
-	}
-	if(write_array(optimal_investment_file, optimal_investment, P_grid_size, L_grid_size)) {
-		clean_up_find_EP();
-		return 3;
-	}
-	if(write_array(optimal_defaulting_file, optimal_defaulting, P_grid_size, L_grid_size)) {
-		clean_up_find_EP();
-		return 3;
-	}
-	if(write_array(optimal_equity_W_file, optimal_equity_W, P_grid_size, L_grid_size)) {
-		clean_up_find_EP();
-		return 3;
-	}
-	if(write_array(optimal_equity_L_file, optimal_equity_L, P_grid_size, L_grid_size)) {
-		clean_up_find_EP();
-		return 3;
+		return 0;
 	}
 
+	char *optimal_equity_file = argv[2];
+	char *optimal_cash_file = argv[3];
+	char *optimal_investment_file = argv[4];
+	char *optimal_defaulting_file = argv[5];
+	char *optimal_equity_W_file = argv[6];
+	char *optimal_equity_L_file = argv[7];
+	write_array_async(optimal_equity_file, optimal_equity, P_grid_size, L_grid_size);
+	write_array_async(optimal_cash_file, optimal_cash, P_grid_size, L_grid_size);
+	write_array_async(optimal_investment_file, optimal_investment, P_grid_size, L_grid_size);
+	write_array_async(optimal_defaulting_file, optimal_defaulting, P_grid_size, L_grid_size);
+	write_array_async(optimal_equity_W_file, optimal_equity_W, P_grid_size, L_grid_size);
+	write_array_async(optimal_equity_L_file, optimal_equity_L, P_grid_size, L_grid_size);
+
+	// The arrays have been copied, so we can free them while the files are being written
 	clean_up_find_EP();
+	if(flush_output()) {
+		return 3;
+	}
 	
 	return 0;
 }
@@ -1,18 +1,32 @@
 // Valerio Morelli, August 2016
 
-// This file defines three functions:
+// This file defines the following functions:
 // int read_args(char *filename);									-- parse parameters from file
+// int read_args_find_EP(char *filename);							-- parse parameters for mca_find_EP from file
+// int read_sweep(char *filename, struct sweep *sweep);			-- parse parameters with sweep specifications from file
+// void set_sweep_point(const struct sweep *sweep, long point);	-- set the parameters to a point of the sweep
 // int write_array(char *filename, double **a, int x, int y);		-- write double array with dimensions x and y to file
-// int write_bool_array(char *filename, bool **a, int x, int y);	-- write bool array with deimsnions x and y to file
+// int format_double(char *dst, double x);							-- shortest representation of x that reads back exactly
+// int write_bool_array(char *filename, uint64_t **a, int x, int y);	-- write bit-packed flags with deimsnions x and y to file
+// int read_options(int argc, char *argv[]);						-- parse and remove the optional --name=value arguments of the executables
+// uint64_t hash_parameters();										-- hash of the values of all parameters
+// void write_array_async(char *filename, double **a, int x, int y);	-- copy a and write it to file in the background
+// void write_bool_array_async(char *filename, uint64_t **a, int x, int y);
+// int flush_output();												-- wait until all files queued for writing are written
 
-// NOTE: We want to use maximum precision for writing the floating point number array.
+// NOTE: We want every floating point number in the arrays we write to read back exactly, see format_double.
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #include "mca.h"
+#include "mca_io.h"
 
 // The following macros are defined in float.h
 // All three should be available with a C11 compiler, C99 provides only the third.
@@ -29,11 +43,290 @@ const int precision = DECIMAL_DIG;
 
 const int MAX_LINE_LENGTH = 256;																	// Maximal line length of parameter file
 
-// Do you we need to check for ferror as well?
+// Table of all parameters, used wherever we need to treat the parameter set as a whole
+const struct parameter parameters[] = {
+	{"r", false, &r},
+	{"lambda", false, &lambda},
+	{"sigma", false, &sigma},
+	{"delta", false, &delta},
+	{"psi", false, &psi},
+	{"taxe", false, &taxe},
+	{"taxi", false, &taxi},
+	{"taxc", false, &taxc},
+	{"P", false, &P},
+	{"P_min", false, &P_min},
+	{"P_max", false, &P_max},
+	{"P_grid_size", true, &P_grid_size},
+	{"theta", false, &theta},
+	{"W_min", false, &W_min},
+	{"W_max", false, &W_max},
+	{"W_grid_size", true, &W_grid_size},
+	{"L_min", false, &L_min},
+	{"L_max", false, &L_max},
+	{"L_grid_size", true, &L_grid_size},
+	{"T", false, &T},
+	{"T_grid_size", true, &T_grid_size},
+	{"iteration_max", true, &iteration_max},
+	{"iteration_tol", false, &iteration_tol},
+	{"trigger_equity_derivative_tol", false, &trigger_equity_derivative_tol},
+	{"equity_cost", false, &equity_cost},
+	{"premium", false, &premium},
+	{"spatial_order", true, &spatial_order},
+	{"boundary_condition", true, &boundary_condition},
+	{"W_cluster_width", false, &W_cluster_width},
+	{"W_cluster_center", false, &W_cluster_center},
+	{"L_cluster_width", false, &L_cluster_width},
+	{"L_cluster_center", false, &L_cluster_center},
+	{"investment_q_max", false, &investment_q_max},
+	{"investment_relaxation", false, &investment_relaxation},
+	{"convergence_norm", true, &convergence_norm},
+	{"max_change_tol", false, &max_change_tol},
+	{"rms_change_tol", false, &rms_change_tol},
+	{"relative_change_tol", false, &relative_change_tol},
+	{"predictor_order", true, &predictor_order},
+	{"policy_freeze_interval", true, &policy_freeze_interval},
+	{"policy_freeze_changes", true, &policy_freeze_changes},
+	{"time_scheme", true, &time_scheme}
+};
+const int parameters_count = sizeof(parameters) / sizeof(parameters[0]);
+
+const char *const sensitivity_names[] = {"r", "lambda", "sigma", "delta", "psi", "taxe", "taxi", "taxc", "P", "theta", "premium"};
+
+// FNV-1a hash over the names and the bit patterns of the values of all parameters.
+// mca_find_EP overwrites P while iterating over the P grid, so this has to be called right after reading the parameter file.
+uint64_t hash_parameters() {
+	uint64_t hash = 14695981039346656037ULL;
+	for(int k = 0; k < parameters_count; ++k) {
+		unsigned char bytes[sizeof(double)];
+		const char *name = parameters[k].name;
+		for(; *name; ++name) {
+			hash ^= (unsigned char) *name;
+			hash *= 1099511628211ULL;
+		}
+		if(parameters[k].is_int) {
+			int64_t value = *(int*) parameters[k].value;
+			memcpy(bytes, &value, sizeof(bytes));
+		} else {
+			memcpy(bytes, parameters[k].value, sizeof(bytes));
+		}
+		for(int b = 0; b < (int) sizeof(bytes); ++b) {
+			hash ^= bytes[b];
+			hash *= 1099511628211ULL;
+		}
+	}
+	return hash;
+}
+
+// Adds the comma-separated parameter names in list to sensitivity_parameter. Returns 0 if successful, 1 if a name is not one of
+// sensitivity_names or given twice.
+static int read_sensitivities(const char *list) {
+	while(true) {
+		size_t length = strcspn(list, ",");
+		int k = 0;
+		while(k < SENSITIVITY_PARAMETERS && (strlen(sensitivity_names[k]) != length || strncmp(list, sensitivity_names[k], length)))
+			++k;
+		if(k == SENSITIVITY_PARAMETERS) {
+			printf("Invalid sensitivity parameter %.*s, expected one of r, lambda, sigma, delta, psi, taxe, taxi, taxc, P, theta, premium\n",
+			       (int) length, list);
+			return 1;
+		}
+		for(int l = 0; l < sensitivity_count; ++l) {
+			if(sensitivity_parameter[l] == (enum sensitivity_parameter) k) {
+				printf("Sensitivity parameter %s given twice\n", sensitivity_names[k]);
+				return 1;
+			}
+		}
+		sensitivity_parameter[sensitivity_count++] = k;
+		if(list[length] == 0)
+			return 0;
+		list += length + 1;
+	}
+}
 
-// The read_args function sets the following parameters:
+// READ_OPTIONS PARSES THE OPTIONAL ARGUMENTS OF THE EXECUTABLES
+// Options have the form --name or --name=value and can appear anywhere on the command line. They are removed from argv, such that the executables
+// can treat the remaining arguments as before. Returns the new argc, or -1 if an option is not recognized.
+//
+// --checkpoint=file				-- periodically save the state of the solver to file
+// --checkpoint-interval=n			-- number of time steps between two checkpoints (default 1000)
+// --resume							-- continue from the checkpoint file instead of starting at the terminal time
+// --binary=file					-- write the results to the binary result file (see mca_binary.h) instead of CSV files
+// --trajectory=file				-- record snapshots of the state during the solve to file (see mca_trajectory.h)
+// --trajectory-every=n				-- number of time steps between two snapshots (default 100)
+// --trajectory-tol=x				-- store equity and investment rounded to multiples of x instead of raw doubles
+// --shard=k/n						-- mca_sweep only solves the points with index k modulo n, mca_richardson the grids
+// --order=p						-- order of convergence for the extrapolation of mca_richardson (default: estimated from the grids)
+// --sensitivity=name,...			-- mca_standalone also computes the derivatives of equity with respect to these parameters, any of
+//									   r, lambda, sigma, delta, psi, taxe, taxi, taxc, P, theta and premium
+// --cube=file						-- mca_find_EP also writes the complete results at t = 0 for every P to file (see mca_binary.h)
+// --equity-cost=x					-- mca_cube: cost per unit of equity raised (default equity_cost of the cube)
+// --cash-penalty=x					-- mca_cube: penalty per unit of |W| (default 0)
+// --W-lower=x						-- mca_cube: only choose W >= x (default no bound)
+// --W-upper=x						-- mca_cube: only choose W <= x (default no bound)
+// --seed=n							-- mca_simulate: key of the random number streams (default 0)
+// --bins=n							-- mca_simulate: number of bins of the histograms (default 100)
+// --steps=n						-- mca_simulate: time steps of the paths (default T_grid_size - 1)
+// --cache=directory				-- use the result cache in directory (default MCA_CACHE_DIR from the environment, or no cache)
+// --cache-size=n					-- maximal size of the result cache in MB (default 1024)
+// --no-cache						-- neither look up nor store the result in the cache, even if --cache or MCA_CACHE_DIR is given
+int read_options(int argc, char *argv[]) {
+	int kept = 1;
+	checkpoint_interval = 1000;
+	trajectory_interval = 100;
+	cache_directory = getenv("MCA_CACHE_DIR") != NULL && getenv("MCA_CACHE_DIR")[0] != '\0' ? getenv("MCA_CACHE_DIR") : NULL;
+	cache_size_limit = 1024LL << 20;
+	bool no_cache = false;
+	shard_index = 0;
+	shard_count = 1;
+	richardson_order = 0;
+	cube_equity_cost = NAN;
+	cube_cash_penalty = 0;
+	cube_W_lower = -INFINITY;
+	cube_W_upper = INFINITY;
+	simulation_seed = 0;
+	simulation_bins = 100;
+	simulation_steps = 0;
+	for(int k = 1; k < argc; ++k) {
+		char *arg = argv[k];
+		if(strncmp(arg, "--", 2)) {
+			argv[kept++] = arg;
+			continue;
+		}
+		if(!strncmp(arg, "--checkpoint=", 13)) {
+			checkpoint_file = arg + 13;
+		} else if(!strncmp(arg, "--checkpoint-interval=", 22)) {
+			checkpoint_interval = atoi(arg + 22);
+			if(checkpoint_interval < 1) {
+				printf("Invalid checkpoint interval %s, must be at least 1\n", arg + 22);
+				return -1;
+			}
+		} else if(!strcmp(arg, "--resume")) {
+			resume = true;
+		} else if(!strncmp(arg, "--binary=", 9)) {
+			binary_file = arg + 9;
+		} else if(!strncmp(arg, "--trajectory=", 13)) {
+			trajectory_file = arg + 13;
+		} else if(!strncmp(arg, "--trajectory-every=", 19)) {
+			trajectory_interval = atoi(arg + 19);
+			if(trajectory_interval < 1) {
+				printf("Invalid trajectory interval %s, must be at least 1\n", arg + 19);
+				return -1;
+			}
+		} else if(!strncmp(arg, "--cache=", 8)) {
+			cache_directory = arg + 8;
+		} else if(!strncmp(arg, "--cache-size=", 13)) {
+			double megabytes = atof(arg + 13);
+			if(!(megabytes > 0)) {
+				printf("Invalid cache size %s, must be positive\n", arg + 13);
+				return -1;
+			}
+			cache_size_limit = (long long) (megabytes * (1 << 20));
+		} else if(!strcmp(arg, "--no-cache")) {
+			no_cache = true;
+		} else if(!strncmp(arg, "--shard=", 8)) {
+			if(sscanf(arg + 8, "%i/%i", &shard_index, &shard_count) != 2 || shard_count < 1 || shard_index < 0 || shard_index >= shard_count) {
+				printf("Invalid shard %s, expected k/n with 0 <= k < n\n", arg + 8);
+				return -1;
+			}
+		} else if(!strncmp(arg, "--order=", 8)) {
+			richardson_order = atof(arg + 8);
+			if(!(richardson_order > 0)) {
+				printf("Invalid order %s, must be positive\n", arg + 8);
+				return -1;
+			}
+		} else if(!strncmp(arg, "--sensitivity=", 14)) {
+			if(read_sensitivities(arg + 14))
+				return -1;
+		} else if(!strncmp(arg, "--cube=", 7)) {
+			cube_file = arg + 7;
+		} else if(!strncmp(arg, "--equity-cost=", 14)) {
+			cube_equity_cost = atof(arg + 14);
+			if(!(cube_equity_cost >= 0)) {
+				printf("Invalid equity cost %s, must not be negative\n", arg + 14);
+				return -1;
+			}
+		} else if(!strncmp(arg, "--cash-penalty=", 15)) {
+			cube_cash_penalty = atof(arg + 15);
+			if(!(cube_cash_penalty >= 0)) {
+				printf("Invalid cash penalty %s, must not be negative\n", arg + 15);
+				return -1;
+			}
+		} else if(!strncmp(arg, "--W-lower=", 10)) {
+			cube_W_lower = atof(arg + 10);
+		} else if(!strncmp(arg, "--W-upper=", 10)) {
+			cube_W_upper = atof(arg + 10);
+		} else if(!strncmp(arg, "--seed=", 7)) {
+			char *end;
+			simulation_seed = strtoull(arg + 7, &end, 10);
+			if(end == arg + 7 || *end != 0) {
+				printf("Invalid seed %s, expected a non-negative integer\n", arg + 7);
+				return -1;
+			}
+		} else if(!strncmp(arg, "--bins=", 7)) {
+			simulation_bins = atoi(arg + 7);
+			if(simulation_bins < 1) {
+				printf("Invalid number of bins %s, must be at least 1\n", arg + 7);
+				return -1;
+			}
+		} else if(!strncmp(arg, "--steps=", 8)) {
+			simulation_steps = atoi(arg + 8);
+			if(simulation_steps < 1) {
+				printf("Invalid number of time steps %s, must be at least 1\n", arg + 8);
+				return -1;
+			}
+		} else if(!strncmp(arg, "--trajectory-tol=", 17)) {
+			trajectory_tolerance = atof(arg + 17);
+			if(!(trajectory_tolerance >= 0)) {
+				printf("Invalid trajectory tolerance %s, must not be negative\n", arg + 17);
+				return -1;
+			}
+		} else {
+			printf("Unknown option %s\n", arg);
+			return -1;
+		}
+	}
+	if(no_cache) {
+		cache_directory = NULL;
+	}
+	if(!(cube_W_lower <= cube_W_upper)) {
+		printf("Invalid range of W, --W-lower has to be at most --W-upper\n");
+		return -1;
+	}
+	if(resume && checkpoint_file == NULL) {
+		printf("Option --resume requires --checkpoint=file\n");
+		return -1;
+	}
+	argv[kept] = NULL;
+	return kept;
+}
+
+// Check the number of positional arguments (after read_options()) of an executable that writes CSV files, or a binary result file with
+// --binary=file. inputs is the number of arguments before the CSV files, the name of the executable included, outputs the number of CSV
+// files. With --binary, CSV files are not written, so naming them is an error rather than silently ignored. Returns 0 if the arguments are
+// fine, 1 otherwise.
+int check_output_arguments(int argc, int inputs, int outputs) {
+	int expected = binary_file != NULL ? inputs : inputs + outputs;
+	if(argc < expected) {
+		printf("Not enough arguments, expected %i.\n", expected - 1);
+		return 1;
+	}
+	if(binary_file != NULL && argc > expected) {
+		printf("Too many arguments, with --binary the results are only written to %s.\n", binary_file);
+		return 1;
+	}
+	return 0;
+}
+
+// Do you we need to check for ferror as well?
 
-// Example paramter file for mca_standalone
+// PARAMETER FILES
+// A parameter file is a csv file with one parameter per line, the name in the first and the value in the second column, in any order:
+//					r,0.01
+//					lambda,0.01
+// Additional columns are ignored and can be used for comments. Empty lines and lines starting with # are skipped as well.
+// Every parameter may only be given once and has to be one of the parameters in the table above.
+//
+// Example parameter file for mca_standalone
 //r,0.05
 //lambda,0.01
 //sigma,0.119
@@ -55,419 +348,209 @@ const int MAX_LINE_LENGTH = 256;																	// Maximal line length of param
 //iteration_max,100
 //iteration_tol,0.1
 //trigger_equity_derivative_tol,0.01
-
-// READ_ARGS ASSIGNS VALUES READ FROM FILE TO THE ABOVE PARAMETERS
-// Expected layout: csv file like this
-//					r,0.01
-//					lambda,0.01
-// The parameters must follow exactly this format exactly in the correct order as given above, with the only flexibility that additonal columns will be ignored.
-// (These additional columns can be used for comments.)
+//premium,0.01
 //
-// Returns 0 if successful, 1 for any error reading the file, 2 for any error closing the file
-int read_args(char *filename) {
-	FILE *fp;
-	fp = fopen(filename, "r");
-	char buf[MAX_LINE_LENGTH];
-	if(fp != NULL) {
-		char *para;
-		char *value;
-		int linenum = 1;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "r")) {
-			printf("Expected reading r, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		r = atof(value);
-		++linenum;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "lambda")) {
-			printf("Expected reading lambda, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		lambda = atof(value);
-		++linenum;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "sigma")) {
-			printf("Expected reading sigma, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		sigma = atof(value);
-		++linenum;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "delta")) {
-			printf("Expected reading delta, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		delta = atof(value);
-		++linenum;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "psi")) {
-			printf("Expected reading psi, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		psi = atof(value);
-		++linenum;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "taxe")) {
-			printf("Expected reading taxe, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		taxe = atof(value);
-		++linenum;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "taxi")) {
-			printf("Expected reading taxi, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		taxi = atof(value);
-		++linenum;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "taxc")) {
-			printf("Expected reading taxc, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		taxc = atof(value);
-		++linenum;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "P")) {
-			printf("Expected reading P, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		P = atof(value);
-		++linenum;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "theta")) {
-			printf("Expected reading theta, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		theta = atof(value);
-		++linenum;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "W_min")) {
-			printf("Expected reading W_min, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		W_min = atof(value);
-		++linenum;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "W_max")) {
-			printf("Expected reading W_max, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		W_max = atof(value);
-		++linenum;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "W_grid_size")) {
-			printf("Expected reading W_grid_size, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		W_grid_size = atoi(value);
-		++linenum;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "L_min")) {
-			printf("Expected reading L_min, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		L_min = atof(value);
-		++linenum;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "L_max")) {
-			printf("Expected reading L_max, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		L_max = atof(value);
-		++linenum;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "L_grid_size")) {
-			printf("Expected reading L_grid_size, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		L_grid_size = atoi(value);
-		++linenum;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "T")) {
-			printf("Expected reading T, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		T = atof(value);
-		++linenum;
+// A parameter file for mca_find_EP gives P_min, P_max, P_grid_size and equity_cost instead of P.
+//
+// The optional parameters select variants of the numerical method and default to the original method when omitted:
+//					spatial_order,2			-- second-order drift terms (see update_new_equity() in mca.c), default 1. Use it with
+//											   investment_q_max, otherwise the time steps may not converge near W_max.
+//					boundary_condition,1	-- far-field boundary condition at W_max and L_max (see update_new_equity() in mca.c), default 0
+//					W_cluster_width,10		-- non-uniform W grid with the points concentrated around W_cluster_center (default 0), see
+//											   fill_grid() in mca.c, default 0 for a uniform grid. Likewise L_cluster_width and L_cluster_center.
+//					investment_q_max,3		-- bound on the ratio of the derivatives of equity in the investment update (see stabilized_investment()
+//											   in mca.c), default 0 for no bound
+//					investment_relaxation,0.5	-- move investment only half way to the new value in every iteration, default 1
+//					convergence_norm,2		-- end a time step once the root mean square change of equity is below rms_change_tol, see
+//											   convergence_measure() in mca.c. Default 0 for the sum of the squared changes below iteration_tol,
+//											   1 for the largest change below max_change_tol, 3 for the root mean square change relative to
+//											   that of equity below relative_change_tol.
+//					max_change_tol,0.02		-- tolerances for convergence_norm 1 to 3, default 0.02, 0.004 and 3e-5, for the change divided by
+//											   one minus its rate of decrease (see iteration_error() in mca.c)
+//					rms_change_tol,0.004
+//					relative_change_tol,3e-5
+//					predictor_order,1		-- start the iterations of a time step from the linear (1) or quadratic (2) extrapolation of the
+//											   preceding time steps (see predict() in mca.c), default 0
+//					policy_freeze_interval,20	-- once defaulting and the signs of investment stop changing, do up to 20 time steps with the
+//											   transition probabilities of the last full time step (see POLICY FREEZE in mca.c), default 0
+//					policy_freeze_changes,20	-- freeze the policy even if it changed at up to 20 points since the last full time step, default 0
+//					time_scheme,1			-- solve every iteration of a time step in implicit half-steps along W and along L (see
+//											   ALTERNATING DIRECTION IMPLICIT ITERATIONS in mca.c), default 0
+//
+// For mca_sweep, the value of any parameter can also be a sweep specification:
+//					sigma,0.1:0.4:4			-- 4 evenly spaced values from 0.1 to 0.4
+//					psi,1;1.5;3				-- the values 1, 1.5 and 3
+// The sweep runs over the cartesian product of all sweep specifications.
+
+// Parameters every parameter file has to give
+static const char *const common_parameters[] = {"r", "lambda", "sigma", "delta", "psi", "taxe", "taxi", "taxc", "theta", "W_min", "W_max",
+	"W_grid_size", "L_min", "L_max", "L_grid_size", "T", "T_grid_size", "iteration_max", "iteration_tol", "trigger_equity_derivative_tol", "premium"};
+// Additional parameters for mca_standalone and mca_find_EP
+static const char *const standalone_parameters[] = {"P"};
+static const char *const find_EP_parameters[] = {"P_min", "P_max", "P_grid_size", "equity_cost"};
+
+// Parameters that may be omitted, with their default value and the range of admissible values
+struct optional_parameter {
+	const char *name;
+	double value;
+	double min;
+	double max;
+};
+static const struct optional_parameter optional_parameters[] = {
+	{"spatial_order", 1, 1, 2},
+	{"boundary_condition", 0, 0, 1},
+	{"W_cluster_width", 0, 0, DBL_MAX},
+	{"W_cluster_center", 0, -DBL_MAX, DBL_MAX},
+	{"L_cluster_width", 0, 0, DBL_MAX},
+	{"L_cluster_center", 0, -DBL_MAX, DBL_MAX},
+	{"investment_q_max", 0, 0, DBL_MAX},
+	{"investment_relaxation", 1, 0.01, 1},
+	{"convergence_norm", 0, 0, 3},
+	{"max_change_tol", 0.02, 0, DBL_MAX},
+	{"rms_change_tol", 0.004, 0, DBL_MAX},
+	{"relative_change_tol", 3e-5, 0, DBL_MAX},
+	{"predictor_order", 0, 0, 2},
+	{"policy_freeze_interval", 0, 0, INT_MAX},
+	{"policy_freeze_changes", 0, 0, INT_MAX},
+	{"time_scheme", 0, 0, 1}
+};
+
+#define COUNT(a) ((int) (sizeof(a) / sizeof(a[0])))
+
+// Returns the index into parameters of the parameter called name, or parameters_count if there is no such parameter
+static int find_parameter(const char *name) {
+	int k;
+	for(k = 0; k < parameters_count && strcmp(name, parameters[k].name); ++k);
+	return k;
+}
 
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "T_grid_size")) {
-			printf("Expected reading T_grid_size, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		T_grid_size = atoi(value);
-		++linenum;
+// Parse a number, which may only be followed by white space. Returns 0 if successful, 1 otherwise.
+static int parse_number(const char *text, double *value) {
+	char *end;
+	*value = strtod(text, &end);
+	if(end == text)
+		return 1;
+	while(*end == ' ' || *end == '\t' || *end == '\r' || *end == '\n')
+		++end;
+	return *end != '\0';
+}
 
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "iteration_max")) {
-			printf("Expected reading iteration_max, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		iteration_max = atoi(value);
-		++linenum;
+// Parse the value of a parameter, either a number or, if sweep specifications are allowed, a range start:stop:count or a list a;b;c.
+// The values are stored in a newly allocated array. Returns the number of values, or 0 if the value is malformatted.
+static int parse_values(char *text, bool allow_sweep, double **values) {
+	int count = 1;
+	if(allow_sweep && strchr(text, ':') != NULL) {
+		double start, stop, n;
+		char *second = strchr(text, ':');
+		char *third = strchr(second + 1, ':');
+		if(third == NULL)
+			return 0;
+		*second = *third = '\0';
+		if(parse_number(text, &start) || parse_number(second + 1, &stop) || parse_number(third + 1, &n) || n < 1 || n != floor(n) ||
+		   n > INT_MAX / sizeof(double))
+			return 0;
+		count = (int) n;
+		*values = malloc(count * sizeof(double));
+		for(int k = 0; k < count; ++k)
+			(*values)[k] = count == 1 ? start : start + k * (stop - start) / (count - 1);
+		return count;
+	}
+	if(allow_sweep) {
+		for(char *c = text; *c; ++c)
+			count += *c == ';';
+	}
+	*values = malloc(count * sizeof(double));
+	for(int k = 0; k < count; ++k) {
+		char *next = strchr(text, ';');
+		if(next != NULL && allow_sweep)
+			*next = '\0';
+		if(parse_number(text, &(*values)[k])) {
+			free(*values);
+			return 0;
+		}
+		if(next != NULL)
+			text = next + 1;
+	}
+	return count;
+}
 
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "iteration_tol")) {
-			printf("Expected reading iteration_tol, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		iteration_tol = atof(value);
-		++linenum;
+// Assign value to parameter k of the table
+static void set_parameter(int k, double value) {
+	if(parameters[k].is_int)
+		*(int*) parameters[k].value = (int) value;
+	else
+		*(double*) parameters[k].value = value;
+}
 
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "trigger_equity_derivative_tol")) {
-			printf("Expected reading trigger_equity_derivative_tol, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		trigger_equity_derivative_tol = atof(value);
-		++linenum;
+// Returns the entry of parameter k in optional_parameters, or NULL if the parameter is not optional
+static const struct optional_parameter* find_optional(int k) {
+	for(int o = 0; o < COUNT(optional_parameters); ++o) {
+		if(!strcmp(optional_parameters[o].name, parameters[k].name))
+			return &optional_parameters[o];
+	}
+	return NULL;
+}
 
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "premium")) {
-			printf("Expected reading premium, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
+// Read a parameter file, assign the values to the parameters and mark the parameters read in given.
+// If sweep is not NULL, sweep specifications are allowed and added to sweep, the parameter is set to the first value of the sweep.
+// Returns 0 if successful, 1 for any error reading the file, 2 for any error closing the file
+static int read_parameter_file(char *filename, bool *given, struct sweep *sweep) {
+	FILE *fp;
+	fp = fopen(filename, "r");
+	char buf[MAX_LINE_LENGTH];
+	if(fp != NULL) {
+		for(int k = 0; k < parameters_count; ++k)
+			given[k] = false;
+		for(int o = 0; o < COUNT(optional_parameters); ++o)
+			set_parameter(find_parameter(optional_parameters[o].name), optional_parameters[o].value);
+		for(int linenum = 1; fgets(buf, sizeof(buf), fp) != NULL; ++linenum) {
+			if(buf[0] == '#' || strspn(buf, " \t\r\n") == strlen(buf))
+				continue;
+			char *para = strtok(buf, ",");
+			char *value = strtok(NULL, ",");
+			if(para == NULL) {
+				printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
+				goto close_after_error;
+			}
+			int k = find_parameter(para);
+			if(k == parameters_count) {
+				printf("Unknown parameter %s on line %i in %s\n", para, linenum, filename);
+				goto close_after_error;
+			}
+			if(given[k]) {
+				printf("Parameter %s given twice, again on line %i in %s\n", para, linenum, filename);
+				goto close_after_error;
+			}
+			double *values;
+			int count = value == NULL ? 0 : parse_values(value, sweep != NULL, &values);
+			if(count == 0) {
+				printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
+				goto close_after_error;
+			}
+			const struct optional_parameter *optional = find_optional(k);
+			for(int v = 0; v < count; ++v) {
+				if(parameters[k].is_int && values[v] != floor(values[v])) {
+					printf("Parameter %s on line %i in %s has to be an integer\n", para, linenum, filename);
+					free(values);
+					goto close_after_error;
+				}
+				if(optional != NULL && (values[v] < optional->min || values[v] > optional->max)) {
+					printf("Parameter %s on line %i in %s has to be between %g and %g\n", para, linenum, filename, optional->min, optional->max);
+					free(values);
+					goto close_after_error;
+				}
+			}
+			given[k] = true;
+			set_parameter(k, values[0]);
+			if(sweep != NULL && count > 1) {
+				sweep->axes = realloc(sweep->axes, (sweep->axis_count + 1) * sizeof(struct sweep_axis));
+				struct sweep_axis axis = {k, count, values};
+				sweep->axes[sweep->axis_count++] = axis;
+				sweep->point_count *= count;
+			} else {
+				free(values);
+			}
 		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		premium = atof(value);
-
 		if(fclose(fp)) {
 			printf("I/O error when closing file %s\n", filename);
 			return 2;
@@ -483,520 +566,411 @@ int read_args(char *filename) {
 		return 1;
 }
 
-// Example parameter file for mca_find_EP
+// Returns true if all parameters in names were given, prints the first missing one otherwise
+static bool check_given(char *filename, const bool *given, const char *const *names, int count, bool print) {
+	for(int n = 0; n < count; ++n) {
+		int k = find_parameter(names[n]);
+		if(!given[k]) {
+			if(print)
+				printf("Missing parameter %s in %s\n", names[n], filename);
+			return false;
+		}
+	}
+	return true;
+}
 
-//r,0.05
-//lambda,0.01
-//sigma,0.119
-//delta,0.025
-//psi,1.5
-//taxe,0
-//taxi,0
-//taxc,0
-//P_min,0
-//P_max,50
-//theta,0.08
-//W_min,-25
-//W_max,75
-//W_grid_size,76
-//L_min,0
-//L_max,300
-//L_grid_size,201
-//T,40
-//T_grid_size,80001
-//iteration_max,100
-//iteration_tol,0.01
-//trigger_equity_derivative_tol,0.01
-//premium,0.01
+// Read parameters for mca_standalone and mca_part
+// Returns 0 if successful, 1 for any error reading the file or a missing parameter, 2 for any error closing the file
+int read_args(char *filename) {
+	bool given[parameters_count];
+	int status = read_parameter_file(filename, given, NULL);
+	if(status)
+		return status;
+	if(!check_given(filename, given, common_parameters, COUNT(common_parameters), true) ||
+	   !check_given(filename, given, standalone_parameters, COUNT(standalone_parameters), true))
+		return 1;
+	return 0;
+}
 
 // Read parameters for mca_findEP
+// Returns 0 if successful, 1 for any error reading the file or a missing parameter, 2 for any error closing the file
 int read_args_find_EP(char *filename) {
-	FILE *fp;
-	fp = fopen(filename, "r");
-	char buf[MAX_LINE_LENGTH];
-	if(fp != NULL) {
-		char *para;
-		char *value;
-		int linenum = 1;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "r")) {
-			printf("Expected reading r, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		r = atof(value);
-		++linenum;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "lambda")) {
-			printf("Expected reading lambda, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		lambda = atof(value);
-		++linenum;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "sigma")) {
-			printf("Expected reading sigma, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		sigma = atof(value);
-		++linenum;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "delta")) {
-			printf("Expected reading delta, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		delta = atof(value);
-		++linenum;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "psi")) {
-			printf("Expected reading psi, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		psi = atof(value);
-		++linenum;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "taxe")) {
-			printf("Expected reading taxe, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		taxe = atof(value);
-		++linenum;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "taxi")) {
-			printf("Expected reading taxi, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		taxi = atof(value);
-		++linenum;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "taxc")) {
-			printf("Expected reading taxc, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		taxc = atof(value);
-		++linenum;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "P_min")) {
-			printf("Expected reading P_min, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		P_min = atof(value);
-		++linenum;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "P_max")) {
-			printf("Expected reading P_max, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		P_max = atof(value);
-		++linenum;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "P_grid_size")) {
-			printf("Expected reading P_grid_size, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		P_grid_size = atoi(value);
-		++linenum;
-
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "theta")) {
-			printf("Expected reading theta, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		theta = atof(value);
-		++linenum;
-
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "W_min")) {
-			printf("Expected reading W_min, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		W_min = atof(value);
-		++linenum;
+	bool given[parameters_count];
+	int status = read_parameter_file(filename, given, NULL);
+	if(status)
+		return status;
+	if(!check_given(filename, given, common_parameters, COUNT(common_parameters), true) ||
+	   !check_given(filename, given, find_EP_parameters, COUNT(find_EP_parameters), true))
+		return 1;
+	return 0;
+}
 
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "W_max")) {
-			printf("Expected reading W_max, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		W_max = atof(value);
-		++linenum;
+// Read the parameter file with sweep specifications for mca_sweep. If the file gives the parameters of mca_find_EP, every point of the sweep is
+// solved like in mca_find_EP, otherwise like in mca_standalone. The parameters are set to the first point of the sweep.
+// Returns 0 if successful, 1 for any error reading the file or a missing parameter, 2 for any error closing the file
+int read_sweep(char *filename, struct sweep *sweep) {
+	bool given[parameters_count];
+	sweep->axis_count = 0;
+	sweep->axes = NULL;
+	sweep->point_count = 1;
+	int status = read_parameter_file(filename, given, sweep);
+	if(status)
+		return status;
+	if(!check_given(filename, given, common_parameters, COUNT(common_parameters), true))
+		return 1;
+	sweep->find_EP = check_given(filename, given, find_EP_parameters, COUNT(find_EP_parameters), false);
+	if(!sweep->find_EP && !check_given(filename, given, standalone_parameters, COUNT(standalone_parameters), true))
+		return 1;
+	return 0;
+}
 
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "W_grid_size")) {
-			printf("Expected reading W_grid_size, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		W_grid_size = atoi(value);
-		++linenum;
+// Set the parameters to the values of point number point of the sweep. The last sweep specification in the file varies fastest.
+void set_sweep_point(const struct sweep *sweep, long point) {
+	for(int a = sweep->axis_count - 1; a >= 0; --a) {
+		set_parameter(sweep->axes[a].parameter, sweep->axes[a].values[point % sweep->axes[a].count]);
+		point /= sweep->axes[a].count;
+	}
+}
 
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "L_min")) {
-			printf("Expected reading L_min, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		L_min = atof(value);
-		++linenum;
+void free_sweep(struct sweep *sweep) {
+	for(int a = 0; a < sweep->axis_count; ++a)
+		free(sweep->axes[a].values);
+	free(sweep->axes);
+}
 
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "L_max")) {
-			printf("Expected reading L_max, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		L_max = atof(value);
-		++linenum;
+// SHORTEST ROUND-TRIP FORMATTING OF DOUBLES
+// format_double writes the shortest decimal string that reads back as exactly the same double (Grisu3, see F. Loitsch, "Printing floating-point
+// numbers quickly and accurately with integers", PLDI 2010). In the rare cases where Grisu3 cannot guarantee the shortest result, we fall back to
+// trying snprintf with increasing precision. The result is written either in fixed or in exponential notation, whichever is shorter, e.g. 0.25,
+// 1e-07, -3.5e+20 or 125, which Matlab (csvread) and R (read.csv) read like the output of printf.
+
+// A floating point number f * 2^e with a 64 bit significand
+struct diy_fp {
+	uint64_t f;
+	int e;
+};
+
+// Normalized approximations f * 2^e of the powers 10^k for k = -348, -340, ..., 340
+static const struct {
+	uint64_t f;
+	int16_t e;
+	int16_t k;
+} cached_powers[] = {
+	{0xfa8fd5a0081c0288ull, -1220, -348},
+	{0xbaaee17fa23ebf76ull, -1193, -340},
+	{0x8b16fb203055ac76ull, -1166, -332},
+	{0xcf42894a5dce35eaull, -1140, -324},
+	{0x9a6bb0aa55653b2dull, -1113, -316},
+	{0xe61acf033d1a45dfull, -1087, -308},
+	{0xab70fe17c79ac6caull, -1060, -300},
+	{0xff77b1fcbebcdc4full, -1034, -292},
+	{0xbe5691ef416bd60cull, -1007, -284},
+	{0x8dd01fad907ffc3cull,  -980, -276},
+	{0xd3515c2831559a83ull,  -954, -268},
+	{0x9d71ac8fada6c9b5ull,  -927, -260},
+	{0xea9c227723ee8bcbull,  -901, -252},
+	{0xaecc49914078536dull,  -874, -244},
+	{0x823c12795db6ce57ull,  -847, -236},
+	{0xc21094364dfb5637ull,  -821, -228},
+	{0x9096ea6f3848984full,  -794, -220},
+	{0xd77485cb25823ac7ull,  -768, -212},
+	{0xa086cfcd97bf97f4ull,  -741, -204},
+	{0xef340a98172aace5ull,  -715, -196},
+	{0xb23867fb2a35b28eull,  -688, -188},
+	{0x84c8d4dfd2c63f3bull,  -661, -180},
+	{0xc5dd44271ad3cdbaull,  -635, -172},
+	{0x936b9fcebb25c996ull,  -608, -164},
+	{0xdbac6c247d62a584ull,  -582, -156},
+	{0xa3ab66580d5fdaf6ull,  -555, -148},
+	{0xf3e2f893dec3f126ull,  -529, -140},
+	{0xb5b5ada8aaff80b8ull,  -502, -132},
+	{0x87625f056c7c4a8bull,  -475, -124},
+	{0xc9bcff6034c13053ull,  -449, -116},
+	{0x964e858c91ba2655ull,  -422, -108},
+	{0xdff9772470297ebdull,  -396, -100},
+	{0xa6dfbd9fb8e5b88full,  -369,  -92},
+	{0xf8a95fcf88747d94ull,  -343,  -84},
+	{0xb94470938fa89bcfull,  -316,  -76},
+	{0x8a08f0f8bf0f156bull,  -289,  -68},
+	{0xcdb02555653131b6ull,  -263,  -60},
+	{0x993fe2c6d07b7facull,  -236,  -52},
+	{0xe45c10c42a2b3b06ull,  -210,  -44},
+	{0xaa242499697392d3ull,  -183,  -36},
+	{0xfd87b5f28300ca0eull,  -157,  -28},
+	{0xbce5086492111aebull,  -130,  -20},
+	{0x8cbccc096f5088ccull,  -103,  -12},
+	{0xd1b71758e219652cull,   -77,   -4},
+	{0x9c40000000000000ull,   -50,    4},
+	{0xe8d4a51000000000ull,   -24,   12},
+	{0xad78ebc5ac620000ull,     3,   20},
+	{0x813f3978f8940984ull,    30,   28},
+	{0xc097ce7bc90715b3ull,    56,   36},
+	{0x8f7e32ce7bea5c70ull,    83,   44},
+	{0xd5d238a4abe98068ull,   109,   52},
+	{0x9f4f2726179a2245ull,   136,   60},
+	{0xed63a231d4c4fb27ull,   162,   68},
+	{0xb0de65388cc8ada8ull,   189,   76},
+	{0x83c7088e1aab65dbull,   216,   84},
+	{0xc45d1df942711d9aull,   242,   92},
+	{0x924d692ca61be758ull,   269,  100},
+	{0xda01ee641a708deaull,   295,  108},
+	{0xa26da3999aef774aull,   322,  116},
+	{0xf209787bb47d6b85ull,   348,  124},
+	{0xb454e4a179dd1877ull,   375,  132},
+	{0x865b86925b9bc5c2ull,   402,  140},
+	{0xc83553c5c8965d3dull,   428,  148},
+	{0x952ab45cfa97a0b3ull,   455,  156},
+	{0xde469fbd99a05fe3ull,   481,  164},
+	{0xa59bc234db398c25ull,   508,  172},
+	{0xf6c69a72a3989f5cull,   534,  180},
+	{0xb7dcbf5354e9beceull,   561,  188},
+	{0x88fcf317f22241e2ull,   588,  196},
+	{0xcc20ce9bd35c78a5ull,   614,  204},
+	{0x98165af37b2153dfull,   641,  212},
+	{0xe2a0b5dc971f303aull,   667,  220},
+	{0xa8d9d1535ce3b396ull,   694,  228},
+	{0xfb9b7cd9a4a7443cull,   720,  236},
+	{0xbb764c4ca7a44410ull,   747,  244},
+	{0x8bab8eefb6409c1aull,   774,  252},
+	{0xd01fef10a657842cull,   800,  260},
+	{0x9b10a4e5e9913129ull,   827,  268},
+	{0xe7109bfba19c0c9dull,   853,  276},
+	{0xac2820d9623bf429ull,   880,  284},
+	{0x80444b5e7aa7cf85ull,   907,  292},
+	{0xbf21e44003acdd2dull,   933,  300},
+	{0x8e679c2f5e44ff8full,   960,  308},
+	{0xd433179d9c8cb841ull,   986,  316},
+	{0x9e19db92b4e31ba9ull,  1013,  324},
+	{0xeb96bf6ebadf77d9ull,  1039,  332},
+	{0xaf87023b9bf0ee6bull,  1066,  340},
+};
+
+static struct diy_fp diy_fp_multiply(struct diy_fp x, struct diy_fp y) {
+	const uint64_t mask = 0xffffffffu;
+	uint64_t a = x.f >> 32, b = x.f & mask, c = y.f >> 32, d = y.f & mask;
+	uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+	uint64_t tmp = (bd >> 32) + (ad & mask) + (bc & mask) + (1u << 31);					// Round the lower 64 bits
+	struct diy_fp result = {ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), x.e + y.e + 64};
+	return result;
+}
 
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "L_grid_size")) {
-			printf("Expected reading L_grid_size, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		L_grid_size = atoi(value);
-		++linenum;
+static struct diy_fp diy_fp_normalize(struct diy_fp x) {
+	while(!(x.f & 0x8000000000000000ull)) {
+		x.f <<= 1;
+		--x.e;
+	}
+	return x;
+}
 
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "T")) {
-			printf("Expected reading T, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		T = atof(value);
-		++linenum;
+// Move the last digit towards w as long as we stay in the safe interval, returns false if the result is not guaranteed to be correct
+static bool round_weed(char *buffer, int length, uint64_t distance_too_high_w, uint64_t unsafe_interval, uint64_t rest, uint64_t ten_kappa,
+                       uint64_t unit) {
+	uint64_t small_distance = distance_too_high_w - unit;
+	uint64_t big_distance = distance_too_high_w + unit;
+	while(rest < small_distance && unsafe_interval - rest >= ten_kappa &&
+	      (rest + ten_kappa < small_distance || small_distance - rest >= rest + ten_kappa - small_distance)) {
+		--buffer[length - 1];
+		rest += ten_kappa;
+	}
+	if(rest < big_distance && unsafe_interval - rest >= ten_kappa &&
+	   (rest + ten_kappa < big_distance || big_distance - rest > rest + ten_kappa - big_distance))
+		return false;
+	return 2 * unit <= rest && rest <= unsafe_interval - 4 * unit;
+}
 
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "T_grid_size")) {
-			printf("Expected reading T_grid_size, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		T_grid_size = atoi(value);
-		++linenum;
+// Generate the shortest digits of a number in the interval (low, high) closest to w, all scaled such that the exponent lies in [-60, -32]
+static bool digit_gen(struct diy_fp low, struct diy_fp w, struct diy_fp high, char *buffer, int *length, int *kappa) {
+	uint64_t unit = 1;
+	uint64_t too_low = low.f - unit;
+	uint64_t too_high = high.f + unit;
+	uint64_t unsafe_interval = too_high - too_low;
+	int shift = -w.e;
+	uint64_t one = (uint64_t) 1 << shift;
+	uint32_t integrals = (uint32_t) (too_high >> shift);
+	uint64_t fractionals = too_high & (one - 1);
+	uint32_t divisor = 1;
+	*kappa = 1;
+	while(divisor <= integrals / 10) {
+		divisor *= 10;
+		++*kappa;
+	}
+	if(integrals == 0)
+		*kappa = 0;
+	*length = 0;
+	while(*kappa > 0) {
+		buffer[(*length)++] = '0' + integrals / divisor;
+		integrals %= divisor;
+		--*kappa;
+		uint64_t rest = ((uint64_t) integrals << shift) + fractionals;
+		if(rest < unsafe_interval)
+			return round_weed(buffer, *length, too_high - w.f, unsafe_interval, rest, (uint64_t) divisor << shift, unit);
+		divisor /= 10;
+	}
+	for(;;) {
+		fractionals *= 10;
+		unit *= 10;
+		unsafe_interval *= 10;
+		buffer[(*length)++] = '0' + (int) (fractionals >> shift);
+		fractionals &= one - 1;
+		--*kappa;
+		if(fractionals < unsafe_interval)
+			return round_weed(buffer, *length, (too_high - w.f) * unit, unsafe_interval, fractionals, one, unit);
+	}
+}
 
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "iteration_max")) {
-			printf("Expected reading iteration_max, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		iteration_max = atoi(value);
-		++linenum;
+// Shortest digits of the positive, finite double v, such that v = digits * 10^exponent. Returns the number of digits.
+static int shortest_digits(double v, char *digits, int *exponent) {
+	uint64_t bits;
+	memcpy(&bits, &v, sizeof bits);
+	uint64_t fraction = bits & 0x000fffffffffffffull;
+	int biased_exponent = (int) (bits >> 52);
+	struct diy_fp w;
+	if(biased_exponent == 0) {
+		w.f = fraction;
+		w.e = -1074;
+	} else {
+		w.f = fraction | 0x0010000000000000ull;
+		w.e = biased_exponent - 1075;
+	}
 
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "iteration_tol")) {
-			printf("Expected reading iteration_tol, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		iteration_tol = atof(value);
-		++linenum;
+	// Boundaries of the interval of numbers that read back as v
+	struct diy_fp plus = {(w.f << 1) + 1, w.e - 1};
+	plus = diy_fp_normalize(plus);
+	struct diy_fp minus;
+	if(fraction == 0 && biased_exponent > 1) {
+		minus.f = (w.f << 2) - 1;
+		minus.e = w.e - 2;
+	} else {
+		minus.f = (w.f << 1) - 1;
+		minus.e = w.e - 1;
+	}
+	minus.f <<= minus.e - plus.e;
+	minus.e = plus.e;
+	w = diy_fp_normalize(w);
+
+	// Pick the cached power 10^-k that scales the exponent into [-60, -32]
+	int k = (int) ceil((-60 - (w.e + 64) + 64 - 1) * 0.30102999566398114);
+	int index = (348 + k - 1) / 8 + 1;
+	struct diy_fp c = {cached_powers[index].f, cached_powers[index].e};
+
+	int length, kappa;
+	if(digit_gen(diy_fp_multiply(minus, c), diy_fp_multiply(w, c), diy_fp_multiply(plus, c), digits, &length, &kappa)) {
+		*exponent = kappa - cached_powers[index].k;
+		return length;
+	}
 
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "trigger_equity_derivative_tol")) {
-			printf("Expected reading trigger_equity_derivative_tol, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
+	// Fall back to the shortest precision that reads back correctly
+	char buf[32];
+	for(int p = 0; p < precision; ++p) {
+		snprintf(buf, sizeof buf, "%.*e", p, v);
+		if(strtod(buf, NULL) == v || p == precision - 1) {
+			length = 0;
+			char *s = buf;
+			for(; *s != 'e'; ++s) {
+				if(*s != '.')
+					digits[length++] = *s;
+			}
+			while(length > 1 && digits[length - 1] == '0')
+				--length;
+			*exponent = atoi(s + 1) - (length - 1);
+			return length;
 		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		trigger_equity_derivative_tol = atof(value);
-		++linenum;
+	}
+	return 0;
+}
 
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "equity_cost")) {
-			printf("Expected reading equity_cost, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		equity_cost = atof(value);
-		++linenum;
+// Writes the shortest representation of x to dst, which must have room for FORMAT_DOUBLE_LENGTH characters. Returns the number of characters written.
+int format_double(char *dst, double x) {
+	char *start = dst;
+	if(signbit(x)) {
+		*dst++ = '-';
+		x = -x;
+	}
+	if(isnan(x)) {
+		memcpy(start, "NaN", 3);
+		return 3;
+	}
+	if(isinf(x)) {
+		memcpy(dst, "Inf", 3);
+		return dst - start + 3;
+	}
+	if(x == 0) {
+		*dst++ = '0';
+		return dst - start;
+	}
 
-		fgets(buf, sizeof(buf), fp);
-		para = strtok(buf, ",");
-		value = strtok(NULL, ",");
-		if(para == NULL) {
-			printf("Malformatted parameter name on line %i in %s\n", linenum, filename);
-			goto close_after_error;
-		}
-		if(strcmp(para, "premium")) {
-			printf("Expected reading premium, instead read %s\n on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}
-		if(value == NULL) {
-			printf("Malformatted parameter value for parameter %s on line %i in %s\n", para, linenum, filename);
-			goto close_after_error;
-		}		
-		premium = atof(value);
-		
-		if(fclose(fp)) {
-			printf("I/O error when closing file %s\n", filename);
-			return 2;
+	char digits[20];
+	int exponent;
+	int length = shortest_digits(x, digits, &exponent);
+
+	// The decimal point is after the first point digits, compare the lengths of fixed and exponential notation
+	int point = length + exponent;
+	int scientific = exponent + length - 1;
+	int fixed_length = point >= length ? point : (point > 0 ? length + 1 : 2 - point + length);
+	int exponent_length = abs(scientific) >= 100 ? 3 : 2;
+	int scientific_length = length + (length > 1) + 2 + exponent_length;
+	if(fixed_length <= scientific_length) {
+		if(point >= length) {
+			memcpy(dst, digits, length);
+			memset(dst + length, '0', point - length);
+			dst += point;
+		} else if(point > 0) {
+			memcpy(dst, digits, point);
+			dst[point] = '.';
+			memcpy(dst + point + 1, digits + point, length - point);
+			dst += length + 1;
+		} else {
+			*dst++ = '0';
+			*dst++ = '.';
+			memset(dst, '0', -point);
+			dst += -point;
+			memcpy(dst, digits, length);
+			dst += length;
 		}
-		return 0;
 	} else {
-		printf("Error, could not open file %s for reading.\n", filename);
-		return 1;
+		*dst++ = digits[0];
+		if(length > 1) {
+			*dst++ = '.';
+			memcpy(dst, digits + 1, length - 1);
+			dst += length - 1;
+		}
+		*dst++ = 'e';
+		*dst++ = scientific < 0 ? '-' : '+';
+		scientific = abs(scientific);
+		if(scientific >= 100) {
+			*dst++ = '0' + scientific / 100;
+			scientific %= 100;
+		}
+		*dst++ = '0' + scientific / 10;
+		*dst++ = '0' + scientific % 10;
 	}
-	close_after_error :
-		if(fclose(fp))
-			printf("I/O error when closing file %s\n", filename);
-		return 1;
+	return dst - start;
 }
 
-// writes floating point array a with dimensions x and y to filename, taking care to write with maximum precision.
+// writes floating point array a with dimensions x and y to filename, with the shortest representation that reads back exactly (see format_double).
+// Every row is formatted into a buffer and written with a single call.
 // Returns 0 if successful, 1 in case of write error, 2 in case of error closing the file.
 int write_array(char *filename, double **a, int x, int y) {
 	FILE *fp;
 	int i, j;
 	fp = fopen(filename, "w");
 	if(fp != NULL) {
+		char *row = malloc(y * (FORMAT_DOUBLE_LENGTH + 1) + 1);
 		for(i = 0; i < x; ++i) {
-			for(j = 0; j < y - 1; ++j) {
-				fprintf(fp, "%.*e,", precision, a[i][j]);
+			char *dst = row;
+			for(j = 0; j < y; ++j) {
+				dst += format_double(dst, a[i][j]);
+				*dst++ = ',';
+			}
+			dst[-1] = '\n';
+			if(fwrite(row, 1, dst - row, fp) != (size_t) (dst - row)) {
+				printf("Error writing file %s\n", filename);
+				free(row);
+				fclose(fp);
+				return 1;
 			}
-			fprintf(fp, "%.*e\n", precision, a[i][j]);
 		}
+		free(row);
 		if(fclose(fp)) {
 			printf("I/O error when closing file %s\n", filename);
 			return 2;
@@ -1008,19 +982,28 @@ int write_array(char *filename, double **a, int x, int y) {
 	}
 }
 
-// writes bool array a with dimensions x and y to filename
+// writes the bit-packed flags a with dimensions x and y (see get_flag() in mca.h) to filename
 // Returns 0 if successful, 1 in case of write error, 2 in case of error closing the file.
-int write_bool_array(char *filename, bool **a, int x, int y) {
+int write_bool_array(char *filename, uint64_t **a, int x, int y) {
 	FILE *fp;
 	int i, j;
 	fp = fopen(filename, "w");
 	if(fp != NULL) {
+		char *row = malloc(2 * y);
 		for(i = 0; i < x; ++i) {
-			for(j = 0; j < y - 1; ++j) {
-				fprintf(fp, "%i,", a[i][j]);
+			for(j = 0; j < y; ++j) {
+				row[2 * j] = get_flag(a, i, j) ? '1' : '0';
+				row[2 * j + 1] = ',';
+			}
+			row[2 * y - 1] = '\n';
+			if(fwrite(row, 1, 2 * y, fp) != (size_t) (2 * y)) {
+				printf("Error writing file %s\n", filename);
+				free(row);
+				fclose(fp);
+				return 1;
 			}
-			fprintf(fp, "%i\n", a[i][j]);
 		}
+		free(row);
 		if(fclose(fp)) {
 			printf("I/O error when closing file %s\n", filename);
 			return 2;
@@ -1031,3 +1014,128 @@ int write_bool_array(char *filename, bool **a, int x, int y) {
 		return 1;
 	}
 }
+
+// ASYNCHRONOUS OUTPUT
+// write_array_async and write_bool_array_async copy the array and queue it for a worker thread, which formats and writes the files one after
+// the other with write_array and write_bool_array. The caller may therefore free or overwrite the array right away. flush_output waits until
+// the queue is empty and reports whether any file could not be written.
+
+struct output_job {
+	char *filename;
+	double **values;																				// Exactly one of values and flags is set
+	uint64_t **flags;
+	int x;
+	int y;
+	struct output_job *next;
+};
+
+static struct output_job *output_first = NULL;
+static struct output_job *output_last = NULL;
+static bool output_writing = false;
+static int output_status = 0;
+static bool output_worker_running = false;
+static pthread_t output_worker;
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t output_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t output_done = PTHREAD_COND_INITIALIZER;
+
+static void* write_output(void *arg) {
+	(void) arg;
+	pthread_mutex_lock(&output_lock);
+	for(;;) {
+		while(output_first == NULL)
+			pthread_cond_wait(&output_queued, &output_lock);
+		struct output_job *job = output_first;
+		output_first = job->next;
+		if(output_first == NULL)
+			output_last = NULL;
+		output_writing = true;
+		pthread_mutex_unlock(&output_lock);
+
+		int status;
+		if(job->values != NULL)
+			status = write_array(job->filename, job->values, job->x, job->y);
+		else
+			status = write_bool_array(job->filename, job->flags, job->x, job->y);
+		free(job->filename);
+		free(job->values != NULL ? (void*) job->values[0] : (void*) job->flags[0]);
+		free(job->values != NULL ? (void*) job->values : (void*) job->flags);
+		free(job);
+
+		pthread_mutex_lock(&output_lock);
+		if(status)
+			output_status = 1;
+		output_writing = false;
+		if(output_first == NULL)
+			pthread_cond_broadcast(&output_done);
+	}
+	return NULL;
+}
+
+// Queue a job, the worker thread is started with the first job and keeps running until the program exits
+static void queue_output(struct output_job *job) {
+	job->next = NULL;
+	pthread_mutex_lock(&output_lock);
+	if(!output_worker_running) {
+		if(pthread_create(&output_worker, NULL, write_output, NULL)) {
+			pthread_mutex_unlock(&output_lock);
+			printf("Could not start thread for writing file %s\n", job->filename);
+			output_status = 1;
+			return;
+		}
+		output_worker_running = true;
+	}
+	if(output_last == NULL)
+		output_first = job;
+	else
+		output_last->next = job;
+	output_last = job;
+	pthread_cond_signal(&output_queued);
+	pthread_mutex_unlock(&output_lock);
+}
+
+// Copy floating point array a with dimensions x and y and write it to filename in the background
+void write_array_async(char *filename, double **a, int x, int y) {
+	struct output_job *job = malloc(sizeof(struct output_job));
+	job->filename = malloc(strlen(filename) + 1);
+	strcpy(job->filename, filename);
+	job->values = malloc(x * sizeof(double*));
+	job->values[0] = malloc((size_t) x * y * sizeof(double));
+	for(int i = 0; i < x; ++i) {
+		job->values[i] = job->values[0] + (size_t) i * y;
+		memcpy(job->values[i], a[i], y * sizeof(double));
+	}
+	job->flags = NULL;
+	job->x = x;
+	job->y = y;
+	queue_output(job);
+}
+
+// Copy the bit-packed flags a with dimensions x and y and write them to filename in the background
+void write_bool_array_async(char *filename, uint64_t **a, int x, int y) {
+	struct output_job *job = malloc(sizeof(struct output_job));
+	job->filename = malloc(strlen(filename) + 1);
+	strcpy(job->filename, filename);
+	job->flags = malloc(x * sizeof(uint64_t*));
+	job->flags[0] = malloc((size_t) x * FLAG_WORDS(y) * sizeof(uint64_t));
+	for(int i = 0; i < x; ++i) {
+		job->flags[i] = job->flags[0] + (size_t) i * FLAG_WORDS(y);
+		memcpy(job->flags[i], a[i], FLAG_WORDS(y) * sizeof(uint64_t));
+	}
+	job->values = NULL;
+	job->x = x;
+	job->y = y;
+	queue_output(job);
+}
+
+// Wait until all queued files are written
+// Returns 0 if successful, 1 if any of the files could not be written.
+int flush_output() {
+	pthread_mutex_lock(&output_lock);
+	while(output_first != NULL || output_writing)
+		pthread_cond_wait(&output_done, &output_lock);
+	int status = output_status;
+	output_status = 0;
+	pthread_mutex_unlock(&output_lock);
+	return status;
+}
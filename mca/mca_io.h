@@ -1,9 +1,51 @@
 #ifndef MCA_IO_H
 #define MCA_IO_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
+// Entry of the table of all parameters, value points to the global variable (an int if is_int, else a double)
+struct parameter {
+	const char *name;
+	bool is_int;
+	void *value;
+};
+extern const struct parameter parameters[];
+extern const int parameters_count;
+// Names of the parameters of enum sensitivity_parameter (see mca.h), as in the parameter files
+extern const char *const sensitivity_names[];
+
+// A parameter that takes several values in a sweep
+struct sweep_axis {
+	int parameter;																					// Index into parameters
+	int count;
+	double *values;
+};
+
+// All sweep specifications of a parameter file for mca_sweep
+struct sweep {
+	bool find_EP;																					// Solve every point like mca_find_EP instead of mca_standalone
+	int axis_count;
+	struct sweep_axis *axes;
+	long point_count;																				// Number of points of the cartesian product
+};
+
 int read_args(char *filename);
 int read_args_find_EP(char *filename);
+int read_sweep(char *filename, struct sweep *sweep);
+void set_sweep_point(const struct sweep *sweep, long point);
+void free_sweep(struct sweep *sweep);
+// Maximal length of the string written by format_double
+#define FORMAT_DOUBLE_LENGTH 25
+
 int write_array(char *filename, double **a, int x, int y);
-int write_bool_array(char *filename, bool **a, int x, int y);
+int format_double(char *dst, double x);
+int write_bool_array(char *filename, uint64_t **a, int x, int y);
+int read_options(int argc, char *argv[]);
+int check_output_arguments(int argc, int inputs, int outputs);
+uint64_t hash_parameters();
+void write_array_async(char *filename, double **a, int x, int y);
+void write_bool_array_async(char *filename, uint64_t **a, int x, int y);
+int flush_output();
 
 #endif
@@ -0,0 +1,69 @@
+// Usage:
+// mca_optimize_P.exe params.csv optimal_P.csv [aggregate]
+//
+// params.csv				-- Parameters to use, same format as for mca_find_EP
+// optimal_P.csv			-- Output file, one row per value of L with the columns
+//							   L, optimal P, equity, cash, investment, defaulting flag, number of P evaluated for this L
+// aggregate				-- Optional, choose a single P maximizing the sum of the optimal equity over all L instead of one P per L
+//
+// Instead of solving the model for every P on the grid given by P_min, P_max and P_grid_size, the optimal P is bracketed and refined with a
+// golden-section search on that grid (see mca_optimize_P() in mca.c).
+
+// Any debug flags have to be specfied in mca.c.
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// FLAG TO SPECIFIY WHETHER WE SHOULD TIME THE EXECUTION
+#define TIMING
+#ifdef TIMING
+#include <time.h>
+#endif
+
+#include "mca_io.h"
+#include "mca.h"
+
+int main(int argc, char* argv[]) {
+	if(argc < 3) {
+		printf("Not enough arguments, expected at least two.\n");
+		return 1;
+	}
+	char *para_file = argv[1];
+	char *optimal_P_file = argv[2];
+	bool aggregate = false;
+	if(argc > 3) {
+		if(strcmp(argv[3], "aggregate")) {
+			printf("Unknown argument %s, expected aggregate.\n", argv[3]);
+			return 1;
+		}
+		aggregate = true;
+	}
+	if(read_args_find_EP(para_file)) {
+		return 2;
+	}
+
+	#ifdef TIMING
+	time_t start, end;
+	time(&start);
+	#endif
+
+	mca_optimize_P(aggregate);
+
+	#ifdef TIMING
+	time(&end);
+	printf("Time: %.2lf seconds to run.\n", difftime(end, start));
+	#endif
+	printf("Solved for %i out of %i values of P.\n", P_evaluations, P_grid_size);
+	print_iteration_counts();
+
+	if(write_array(optimal_P_file, optimal_P_per_L, L_grid_size, OPTIMAL_P_COLUMNS)) {
+		clean_up_optimize_P();
+		return 3;
+	}
+
+	clean_up_optimize_P();
+	
+	return 0;
+}
@@ -4,13 +4,22 @@
 // it performs a number of time steps specified by its first argument.
 
 // Usage:
-// mca_part.exe t params.csv Equity.csv Investment.csv Defaulting.csv
+// mca_part.exe t params.csv Equity.csv Investment.csv Defaulting.csv Equity_W.csv Equity_L.csv [options]
+// mca_part.exe t params.csv --binary=result.mcab [options]
 //
 // t				-- number of time steps to perform
 // params.csv		-- Parameters to use
 // Equity.csv
 // Investment.csv	-- Output files
 // Defaulting.csv
+// Equity_W.csv
+// Equity_L.csv
+// result.mcab		-- Binary result file (see mca_binary.h), instead of the CSV files
+//
+// Options (see read_options() in mca_io.c):
+// --binary=file --checkpoint=file --checkpoint-interval=n --resume --trajectory=file --trajectory-every=n --trajectory-tol=x
+// With --checkpoint, the state after time step t is saved as well, such that mca_standalone can continue from it with --resume.
+// With --resume, mca_part continues from the checkpoint up to time step t.
 
 // Any debug flags have to be specfied in mca.c.
 
@@ -26,21 +35,26 @@
 
 #include "mca_io.h"
 #include "mca.h"
+#include "mca_checkpoint.h"
+#include "mca_binary.h"
 
 int main(int argc, char* argv[]) {
-	if(argc < 7) {
-		printf("Not enough arguments, expected six.\n");
+	argc = read_options(argc, argv);
+	if(argc < 0) {
+		return 1;
+	}
+	if(check_output_arguments(argc, 3, 5)) {
+		return 1;
+	}
+	if(sensitivity_count > 0 || cube_file != NULL) {
+		printf("mca_part does not support --sensitivity and --cube\n");
 		return 1;
 	}
-	char *para_file = argv[1];
-	char *equity_file = argv[2];
-	char *investing_file = argv[3];
-	char *defaulting_file = argv[4];
-	char *equity_W_file = argv[5];
-	char *equity_L_file = argv[6];
+	char *para_file = argv[2];
 	if(read_args(para_file)) {
 		return 2;
 	}
+	init_checkpoint();
 	
 	int time_steps = atoi(argv[1]);
 	if(time_steps < 1 || time_steps > T_grid_size - 1) {
@@ -53,35 +67,43 @@ int main(int argc, char* argv[]) {
 	time(&start);
 	#endif
 
-	mca_part(time_steps);
+	if(mca_part(time_steps)) {
+		clean_up_standalone();
+		return 4;
+	}
+	wait_for_checkpoint();
+	print_iteration_counts();
 
 	#ifdef TIMING
 	time(&end);
 	printf("Time: %.2lf seconds to run.\n", difftime(end, start));
 	#endif
 
-	if(write_array(equity_file, equity, W_grid_size, L_grid_size)) {
-		clean_up();
-		return 3;
-	}
-	if(write_array(investing_file, investment, W_grid_size, L_grid_size)) {
-		clean_up();
-		return 3;
-	}
-	if(write_bool_array(defaulting_file, defaulting, W_grid_size, L_grid_size)) {
-		clean_up();
-		return 3;
-	}
-	if(write_array(equity_W_file, equity_W, W_grid_size, L_grid_size)) {
-		clean_up();
-		return 3;
+	if(binary_file != NULL) {
+		if(write_standalone_result(binary_file)) {
+			clean_up_standalone();
+			return 3;
+		}
+		clean_up_standalone();
+		return 0;
 	}
-	if(write_array(equity_L_file, equity_L, W_grid_size, L_grid_size)) {
-		clean_up();
+
+	char *equity_file = argv[3];
+	char *investing_file = argv[4];
+	char *defaulting_file = argv[5];
+	char *equity_W_file = argv[6];
+	char *equity_L_file = argv[7];
+	write_array_async(equity_file, equity, W_grid_size, L_grid_size);
+	write_array_async(investing_file, investment, W_grid_size, L_grid_size);
+	write_bool_array_async(defaulting_file, defaulting, W_grid_size, L_grid_size);
+	write_array_async(equity_W_file, equity_W, W_grid_size, L_grid_size);
+	write_array_async(equity_L_file, equity_L, W_grid_size, L_grid_size);
+
+	// The arrays have been copied, so we can free them while the files are being written
+	clean_up_standalone();
+	if(flush_output()) {
 		return 3;
 	}
-
-	clean_up();
 	
 	return 0;
 }
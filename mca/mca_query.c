@@ -0,0 +1,167 @@
+// Usage:
+// mca_query.exe socket points.csv values.csv [bicubic]
+// mca_query.exe socket reload [result.mcab]
+//
+// socket					-- Socket of a running mca_serve
+// points.csv				-- Points to look up, one per line with the columns W, L and P (P can be left out for a result of mca_standalone)
+// values.csv				-- Output file, one line per point with equity, investment, defaulting, equity_W and equity_L
+// bicubic					-- Optional, bicubic instead of bilinear interpolation
+// reload					-- Make mca_serve switch to result.mcab, or map the file it serves again
+//
+// Client for mca_serve, see mca_serve.h for the protocol. All points are sent in one batch. Only builds on systems with Unix domain sockets
+// (make mca_query).
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "mca_io.h"
+#include "mca_serve.h"
+
+static bool read_full(int fd, void *buffer, size_t size) {
+	char *data = buffer;
+	while(size > 0) {
+		ssize_t n = read(fd, data, size);
+		if(n <= 0)
+			return false;
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool write_full(int fd, const void *buffer, size_t size) {
+	const char *data = buffer;
+	while(size > 0) {
+		ssize_t n = write(fd, data, size);
+		if(n <= 0)
+			return false;
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+// Reads the points of filename into points (3 doubles each, P is 0 where it is left out). Returns the number of points, or -1 if the file
+// cannot be read.
+static int read_points(const char *filename, double **points) {
+	FILE *fp = fopen(filename, "r");
+	if(fp == NULL) {
+		printf("Error reading file %s\n", filename);
+		return -1;
+	}
+	int count = 0, capacity = 1024;
+	*points = malloc(capacity * 3 * sizeof(double));
+	char line[256];
+	while(fgets(line, sizeof line, fp) != NULL) {
+		double W, L, P = 0;
+		if(line[0] == '#' || sscanf(line, "%lf ,%lf ,%lf", &W, &L, &P) < 2)
+			continue;
+		if(count == capacity) {
+			capacity *= 2;
+			*points = realloc(*points, capacity * 3 * sizeof(double));
+		}
+		(*points)[3 * count] = W;
+		(*points)[3 * count + 1] = L;
+		(*points)[3 * count + 2] = P;
+		++count;
+	}
+	fclose(fp);
+	return count;
+}
+
+int main(int argc, char* argv[]) {
+	if(argc < 3 || (argc < 4 && strcmp(argv[2], "reload"))) {
+		printf("Not enough arguments, expected at least %s.\n", argc < 3 ? "two" : "three");
+		return 1;
+	}
+	bool reload = !strcmp(argv[2], "reload");
+	uint32_t method = SERVE_BILINEAR;
+	if(!reload && argc > 4) {
+		if(strcmp(argv[4], "bicubic")) {
+			printf("Unknown argument %s, expected bicubic.\n", argv[4]);
+			return 1;
+		}
+		method = SERVE_BICUBIC;
+	}
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof address);
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, argv[1], sizeof address.sun_path - 1);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0 || connect(fd, (struct sockaddr*) &address, sizeof address)) {
+		printf("Error connecting to socket %s\n", argv[1]);
+		return 1;
+	}
+
+	struct serve_request request = {SERVE_MAGIC, reload ? SERVE_RELOAD : SERVE_QUERY, 0, method};
+	struct serve_response response;
+	if(reload) {
+		const char *filename = argc > 3 ? argv[3] : "";
+		if(strlen(filename) > SERVE_MAX_NAME) {
+			printf("File name too long, at most %i characters\n", SERVE_MAX_NAME);
+			close(fd);
+			return 1;
+		}
+		request.count = strlen(filename);
+		if(!write_full(fd, &request, sizeof request) || !write_full(fd, filename, request.count) || !read_full(fd, &response, sizeof response)) {
+			printf("Error communicating with mca_serve\n");
+			close(fd);
+			return 3;
+		}
+		close(fd);
+		if(response.status != SERVE_OK) {
+			printf("mca_serve could not load the result set\n");
+			return 2;
+		}
+		printf("mca_serve switched to generation %llu\n", (unsigned long long) response.generation);
+		return 0;
+	}
+
+	double *points;
+	int count = read_points(argv[2], &points);
+	if(count < 0) {
+		close(fd);
+		return 2;
+	}
+	if(count > SERVE_MAX_POINTS) {
+		printf("Too many points, at most %i per query\n", SERVE_MAX_POINTS);
+		free(points);
+		close(fd);
+		return 1;
+	}
+	request.count = count;
+	double *values = malloc((size_t) count * SERVE_FIELDS * sizeof(double));
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	bool answered = write_full(fd, &request, sizeof request) && write_full(fd, points, (size_t) count * 3 * sizeof(double)) &&
+	                read_full(fd, &response, sizeof response) && response.status == SERVE_OK &&
+	                read_full(fd, values, (size_t) count * SERVE_FIELDS * sizeof(double));
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	close(fd);
+	free(points);
+	if(!answered) {
+		printf("Error communicating with mca_serve\n");
+		free(values);
+		return 3;
+	}
+	printf("%i points answered from generation %llu in %.3f ms.\n", count, (unsigned long long) response.generation,
+	       (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) * 1e-6);
+
+	double **rows = malloc(count * sizeof(double*));
+	for(int k = 0; k < count; ++k)
+		rows[k] = values + (size_t) k * SERVE_FIELDS;
+	int status = write_array(argv[3], rows, count, SERVE_FIELDS) ? 3 : 0;
+	free(rows);
+	free(values);
+	return status;
+}
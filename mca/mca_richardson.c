@@ -0,0 +1,251 @@
+// Usage:
+// mca_richardson.exe params.csv levels directory [options]
+//
+// params.csv				-- Parameters of the coarsest grid, same format as for mca_standalone
+// levels					-- Number of grids, 2 or 3. Grid k has 2^k times as many intervals in W, L and T as the coarsest grid (grid 0).
+// directory				-- Existing directory for the results
+//
+// Options (see read_options() in mca_io.c):
+// --order=p				-- order of convergence used for the extrapolation, by default estimated from the grids with 3 levels and 1 with 2
+// --shard=k/n				-- only solve the grids with index k modulo n, without extrapolating
+// --cache=directory --cache-size=n --no-cache
+//
+// Solves the model like mca_standalone on every grid and writes the result of grid k to directory/level_k.mcab. The points of grid 0 are points
+// of every grid, so the equity of the grids can be compared there. If the error of grid k behaves like C (h / 2^k)^p, the extrapolation
+//		E = E_f + (E_f - E_{f-1}) / (2^p - 1)
+// from the finest grid f and the one before cancels the leading error term. With three grids, p is estimated as the median of
+// log2((E_1 - E_0) / (E_2 - E_1)) over the points of grid 0 where the differences have the same sign. A norm of the differences would be
+// dominated by the kinks and the edges of the grid, where the error does not decrease like h^p. The difference between the extrapolations from
+// grids 1 and 2 and from grids 0 and 1 is an estimate of the error of the extrapolated equity. With two grids, the correction
+// (E_1 - E_0) / (2^p - 1) is given instead, an estimate of the error of E_1.
+// Where grid f defaults, equity stays 0, and extrapolated equity is never negative: across the default boundary the solution has a kink and the
+// error does not behave like C h^p.
+//
+// directory/richardson.mcab holds the extrapolated equity and the error estimate (error_estimate) on grid 0, as well as investment,
+// defaulting, equity_W and equity_L of the finest grid at the points of grid 0.
+//
+// The grids can be solved in parallel by several processes with --shard=k/n that share the result cache (see mca_cache.h). Once all shards are
+// done, running mca_richardson again without --shard loads the grids from the cache and extrapolates.
+
+// Any debug flags have to be specfied in mca.c.
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+// FLAG TO SPECIFIY WHETHER WE SHOULD TIME THE EXECUTION
+#define TIMING
+#ifdef TIMING
+#include <time.h>
+#endif
+
+#include "mca_io.h"
+#include "mca.h"
+#include "mca_binary.h"
+#include "mca_cache.h"
+
+#define MAX_LEVELS 3
+
+static double** create_rows(int x, int y) {
+	double **a = malloc(x * sizeof(double*));
+	for(int i = 0; i < x; ++i)
+		a[i] = malloc(y * sizeof(double));
+	return a;
+}
+
+static void destroy_rows(void **a, int x) {
+	for(int i = 0; i < x; ++i)
+		free(a[i]);
+	free(a);
+}
+
+static int compare_doubles(const void *a, const void *b) {
+	double x = *(const double*) a, y = *(const double*) b;
+	return (x > y) - (x < y);
+}
+
+static double extrapolate(double fine, double coarse, double factor) {
+	return fine + (fine - coarse) * factor;
+}
+
+int main(int argc, char* argv[]) {
+	argc = read_options(argc, argv);
+	if(argc < 0) {
+		return 1;
+	}
+	if(argc < 4) {
+		printf("Not enough arguments, expected three.\n");
+		return 1;
+	}
+	if(checkpoint_file != NULL || trajectory_file != NULL || binary_file != NULL || sensitivity_count > 0 || cube_file != NULL) {
+		printf("mca_richardson does not support --checkpoint, --trajectory, --binary, --sensitivity and --cube\n");
+		return 1;
+	}
+	// The shards only hand their grids on through the cache
+	if(shard_count > 1 && cache_directory == NULL) {
+		printf("mca_richardson with --shard needs the result cache, give --cache=directory or set MCA_CACHE_DIR\n");
+		return 1;
+	}
+	char *para_file = argv[1];
+	int levels = atoi(argv[2]);
+	char *directory = argv[3];
+	if(levels < 2 || levels > MAX_LEVELS) {
+		printf("Invalid number of levels %s, expected 2 or 3\n", argv[2]);
+		return 1;
+	}
+	if(read_args(para_file)) {
+		return 2;
+	}
+
+	// Grid 0 and the values of every grid at its points
+	int W0 = W_grid_size, L0 = L_grid_size, T0 = T_grid_size;
+	bool extrapolating = shard_count == 1;
+	double **level_equity[MAX_LEVELS];
+	double **fine_investment = NULL, **fine_equity_W = NULL, **fine_equity_L = NULL;
+	uint64_t **fine_defaulting = NULL;
+	for(int k = 0; k < levels && extrapolating; ++k)
+		level_equity[k] = create_rows(W0, L0);
+
+	// Solve the finest grid first, such that the data structures of grid 0 are left for writing the extrapolation
+	int status = 0;
+	for(int k = levels - 1; k >= 0 && !status; --k) {
+		if(k % shard_count != shard_index)
+			continue;
+		int refinement = 1 << k;
+		W_grid_size = (W0 - 1) * refinement + 1;
+		L_grid_size = (L0 - 1) * refinement + 1;
+		T_grid_size = (T0 - 1) * refinement + 1;
+
+		#ifdef TIMING
+		time_t start, end;
+		time(&start);
+		#endif
+
+		if(!cache_lookup(false)) {
+			if(mca_standalone()) {
+				clean_up_standalone();
+				return 4;
+			}
+			cache_store(false);
+		}
+
+		#ifdef TIMING
+		time(&end);
+		printf("Grid %i (%i x %i, %i time steps): %.2lf seconds to run.\n", k, W_grid_size, L_grid_size, T_grid_size, difftime(end, start));
+		#endif
+
+		char path[1024 + 64];
+		snprintf(path, sizeof path, "%s/level_%i.mcab", directory, k);
+		status = write_standalone_result(path);
+
+		if(extrapolating) {
+			for(int i = 0; i < W0; ++i)
+				for(int j = 0; j < L0; ++j)
+					level_equity[k][i][j] = equity[i * refinement][j * refinement];
+			if(k == levels - 1) {
+				fine_investment = create_rows(W0, L0);
+				fine_equity_W = create_rows(W0, L0);
+				fine_equity_L = create_rows(W0, L0);
+				fine_defaulting = malloc(W0 * sizeof(uint64_t*));
+				for(int i = 0; i < W0; ++i) {
+					fine_defaulting[i] = calloc(FLAG_WORDS(L0), sizeof(uint64_t));
+					for(int j = 0; j < L0; ++j) {
+						fine_investment[i][j] = investment[i * refinement][j * refinement];
+						fine_equity_W[i][j] = equity_W[i * refinement][j * refinement];
+						fine_equity_L[i][j] = equity_L[i * refinement][j * refinement];
+						set_flag(fine_defaulting, i, j, get_flag(defaulting, i * refinement, j * refinement));
+					}
+				}
+			}
+		}
+		if(k > 0 || !extrapolating)
+			clean_up_standalone();
+	}
+	W_grid_size = W0;
+	L_grid_size = L0;
+	T_grid_size = T0;
+	if(!extrapolating)
+		return status ? 3 : 0;
+	if(status) {
+		clean_up_standalone();
+		return 3;
+	}
+
+	// Order of convergence
+	double p = richardson_order;
+	if(p == 0) {
+		p = 1;
+		if(levels == 3) {
+			double *orders = malloc(W0 * L0 * sizeof(double));
+			int count = 0;
+			for(int i = 0; i < W0; ++i) {
+				for(int j = 0; j < L0; ++j) {
+					double d1 = level_equity[1][i][j] - level_equity[0][i][j];
+					double d2 = level_equity[2][i][j] - level_equity[1][i][j];
+					if(d1 * d2 > 0)
+						orders[count++] = log2(d1 / d2);
+				}
+			}
+			qsort(orders, count, sizeof(double), compare_doubles);
+			if(count > 0 && orders[count / 2] > 0)
+				p = orders[count / 2];
+			else
+				printf("The differences between the grids do not decrease, using order 1.\n");
+			free(orders);
+		}
+	}
+	printf("Order of convergence: %g\n", p);
+
+	// The extrapolation replaces the result of grid 0, investment, defaulting and the derivatives are taken from the finest grid
+	double factor = 1 / (pow(2, p) - 1);
+	int f = levels - 1;
+	double **error_estimate = create_rows(W0, L0);
+	double error_max = 0, error_sum = 0;
+	for(int i = 0; i < W0; ++i) {
+		for(int j = 0; j < L0; ++j) {
+			double e = extrapolate(level_equity[f][i][j], level_equity[f-1][i][j], factor);
+			if(levels == 3)
+				error_estimate[i][j] = fabs(e - extrapolate(level_equity[1][i][j], level_equity[0][i][j], factor));
+			else
+				error_estimate[i][j] = fabs(level_equity[1][i][j] - level_equity[0][i][j]) * factor;
+			if(get_flag(fine_defaulting, i, j) || e < 0)
+				e = 0;
+			equity[i][j] = e;
+			investment[i][j] = fine_investment[i][j];
+			set_flag(defaulting, i, j, get_flag(fine_defaulting, i, j));
+			equity_W[i][j] = fine_equity_W[i][j];
+			equity_L[i][j] = fine_equity_L[i][j];
+			error_max = error_estimate[i][j] > error_max ? error_estimate[i][j] : error_max;
+			error_sum += error_estimate[i][j];
+		}
+	}
+	printf("Estimated error: %g at most, %g on average\n", error_max, error_sum / (W0 * L0));
+
+	struct binary_axis axes[] = {
+		{"W", W_grid, W_grid_size},
+		{"L", L_grid, L_grid_size}
+	};
+	struct binary_array arrays[] = {
+		{"equity", equity, NULL, false, {0, 1}},
+		{"error_estimate", error_estimate, NULL, false, {0, 1}},
+		{"investment", investment, NULL, false, {0, 1}},
+		{"defaulting", NULL, defaulting, true, {0, 1}},
+		{"equity_W", equity_W, NULL, false, {0, 1}},
+		{"equity_L", equity_L, NULL, false, {0, 1}}
+	};
+	char path[1024 + 64];
+	snprintf(path, sizeof path, "%s/richardson.mcab", directory);
+	status = write_binary_result(path, axes, 2, arrays, 6);
+
+	clean_up_standalone();
+	for(int k = 0; k < levels; ++k)
+		destroy_rows((void**) level_equity[k], W0);
+	destroy_rows((void**) error_estimate, W0);
+	destroy_rows((void**) fine_investment, W0);
+	destroy_rows((void**) fine_equity_W, W0);
+	destroy_rows((void**) fine_equity_L, W0);
+	destroy_rows((void**) fine_defaulting, W0);
+	return status ? 3 : 0;
+}
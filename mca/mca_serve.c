@@ -0,0 +1,388 @@
+// Usage:
+// mca_serve.exe socket result.mcab
+//
+// socket					-- Path of the Unix domain socket to listen on, an existing file of this name is replaced
+// result.mcab				-- Result set to serve: binary result file of mca_standalone or mca_part, or cube of mca_find_EP (--cube)
+//
+// Answers batches of lookups of equity, investment, defaulting, equity_W and equity_L at arbitrary points (W, L, P) until it is killed, see
+// mca_serve.h for the protocol and mca_query.c for a client. Only builds on systems with Unix domain sockets (make mca_serve).
+//
+// The result set is memory-mapped once, every client connection is served by its own thread. The lookups only read the mapped result set,
+// so they need no lock. A reload maps the new result set and swaps the pointer to the current one atomically: requests that have started
+// finish on the old one, later ones use the new one. Every connection thread publishes the result set it is reading in a slot of
+// reader_slots, and the old result set is unmapped once no slot holds it anymore.
+//
+// Bilinear lookups interpolate linearly in W and L. Bicubic lookups use cubic Hermite interpolation in W and L with the slopes of the
+// central differences at the grid points, one-sided at the edges, on non-uniform grids as well. defaulting is the flag of the nearest grid
+// point. Between the values of P of a cube, the results of the two neighbouring values are interpolated linearly.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <signal.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "mca_binary.h"
+#include "mca_serve.h"
+
+#define MAX_CLIENTS 256																				// Connections served at the same time
+
+// Index of the arrays of doubles of a result set in the order of the fields of a result
+static const char *const field_names[] = {"equity", "investment", NULL, "equity_W", "equity_L"};
+#define DEFAULTING_FIELD 2
+
+// A mapped result set. For the results of mca_standalone, P_size is 1 and P is NULL.
+struct result_set {
+	struct binary_result *res;
+	char *filename;
+	uint64_t generation;
+	int P_size, W_size, L_size;
+	const double *P, *W, *L;
+	const double *fields[SERVE_FIELDS];																// NULL for the defaulting flags
+	const uint8_t *defaulting;
+	const uint8_t *solved;																			// Values of P in the cube, NULL for mca_standalone
+};
+
+static _Atomic(struct result_set*) current;
+static _Atomic(struct result_set*) reader_slots[MAX_CLIENTS];
+static atomic_bool slot_taken[MAX_CLIENTS];
+static pthread_mutex_t reload_lock = PTHREAD_MUTEX_INITIALIZER;										// Only one reload at a time
+static uint64_t generations = 0;
+
+// Maps filename and checks that it holds a result set. Returns NULL and prints the reason if it does not.
+static struct result_set* open_result_set(const char *filename) {
+	struct binary_result *res = open_binary_result(filename);
+	if(res == NULL) {
+		printf("Error reading result file %s\n", filename);
+		return NULL;
+	}
+	struct result_set *set = calloc(1, sizeof(struct result_set));
+	set->res = res;
+	set->P = binary_result_axis(res, "P", &set->P_size);
+	set->W = binary_result_axis(res, "W", &set->W_size);
+	set->L = binary_result_axis(res, "L", &set->L_size);
+	int rank = set->P != NULL ? 3 : 2;
+	if(set->P == NULL)
+		set->P_size = 1;
+	uint64_t n = (uint64_t) set->P_size * set->W_size * set->L_size;
+	bool valid = set->W != NULL && set->L != NULL && set->W_size >= 2 && set->L_size >= 2;
+	for(int f = 0; f < SERVE_FIELDS && valid; ++f) {
+		const struct binary_array_entry *entry;
+		if(f == DEFAULTING_FIELD)
+			set->defaulting = binary_result_flags(res, "defaulting", &entry);
+		else
+			set->fields[f] = binary_result_array(res, field_names[f], &entry);
+		valid = entry != NULL && entry->rank == (uint32_t) rank &&
+		        entry->size == (f == DEFAULTING_FIELD ? (n + 7) / 8 : n * sizeof(double));
+	}
+	if(valid && rank == 3) {
+		const struct binary_array_entry *entry;
+		set->solved = binary_result_flags(res, "solved", &entry);
+		valid = set->solved != NULL && entry->size == ((uint64_t) set->P_size + 7) / 8;
+	}
+	if(!valid) {
+		printf("Result file %s holds neither a result of mca_standalone nor a cube of mca_find_EP\n", filename);
+		close_binary_result(res);
+		free(set);
+		return NULL;
+	}
+	set->filename = malloc(strlen(filename) + 1);
+	strcpy(set->filename, filename);
+	set->generation = ++generations;
+	return set;
+}
+
+static void close_result_set(struct result_set *set) {
+	close_binary_result(set->res);
+	free(set->filename);
+	free(set);
+}
+
+// LOOKUPS
+
+// Index k of the interval [x[k], x[k + 1]] of the grid x with n points that holds v, and the position t of v in it. Returns false if v is
+// not on the grid.
+static bool locate(const double *x, int n, double v, int *k, double *t) {
+	if(!(v >= x[0] && v <= x[n - 1]))
+		return false;
+	int lo = 0, hi = n - 1;
+	while(hi - lo > 1) {
+		int mid = (lo + hi) / 2;
+		if(x[mid] <= v)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	*k = lo;
+	*t = (v - x[lo]) / (x[lo + 1] - x[lo]);
+	return true;
+}
+
+// Slope at the grid point k of the values v[k - 1], v[k], v[k + 1] (missing at the edges), the central difference of mca.c
+static inline double slope(const double *x, int n, int k, double a, double b, double c) {
+	if(k == 0)
+		return (c - b) / (x[1] - x[0]);
+	if(k == n - 1)
+		return (b - a) / (x[k] - x[k - 1]);
+	double h_p = x[k] - x[k - 1];
+	double h_n = x[k + 1] - x[k];
+	return ( h_n * h_n * (c - b) + h_p * h_p * (b - a) ) / ( h_n * h_p * (h_n + h_p) );
+}
+
+// Cubic Hermite interpolation at t in [x[k], x[k + 1]], given the values v[0] to v[3] at the grid points k - 1 to k + 2 (those outside the
+// grid are not used)
+static double hermite(const double *x, int n, int k, double t, const double v[4]) {
+	double h = x[k + 1] - x[k];
+	double m0 = slope(x, n, k, v[0], v[1], v[2]);
+	double m1 = slope(x, n, k + 1, v[1], v[2], v[3]);
+	double t2 = t * t, t3 = t2 * t;
+	return (2 * t3 - 3 * t2 + 1) * v[1] + (t3 - 2 * t2 + t) * h * m0 + (-2 * t3 + 3 * t2) * v[2] + (t3 - t2) * h * m1;
+}
+
+// Interpolation of the W x L slice a at the point in the cell (i, j) with the positions s in W and t in L
+static double interpolate(const struct result_set *set, const double *a, int i, int j, double s, double t, uint32_t method) {
+	int L_size = set->L_size;
+	if(method == SERVE_BILINEAR) {
+		const double *row = a + (size_t) i * L_size + j;
+		return (1 - s) * ((1 - t) * row[0] + t * row[1]) + s * ((1 - t) * row[L_size] + t * row[L_size + 1]);
+	}
+	// Along L for the rows i - 1 to i + 2, then along W
+	double along_L[4];
+	for(int r = 0; r < 4; ++r) {
+		int row_index = i - 1 + r;
+		if(row_index < 0 || row_index >= set->W_size)
+			continue;
+		const double *row = a + (size_t) row_index * L_size;
+		double v[4];
+		for(int c = 0; c < 4; ++c) {
+			int column = j - 1 + c;
+			v[c] = column >= 0 && column < L_size ? row[column] : 0;
+		}
+		along_L[r] = hermite(set->L, L_size, j, t, v);
+	}
+	if(i == 0)
+		along_L[0] = 0;
+	if(i + 2 >= set->W_size)
+		along_L[3] = 0;
+	return hermite(set->W, set->W_size, i, s, along_L);
+}
+
+// Fills the SERVE_FIELDS values of result at the point (W, L, P)
+static void look_up(const struct result_set *set, const double *point, uint32_t method, double *result) {
+	int i, j, p = 0;
+	double s, t, u = 0;
+	bool inside = locate(set->W, set->W_size, point[0], &i, &s) && locate(set->L, set->L_size, point[1], &j, &t);
+	if(inside && set->P != NULL) {
+		if(set->P_size == 1)
+			inside = point[2] == set->P[0];
+		else
+			inside = locate(set->P, set->P_size, point[2], &p, &u);
+		inside = inside && binary_flag(set->solved, p) && (u == 0 || binary_flag(set->solved, p + 1));
+	}
+	if(!inside) {
+		for(int f = 0; f < SERVE_FIELDS; ++f)
+			result[f] = NAN;
+		return;
+	}
+	size_t slice = (size_t) set->W_size * set->L_size;
+	for(int f = 0; f < SERVE_FIELDS; ++f) {
+		if(f == DEFAULTING_FIELD) {
+			size_t nearest = (p + (u > 0.5)) * slice + (size_t) (i + (s > 0.5)) * set->L_size + j + (t > 0.5);
+			result[f] = binary_flag(set->defaulting, nearest);
+			continue;
+		}
+		const double *a = set->fields[f] + p * slice;
+		result[f] = interpolate(set, a, i, j, s, t, method);
+		if(u > 0)
+			result[f] = (1 - u) * result[f] + u * interpolate(set, a + slice, i, j, s, t, method);
+	}
+}
+
+// CONNECTIONS
+
+static bool read_full(int fd, void *buffer, size_t size) {
+	char *data = buffer;
+	while(size > 0) {
+		ssize_t n = read(fd, data, size);
+		if(n <= 0)
+			return false;
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool write_full(int fd, const void *buffer, size_t size) {
+	const char *data = buffer;
+	while(size > 0) {
+		ssize_t n = write(fd, data, size);
+		if(n <= 0)
+			return false;
+		data += n;
+		size -= n;
+	}
+	return true;
+}
+
+// Maps filename and makes it the current result set, then waits until no request uses the preceding one anymore and unmaps that.
+// Returns SERVE_OK or SERVE_LOAD_FAILED.
+static uint32_t reload(const char *filename, uint64_t *generation) {
+	pthread_mutex_lock(&reload_lock);
+	struct result_set *old = atomic_load(&current);
+	struct result_set *set = open_result_set(filename[0] != 0 ? filename : old->filename);
+	if(set == NULL) {
+		pthread_mutex_unlock(&reload_lock);
+		*generation = old->generation;
+		return SERVE_LOAD_FAILED;
+	}
+	atomic_store(&current, set);
+	for(int c = 0; c < MAX_CLIENTS; ++c) {
+		while(atomic_load(&reader_slots[c]) == old)
+			sched_yield();
+	}
+	close_result_set(old);
+	printf("Serving %s (generation %llu)\n", set->filename, (unsigned long long) set->generation);
+	fflush(stdout);
+	*generation = set->generation;
+	pthread_mutex_unlock(&reload_lock);
+	return SERVE_OK;
+}
+
+// Serves the requests of one connection until the client closes it or sends an invalid request
+static void* serve_connection(void *arg) {
+	int fd = (int) (intptr_t) arg;
+	int c = 0;
+	bool expected = false;
+	while(c < MAX_CLIENTS && !atomic_compare_exchange_strong(&slot_taken[c], &expected, true)) {
+		expected = false;
+		++c;
+	}
+	double *points = NULL;
+	double *results = NULL;
+	uint32_t capacity = 0;
+	struct serve_request request;
+	while(c < MAX_CLIENTS && read_full(fd, &request, sizeof request)) {
+		struct serve_response response = {SERVE_OK, 0, 0};
+		if(request.magic != SERVE_MAGIC || (request.type == SERVE_QUERY && (request.count > SERVE_MAX_POINTS || request.method > SERVE_BICUBIC)) ||
+		   (request.type == SERVE_RELOAD && request.count > SERVE_MAX_NAME) || (request.type != SERVE_QUERY && request.type != SERVE_RELOAD)) {
+			response.status = SERVE_BAD_REQUEST;
+			write_full(fd, &response, sizeof response);
+			break;
+		}
+		if(request.type == SERVE_RELOAD) {
+			char *filename = malloc(request.count + 1);
+			if(filename == NULL) {
+				response.status = SERVE_NO_MEMORY;
+				write_full(fd, &response, sizeof response);
+				break;
+			}
+			bool received = read_full(fd, filename, request.count);
+			filename[request.count] = 0;
+			if(received)
+				response.status = reload(filename, &response.generation);
+			free(filename);
+			if(!received || !write_full(fd, &response, sizeof response))
+				break;
+			continue;
+		}
+		if(request.count > capacity) {
+			// Keep the old buffers on failure, such that they are freed below
+			double *new_points = realloc(points, (size_t) request.count * 3 * sizeof(double));
+			if(new_points != NULL)
+				points = new_points;
+			double *new_results = new_points != NULL ? realloc(results, (size_t) request.count * SERVE_FIELDS * sizeof(double)) : NULL;
+			if(new_results == NULL) {
+				response.status = SERVE_NO_MEMORY;
+				write_full(fd, &response, sizeof response);
+				break;
+			}
+			results = new_results;
+			capacity = request.count;
+		}
+		if(!read_full(fd, points, (size_t) request.count * 3 * sizeof(double)))
+			break;
+
+		// Publish the result set before using it, and check that it is still the current one, such that reload() cannot miss it
+		struct result_set *set;
+		do {
+			set = atomic_load(&current);
+			atomic_store(&reader_slots[c], set);
+		} while(set != atomic_load(&current));
+		for(uint32_t k = 0; k < request.count; ++k)
+			look_up(set, points + 3 * (size_t) k, request.method, results + SERVE_FIELDS * (size_t) k);
+		response.generation = set->generation;
+		atomic_store(&reader_slots[c], NULL);
+
+		response.count = request.count;
+		if(!write_full(fd, &response, sizeof response) || !write_full(fd, results, (size_t) request.count * SERVE_FIELDS * sizeof(double)))
+			break;
+	}
+	if(c == MAX_CLIENTS) {
+		struct serve_response response = {SERVE_BUSY, 0, 0};
+		write_full(fd, &response, sizeof response);
+	} else {
+		atomic_store(&slot_taken[c], false);
+	}
+	free(points);
+	free(results);
+	close(fd);
+	return NULL;
+}
+
+int main(int argc, char* argv[]) {
+	if(argc < 3) {
+		printf("Not enough arguments, expected two.\n");
+		return 1;
+	}
+	char *socket_path = argv[1];
+	struct result_set *set = open_result_set(argv[2]);
+	if(set == NULL) {
+		return 2;
+	}
+	atomic_store(&current, set);
+	for(int c = 0; c < MAX_CLIENTS; ++c) {
+		atomic_store(&reader_slots[c], NULL);
+		atomic_store(&slot_taken[c], false);
+	}
+	signal(SIGPIPE, SIG_IGN);																		// A client that went away only ends its thread
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof address);
+	address.sun_family = AF_UNIX;
+	if(strlen(socket_path) >= sizeof address.sun_path) {
+		printf("Socket path %s is too long\n", socket_path);
+		return 1;
+	}
+	strcpy(address.sun_path, socket_path);
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(socket_path);
+	if(listener < 0 || bind(listener, (struct sockaddr*) &address, sizeof address) || listen(listener, 64)) {
+		printf("Error listening on socket %s\n", socket_path);
+		return 3;
+	}
+	printf("Serving %s (generation %llu) on %s\n", set->filename, (unsigned long long) set->generation, socket_path);
+	fflush(stdout);
+
+	while(true) {
+		int fd = accept(listener, NULL, NULL);
+		if(fd < 0)
+			continue;
+		pthread_t thread;
+		pthread_attr_t attributes;
+		pthread_attr_init(&attributes);
+		pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+		if(pthread_create(&thread, &attributes, serve_connection, (void*) (intptr_t) fd))
+			close(fd);
+		pthread_attr_destroy(&attributes);
+	}
+}
@@ -0,0 +1,49 @@
+#ifndef MCA_SERVE_H
+#define MCA_SERVE_H
+
+// QUERY PROTOCOL OF MCA_SERVE
+// mca_serve answers requests on a Unix domain stream socket. A client sends a struct serve_request followed by its payload and receives a
+// struct serve_response followed by its payload, any number of times on the same connection. All values are in the byte order of the machine.
+//
+// SERVE_QUERY		-- count points (W, L, P), 3 doubles each, are answered with count results of SERVE_FIELDS doubles each: equity,
+//					   investment, defaulting (0 or 1), equity_W and equity_L at the point. method is SERVE_BILINEAR or SERVE_BICUBIC.
+// SERVE_RELOAD		-- count bytes of a file name (without terminating 0) are answered without payload. The server maps the new result set
+//					   and switches to it for all requests that start afterwards. With count 0, the file served so far is mapped again, e.g.
+//					   after a new result has been renamed to its name. A file that is being served must not be overwritten in place.
+//
+// A result set is a binary result file (see mca_binary.h) of mca_standalone or mca_part, on the axes W and L, or a cube of mca_find_EP
+// (--cube), on the axes P, W and L. For the former, P is ignored. Points outside the grids give NaN, as do values of P next to one missing
+// from a cube. generation counts the result sets the server has loaded, so a client can tell whether two answers come from the same one.
+
+#include <stdint.h>
+
+#define SERVE_MAGIC 0x5141434d																		// "MCAQ" in little endian
+#define SERVE_QUERY 1
+#define SERVE_RELOAD 2
+#define SERVE_BILINEAR 0
+#define SERVE_BICUBIC 1
+#define SERVE_FIELDS 5
+#define SERVE_MAX_POINTS (1 << 20)																	// Largest count of a query
+#define SERVE_MAX_NAME 4096																			// Largest count of a reload, the length of the file name
+
+#define SERVE_OK 0
+#define SERVE_BAD_REQUEST 1																			// The server closes the connection
+#define SERVE_LOAD_FAILED 2																			// The result set of a reload could not be mapped
+#define SERVE_BUSY 3																				// Too many connections, the server closes this one
+#define SERVE_NO_MEMORY 4																			// The buffers of the request could not be allocated, the server
+																									// closes the connection
+
+struct serve_request {
+	uint32_t magic;																					// SERVE_MAGIC
+	uint32_t type;																					// SERVE_QUERY or SERVE_RELOAD
+	uint32_t count;
+	uint32_t method;
+};
+
+struct serve_response {
+	uint32_t status;
+	uint32_t count;																					// Number of results following
+	uint64_t generation;																			// Of the result set used
+};
+
+#endif
@@ -0,0 +1,508 @@
+// Usage:
+// mca_simulate.exe result.mcab W0 L0 paths default_times.csv terminal.csv [options]
+//
+// result.mcab				-- Binary result file of mca_standalone or mca_part (see mca_binary.h), the policy at t = 0
+// W0 L0					-- Cash and loans at t = 0, on the grids of the result
+// paths					-- Number of paths to simulate
+// default_times.csv		-- Output file, one line per bin of the default time with begin, end, fraction of the paths defaulting in the
+//							   bin and fraction defaulted up to its end. The last line (begin and end T) counts the defaults at T.
+// terminal.csv				-- Output file, one line per bin with the begin, end and fraction of the paths in the bin of W, L and the
+//							   terminal payoff at T, the surviving paths only
+//
+// Options (see read_options() in mca_io.c):
+// --trajectory=file		-- Trajectory of the same solve (see mca_trajectory.h), for the policy at the times of its snapshots
+// --seed=n					-- Key of the random number streams (default 0)
+// --bins=n					-- Number of bins of the histograms (default 100)
+// --steps=n				-- Time steps of the paths (default T_grid_size - 1 of the result)
+//
+// The paths follow the dynamics of the model (see transition_rates() in mca.c) with the investment q of the solved policy, in steps of
+// length h = T / steps:
+//		W += (1 - taxc) (1 - taxe) (delta L + r_W W - coupon - q - psi q^2 / 2) h,		r_W = r - lambda for W >= 0, r for W < 0
+//		L += (q - delta L) h + sigma L sqrt(h) Z,										L >= 0
+// At the beginning of every step, a path defaults if the defaulting flag of the grid point nearest to it is set. At T, it receives the
+// terminal payoff of terminal_equity_default() in mca.c, and defaults if that is 0. Without a trajectory, the policy at t = 0 is used for the
+// whole horizon, with one, the policy of the latest snapshot at or before t. investment is interpolated bilinearly, and the policy of the
+// nearest point of the grid is used outside of it.
+//
+// The paths are simulated in batches of PATH_BATCH, stored as one array per variable, so that the compiler vectorizes the steps and the
+// random numbers over the paths of a batch. The random numbers come from Philox4x32-10, a counter-based generator: the normals of path n
+// for the steps 4m to 4m + 3 are computed from the counter (m, n) and the key --seed, so every path has its own stream and the results
+// do not depend on the number of threads or the order in which the batches are run.
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+// FLAG TO SPECIFIY WHETHER WE SHOULD TIME THE EXECUTION
+#define TIMING
+#ifdef TIMING
+#include <time.h>
+#endif
+
+#include "mca_io.h"
+#include "mca.h"
+#include "mca_binary.h"
+#include "mca_trajectory.h"
+
+#define PATH_BATCH 8																				// Paths simulated together
+#define PATH_CHUNK 4096																				// Paths per unit of work, a multiple of PATH_BATCH
+#define TWO_PI 6.283185307179586
+
+// Constants of Philox4x32-10 (Salmon et al., Parallel random numbers: as easy as 1, 2, 3, 2011)
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+// The policy from time t on, until the next one
+struct policy {
+	double t;
+	double *investment;																				// W_grid_size * L_grid_size, row by row
+	bool *defaulting;
+};
+
+static struct policy *policies;																		// In increasing order of t, the first at t = 0
+static int policy_count;
+
+// Statistics of the paths of a chunk. The counts are exact in any order, the sums are added up in the order of the chunks.
+struct chunk_sums {
+	double value, value_squared;																	// Of the discounted terminal payoff, 0 for defaults
+	double W, L;																					// At T, of the surviving paths
+	double default_time;																			// Of the defaulting paths
+};
+
+// Counts of the paths in the bins, default_time has simulation_bins + 1 bins, the last for defaults at T
+struct histograms {
+	long long *default_time, *W, *L, *value;
+};
+
+static double value_max;																			// Upper end of the histogram of the terminal payoff
+
+// Runs Philox4x32-10 on the counters of the paths of a batch, c[k][n] is word k of the counter of path n
+static inline void philox_batch(uint32_t c[4][PATH_BATCH], uint32_t key0, uint32_t key1) {
+	for(int round = 0; round < 10; ++round) {
+		#pragma omp simd
+		for(int n = 0; n < PATH_BATCH; ++n) {
+			uint64_t product0 = (uint64_t) PHILOX_M0 * c[0][n];
+			uint64_t product1 = (uint64_t) PHILOX_M1 * c[2][n];
+			uint32_t c1 = c[1][n], c3 = c[3][n];
+			c[0][n] = (uint32_t) (product1 >> 32) ^ c1 ^ key0;
+			c[1][n] = (uint32_t) product1;
+			c[2][n] = (uint32_t) (product0 >> 32) ^ c3 ^ key1;
+			c[3][n] = (uint32_t) product0;
+		}
+		key0 += PHILOX_W0;
+		key1 += PHILOX_W1;
+	}
+}
+
+// Fills z[s][n] with the standard normals of path first_path + n for the steps 4m + s (Box-Muller on the four words of the counter (m, n))
+static void normals_batch(uint64_t first_path, int m, double z[4][PATH_BATCH]) {
+	uint32_t c[4][PATH_BATCH];
+	for(int n = 0; n < PATH_BATCH; ++n) {
+		c[0][n] = (uint32_t) m;
+		c[1][n] = (uint32_t) (first_path + n);
+		c[2][n] = (uint32_t) ((first_path + n) >> 32);
+		c[3][n] = 0;
+	}
+	philox_batch(c, (uint32_t) simulation_seed, (uint32_t) (simulation_seed >> 32));
+	#pragma omp simd
+	for(int n = 0; n < PATH_BATCH; ++n) {
+		// Uniforms in (0, 1), never 0
+		double u0 = (c[0][n] + 0.5) * 0x1p-32, u1 = (c[1][n] + 0.5) * 0x1p-32;
+		double u2 = (c[2][n] + 0.5) * 0x1p-32, u3 = (c[3][n] + 0.5) * 0x1p-32;
+		double radius0 = sqrt(-2 * log(u0)), radius1 = sqrt(-2 * log(u2));
+		z[0][n] = radius0 * cos(TWO_PI * u1);
+		z[1][n] = radius0 * sin(TWO_PI * u1);
+		z[2][n] = radius1 * cos(TWO_PI * u3);
+		z[3][n] = radius1 * sin(TWO_PI * u3);
+	}
+}
+
+// A grid of the result, located by a division if it is uniform and by bisection otherwise
+struct axis {
+	const double *grid;
+	int size;
+	bool uniform;
+	double inverse_step;
+};
+
+static struct axis W_axis, L_axis;
+
+static void setup_axis(struct axis *axis, const double *grid, int size) {
+	axis->grid = grid;
+	axis->size = size;
+	double step = (grid[size - 1] - grid[0]) / (size - 1);
+	axis->uniform = true;
+	for(int i = 1; i < size; ++i)
+		axis->uniform = axis->uniform && fabs(grid[i] - (grid[0] + i * step)) <= 1e-9 * fabs(step);
+	axis->inverse_step = 1 / step;
+}
+
+// Index i of the interval [grid[i], grid[i + 1]] holding x and the weight of grid[i + 1], x outside of the grid is moved onto it
+static inline int locate(const struct axis *axis, double x, double *weight) {
+	int low;
+	if(axis->uniform) {
+		double position = (x - axis->grid[0]) * axis->inverse_step;
+		low = !(position > 0) ? 0 : position >= axis->size - 2 ? axis->size - 2 : (int) position;
+		*weight = position - low;
+	} else {
+		low = 0;
+		int high = axis->size - 2;
+		while(low < high) {
+			int middle = (low + high + 1) / 2;
+			if(axis->grid[middle] <= x)
+				low = middle;
+			else
+				high = middle - 1;
+		}
+		*weight = (x - axis->grid[low]) / (axis->grid[low + 1] - axis->grid[low]);
+	}
+	if(*weight < 0)
+		*weight = 0;
+	else if(*weight > 1)
+		*weight = 1;
+	return low;
+}
+
+// Bilinear interpolation of a (row by row on the W x L grid) at the position given by locate()
+static inline double interpolate(const double *a, int i, double wW, int j, double wL) {
+	const double *row = a + (size_t) i * L_grid_size + j;
+	return (1 - wW) * ((1 - wL) * row[0] + wL * row[1]) + wW * ((1 - wL) * row[L_grid_size] + wL * row[L_grid_size + 1]);
+}
+
+static inline double terminal_payoff(double W, double L) {
+	if(W >= 0)
+		return fmax(W * (1 - taxe) - P + L, 0);
+	else
+		return fmax(W - P + (1 - theta) * L, 0);
+}
+
+// Bin of x in [low, high) divided into simulation_bins bins, values outside go to the first or last bin
+static inline int bin(double x, double low, double high) {
+	double position = (x - low) / (high - low) * simulation_bins;
+	if(!(position >= 0))
+		return 0;
+	if(position >= simulation_bins)
+		return simulation_bins - 1;
+	return (int) position;
+}
+
+// Simulates count paths starting with first_path and adds their statistics to sums and counts
+static void simulate_chunk(uint64_t first_path, int count, double W0, double L0, struct chunk_sums *sums, struct histograms *counts) {
+	int steps = simulation_steps;
+	double h = T / steps, sqrt_h = sqrt(h);
+	double k = (1 - taxc) * (1 - taxe);
+	double discount = exp(-rhohat * T);
+	memset(sums, 0, sizeof(struct chunk_sums));
+	for(int first = 0; first < count; first += PATH_BATCH) {
+		uint64_t batch_path = first_path + first;
+		double W[PATH_BATCH], L[PATH_BATCH], q[PATH_BATCH], z[4][PATH_BATCH];
+		bool alive[PATH_BATCH];
+		for(int n = 0; n < PATH_BATCH; ++n) {
+			W[n] = W0;
+			L[n] = L0;
+			alive[n] = first + n < count;
+		}
+		int p = 0;
+		for(int s = 0; s < steps; ++s) {
+			double t = s * h;
+			while(p + 1 < policy_count && policies[p + 1].t <= t)
+				++p;
+			// The policy at the paths, looked up one path after another
+			int living = 0;
+			for(int n = 0; n < PATH_BATCH; ++n) {
+				q[n] = 0;
+				if(!alive[n])
+					continue;
+				double wW, wL;
+				int i = locate(&W_axis, W[n], &wW);
+				int j = locate(&L_axis, L[n], &wL);
+				if(policies[p].defaulting[(size_t) (i + (wW > 0.5)) * L_grid_size + j + (wL > 0.5)]) {
+					alive[n] = false;
+					++counts->default_time[bin(t, 0, T)];
+					sums->default_time += t;
+					continue;
+				}
+				q[n] = interpolate(policies[p].investment, i, wW, j, wL);
+				++living;
+			}
+			if(living == 0)
+				break;
+			if(s % 4 == 0)
+				normals_batch(batch_path, s / 4, z);
+			const double *dZ = z[s % 4];
+			#pragma omp simd
+			for(int n = 0; n < PATH_BATCH; ++n) {
+				double rate = W[n] >= 0 ? r - lambda : r;
+				double W_next = W[n] + k * (delta * L[n] + rate * W[n] - coupon - q[n] - 0.5 * psi * q[n] * q[n]) * h;
+				double L_next = L[n] + (q[n] - delta * L[n]) * h + sigma * L[n] * sqrt_h * dZ[n];
+				W[n] = alive[n] ? W_next : W[n];
+				L[n] = alive[n] ? fmax(L_next, 0) : L[n];
+			}
+		}
+		for(int n = 0; n < PATH_BATCH; ++n) {
+			if(!alive[n])
+				continue;
+			double value = terminal_payoff(W[n], L[n]);
+			if(value == 0) {
+				++counts->default_time[simulation_bins];
+				sums->default_time += T;
+				continue;
+			}
+			sums->value += discount * value;
+			sums->value_squared += discount * value * discount * value;
+			sums->W += W[n];
+			sums->L += L[n];
+			++counts->W[bin(W[n], W_min, W_max)];
+			++counts->L[bin(L[n], L_min, L_max)];
+			++counts->value[bin(value, 0, value_max)];
+		}
+	}
+}
+
+// Reads the snapshots of mca_standalone or mca_part from the trajectory file into policies after the policy at t = 0. Returns 0 if
+// successful, 1 if the trajectory does not belong to the grids of the result, 2 if it cannot be read.
+static int read_trajectory_policies(const char *filename) {
+	struct trajectory *tr = open_trajectory(filename);
+	if(tr == NULL) {
+		printf("Error reading trajectory file %s\n", filename);
+		return 2;
+	}
+	if(tr->W_grid_size != W_grid_size || tr->L_grid_size != L_grid_size || memcmp(tr->W_grid, W_grid, W_grid_size * sizeof(double)) ||
+	   memcmp(tr->L_grid, L_grid, L_grid_size * sizeof(double))) {
+		printf("Trajectory file %s was recorded on other grids than the result\n", filename);
+		close_trajectory(tr);
+		return 1;
+	}
+	// The index is in the order of recording, backward in time
+	policies = realloc(policies, (1 + tr->count) * sizeof(struct policy));
+	size_t n = (size_t) W_grid_size * L_grid_size;
+	for(int k = tr->count - 1; k >= 0; --k) {
+		if(tr->index[k].P_index != -1 || !(tr->index[k].t > policies[policy_count - 1].t) || !(tr->index[k].t < T))
+			continue;
+		struct policy *policy = &policies[policy_count];
+		policy->t = tr->index[k].t;
+		policy->investment = malloc(n * sizeof(double));
+		policy->defaulting = malloc(n * sizeof(bool));
+		if(read_trajectory_slice(tr, k, NULL, policy->investment, policy->defaulting)) {
+			printf("Error reading snapshot %i of trajectory file %s\n", k, filename);
+			free(policy->investment);
+			free(policy->defaulting);
+			close_trajectory(tr);
+			return 2;
+		}
+		++policy_count;
+	}
+	close_trajectory(tr);
+	if(policy_count == 1)
+		printf("Trajectory file %s has no snapshots of mca_standalone or mca_part between t = 0 and T\n", filename);
+	return 0;
+}
+
+static int write_histograms(const char *default_times_name, const char *terminal_name, const struct histograms *counts, long long paths) {
+	double **rows = malloc((simulation_bins + 1) * sizeof(double*));
+	for(int b = 0; b <= simulation_bins; ++b)
+		rows[b] = malloc(9 * sizeof(double));
+	long long defaults = 0;
+	for(int b = 0; b <= simulation_bins; ++b) {
+		defaults += counts->default_time[b];
+		rows[b][0] = b < simulation_bins ? T * b / simulation_bins : T;
+		rows[b][1] = b < simulation_bins ? T * (b + 1) / simulation_bins : T;
+		rows[b][2] = (double) counts->default_time[b] / paths;
+		rows[b][3] = (double) defaults / paths;
+	}
+	int status = write_array((char*) default_times_name, rows, simulation_bins + 1, 4);
+	double low[3] = {W_min, L_min, 0}, high[3] = {W_max, L_max, value_max};
+	long long *histogram[3] = {counts->W, counts->L, counts->value};
+	for(int b = 0; b < simulation_bins; ++b) {
+		for(int v = 0; v < 3; ++v) {
+			rows[b][3 * v] = low[v] + (high[v] - low[v]) * b / simulation_bins;
+			rows[b][3 * v + 1] = low[v] + (high[v] - low[v]) * (b + 1) / simulation_bins;
+			rows[b][3 * v + 2] = (double) histogram[v][b] / paths;
+		}
+	}
+	if(!status)
+		status = write_array((char*) terminal_name, rows, simulation_bins, 9);
+	for(int b = 0; b <= simulation_bins; ++b)
+		free(rows[b]);
+	free(rows);
+	return status;
+}
+
+int main(int argc, char* argv[]) {
+	argc = read_options(argc, argv);
+	if(argc < 0) {
+		return 1;
+	}
+	if(argc < 7) {
+		printf("Not enough arguments, expected six.\n");
+		return 1;
+	}
+	char *result_name = argv[1];
+	double W0 = atof(argv[2]), L0 = atof(argv[3]);
+	long long paths = atoll(argv[4]);
+	if(paths < 1) {
+		printf("Invalid number of paths %s, must be at least 1\n", argv[4]);
+		return 1;
+	}
+
+	#ifdef TIMING
+	time_t start, end;
+	time(&start);
+	#endif
+
+	struct binary_result *res = open_binary_result(result_name);
+	if(res == NULL) {
+		printf("Error reading result file %s\n", result_name);
+		return 2;
+	}
+	for(int k = 0; k < parameters_count; ++k) {
+		double value;
+		if(binary_result_parameter(res, parameters[k].name, &value)) {
+			if(parameters[k].is_int)
+				*(int*) parameters[k].value = (int) value;
+			else
+				*(double*) parameters[k].value = value;
+		}
+	}
+	coupon = (r + premium) * P;
+	rhohat = (1 - taxi) * r;
+	W_grid = (double*) binary_result_axis(res, "W", &W_grid_size);
+	L_grid = (double*) binary_result_axis(res, "L", &L_grid_size);
+	const struct binary_array_entry *equity_entry, *investment_entry, *defaulting_entry;
+	const double *result_equity = binary_result_array(res, "equity", &equity_entry);
+	const double *result_investment = binary_result_array(res, "investment", &investment_entry);
+	const uint8_t *result_defaulting = binary_result_flags(res, "defaulting", &defaulting_entry);
+	size_t n = (size_t) W_grid_size * L_grid_size;
+	if(W_grid == NULL || L_grid == NULL || W_grid_size < 2 || L_grid_size < 2 || result_equity == NULL || result_investment == NULL ||
+	   result_defaulting == NULL || equity_entry->size != n * sizeof(double) || investment_entry->size != n * sizeof(double) ||
+	   defaulting_entry->size != (n + 7) / 8) {
+		printf("Result file %s is not a result of mca_standalone or mca_part\n", result_name);
+		close_binary_result(res);
+		return 2;
+	}
+	W_min = W_grid[0];
+	W_max = W_grid[W_grid_size - 1];
+	L_min = L_grid[0];
+	L_max = L_grid[L_grid_size - 1];
+	setup_axis(&W_axis, W_grid, W_grid_size);
+	setup_axis(&L_axis, L_grid, L_grid_size);
+	if(!(W0 >= W_min && W0 <= W_max && L0 >= L_min && L0 <= L_max)) {
+		printf("Initial point (%s, %s) lies outside of the grids of the result\n", argv[2], argv[3]);
+		close_binary_result(res);
+		return 1;
+	}
+	if(simulation_steps == 0)
+		simulation_steps = T_grid_size - 1;
+	if(simulation_steps < 1) {
+		printf("The result has no time steps, use --steps=n\n");
+		close_binary_result(res);
+		return 1;
+	}
+
+	policies = malloc(sizeof(struct policy));
+	policies[0].t = 0;
+	policies[0].investment = (double*) result_investment;
+	policies[0].defaulting = malloc(n * sizeof(bool));
+	for(size_t k = 0; k < n; ++k)
+		policies[0].defaulting[k] = binary_flag(result_defaulting, k);
+	policy_count = 1;
+	if(trajectory_file != NULL) {
+		int status = read_trajectory_policies(trajectory_file);
+		if(status) {
+			close_binary_result(res);
+			return status;
+		}
+	}
+	value_max = fmax(terminal_payoff(W_max, L_max), terminal_payoff(W_min, L_max));
+	if(!(value_max > 0))
+		value_max = 1;
+
+	// The chunks are distributed over the threads, the counts are kept per thread and the sums per chunk
+	long long chunks = (paths + PATH_CHUNK - 1) / PATH_CHUNK;
+	struct chunk_sums *sums = malloc(chunks * sizeof(struct chunk_sums));
+	struct histograms total;
+	total.default_time = calloc(simulation_bins + 1, sizeof(long long));
+	total.W = calloc(simulation_bins, sizeof(long long));
+	total.L = calloc(simulation_bins, sizeof(long long));
+	total.value = calloc(simulation_bins, sizeof(long long));
+	#pragma omp parallel
+	{
+		struct histograms counts;
+		counts.default_time = calloc(simulation_bins + 1, sizeof(long long));
+		counts.W = calloc(simulation_bins, sizeof(long long));
+		counts.L = calloc(simulation_bins, sizeof(long long));
+		counts.value = calloc(simulation_bins, sizeof(long long));
+		#pragma omp for schedule(dynamic)
+		for(long long c = 0; c < chunks; ++c)
+			simulate_chunk((uint64_t) c * PATH_CHUNK, c < chunks - 1 ? PATH_CHUNK : paths - c * PATH_CHUNK, W0, L0, &sums[c], &counts);
+		#pragma omp critical
+		{
+			for(int b = 0; b <= simulation_bins; ++b)
+				total.default_time[b] += counts.default_time[b];
+			for(int b = 0; b < simulation_bins; ++b) {
+				total.W[b] += counts.W[b];
+				total.L[b] += counts.L[b];
+				total.value[b] += counts.value[b];
+			}
+		}
+		free(counts.default_time);
+		free(counts.W);
+		free(counts.L);
+		free(counts.value);
+	}
+	struct chunk_sums sum = {0, 0, 0, 0, 0};
+	for(long long c = 0; c < chunks; ++c) {
+		sum.value += sums[c].value;
+		sum.value_squared += sums[c].value_squared;
+		sum.W += sums[c].W;
+		sum.L += sums[c].L;
+		sum.default_time += sums[c].default_time;
+	}
+	long long defaults = 0;
+	for(int b = 0; b <= simulation_bins; ++b)
+		defaults += total.default_time[b];
+
+	#ifdef TIMING
+	time(&end);
+	printf("Time: %.2lf seconds to run.\n", difftime(end, start));
+	#endif
+
+	double mean = sum.value / paths;
+	double standard_error = sqrt(fmax(sum.value_squared / paths - mean * mean, 0) / (paths - 1 > 0 ? paths - 1 : 1));
+	double wW, wL;
+	int i = locate(&W_axis, W0, &wW);
+	int j = locate(&L_axis, L0, &wL);
+	if(policy_count == 1)
+		printf("%lld paths of %i time steps from (%g, %g) with the policy at t = 0.\n", paths, simulation_steps, W0, L0);
+	else
+		printf("%lld paths of %i time steps from (%g, %g) with the policies at %i times.\n", paths, simulation_steps, W0, L0, policy_count);
+	printf("Default probability: %.6f, %.6f before T\n", (double) defaults / paths,
+	       (double) (defaults - total.default_time[simulation_bins]) / paths);
+	if(defaults > 0)
+		printf("Mean default time of the defaulting paths: %.4f\n", sum.default_time / defaults);
+	if(defaults < paths)
+		printf("Mean W and L at T of the surviving paths: %.4f, %.4f\n", sum.W / (paths - defaults), sum.L / (paths - defaults));
+	printf("Equity: %.4f +- %.4f (discounted terminal payoff), %.4f (solver)\n", mean, standard_error,
+	       interpolate(result_equity, i, wW, j, wL));
+
+	int status = write_histograms(argv[5], argv[6], &total, paths) ? 3 : 0;
+
+	free(sums);
+	free(total.default_time);
+	free(total.W);
+	free(total.L);
+	free(total.value);
+	for(int k = 0; k < policy_count; ++k) {
+		if(k > 0)
+			free(policies[k].investment);
+		free(policies[k].defaulting);
+	}
+	free(policies);
+	close_binary_result(res);
+	return status;
+}
@@ -1,18 +1,30 @@
 // Valerio Morelli, August 2016
 
 // Usage:
-// mca_standalone.exe params.csv Equity.csv Investment.csv Defaulting.csv
+// mca_standalone.exe params.csv Equity.csv Investment.csv Defaulting.csv Equity_W.csv Equity_L.csv [options]
+// mca_standalone.exe params.csv --binary=result.mcab [options]
 //
 // params.csv		-- Parameters to use
 // Equity.csv
 // Investment.csv	-- Output files
 // Defaulting.csv
+// Equity_W.csv
+// Equity_L.csv
+// result.mcab		-- Binary result file with all outputs, the grid axes and the parameters (see mca_binary.h), instead of the CSV files
+//
+// With --sensitivity=name,..., the derivatives of equity with respect to the parameters are written to Equity_d_<name>.csv next to
+// Equity.csv, or with --binary to the binary result file as the arrays d_equity_d_<name>.
+//
+// Options (see read_options() in mca_io.c):
+// --binary=file --checkpoint=file --checkpoint-interval=n --resume --trajectory=file --trajectory-every=n --trajectory-tol=x
+// --sensitivity=name,... --cache=directory --cache-size=n --no-cache
 
 // Any debug flags have to be specfied in mca.c.
 
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
 // FLAG TO SPECIFIY WHETHER WE SHOULD TIME THE EXECUTION
 #define TIMING
@@ -22,56 +34,84 @@
 
 #include "mca_io.h"
 #include "mca.h"
+#include "mca_checkpoint.h"
+#include "mca_binary.h"
+#include "mca_cache.h"
 
 int main(int argc, char* argv[]) {
-	if(argc < 7) {
-		printf("Not enough arguments, expected six.\n");
+	argc = read_options(argc, argv);
+	if(argc < 0) {
+		return 1;
+	}
+	if(check_output_arguments(argc, 2, 5)) {
+		return 1;
+	}
+	if(cube_file != NULL) {
+		printf("mca_standalone does not support --cube\n");
 		return 1;
 	}
 	char *para_file = argv[1];
-	char *equity_file = argv[2];
-	char *investing_file = argv[3];
-	char *defaulting_file = argv[4];
-	char *equity_W_file = argv[5];
-	char *equity_L_file = argv[6];
 	if(read_args(para_file)) {
 		return 2;
 	}
+	init_checkpoint();
 
 	#ifdef TIMING
 	time_t start, end;
 	time(&start);
 	#endif
 
-	mca_standalone();
+	if(!cache_lookup(false)) {
+		if(mca_standalone()) {
+			clean_up_standalone();
+			return 4;
+		}
+		wait_for_checkpoint();
+		cache_store(false);
+		print_iteration_counts();
+	}
 
 	#ifdef TIMING
 	time(&end);
 	printf("Time: %.2lf seconds to run.\n", difftime(end, start));
 	#endif
 
-	if(write_array(equity_file, equity, W_grid_size, L_grid_size)) {
-		clean_up_standalone();
-		return 3;
-	}
-	if(write_array(investing_file, investment, W_grid_size, L_grid_size)) {
-		clean_up_standalone();
-		return 3;
-	}
-	if(write_bool_array(defaulting_file, defaulting, W_grid_size, L_grid_size)) {
-		clean_up_standalone();
-		return 3;
-	}
-	if(write_array(equity_W_file, equity_W, W_grid_size, L_grid_size)) {
+	if(binary_file != NULL) {
+		if(write_standalone_result(binary_file)) {
+			clean_up_standalone();
+			return 3;
+		}
 		clean_up_standalone();
-		return 3;
+		return 0;
 	}
-	if(write_array(equity_L_file, equity_L, W_grid_size, L_grid_size)) {
-		clean_up_standalone();
-		return 3;
+
+	char *equity_file = argv[2];
+	char *investing_file = argv[3];
+	char *defaulting_file = argv[4];
+	char *equity_W_file = argv[5];
+	char *equity_L_file = argv[6];
+	write_array_async(equity_file, equity, W_grid_size, L_grid_size);
+	write_array_async(investing_file, investment, W_grid_size, L_grid_size);
+	write_bool_array_async(defaulting_file, defaulting, W_grid_size, L_grid_size);
+	write_array_async(equity_W_file, equity_W, W_grid_size, L_grid_size);
+	write_array_async(equity_L_file, equity_L, W_grid_size, L_grid_size);
+	for(int k = 0; k < sensitivity_count; ++k) {
+		// The name of the equity file with _d_<name> inserted before the extension .csv, if it has one
+		const char *name = sensitivity_names[sensitivity_parameter[k]];
+		size_t stem = strlen(equity_file);
+		if(stem >= 4 && !strcmp(equity_file + stem - 4, ".csv"))
+			stem -= 4;
+		char *sensitivity_file = malloc(stem + strlen(name) + 8);
+		sprintf(sensitivity_file, "%.*s_d_%s%s", (int) stem, equity_file, name, equity_file + stem);
+		write_array_async(sensitivity_file, equity_sensitivity[k], W_grid_size, L_grid_size);
+		free(sensitivity_file);
 	}
 
+	// The arrays have been copied, so we can free them while the files are being written
 	clean_up_standalone();
+	if(flush_output()) {
+		return 3;
+	}
 	
 	return 0;
 }
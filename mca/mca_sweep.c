@@ -0,0 +1,169 @@
+// Usage:
+// mca_sweep.exe sweep.csv directory [options]
+//
+// sweep.csv				-- Parameter file in which any parameter can be given as a sweep specification (see read_sweep() in mca_io.c),
+//							   e.g. sigma,0.1:0.4:4 or psi,1;1.5;3
+// directory				-- Existing directory for the results
+//
+// Options (see read_options() in mca_io.c):
+// --shard=k/n				-- only solve the points with index k modulo n, so that n processes can share a sweep
+//
+// Solves the model for every point of the cartesian product of the sweep specifications. If the file gives P_min, P_max, P_grid_size and
+// equity_cost, every point is solved like in mca_find_EP, otherwise like in mca_standalone. The data structures are only allocated again
+// when the grid sizes change from one point to the next.
+//
+// The result for point k is written to directory/point_k.mcab (see mca_binary.h), which also holds all parameters of the point.
+// directory/index.csv (index_k.csv for shard k) has one row per point with the index, the file name and the values of the swept parameters.
+
+// Any debug flags have to be specfied in mca.c.
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// FLAG TO SPECIFIY WHETHER WE SHOULD TIME THE EXECUTION
+#define TIMING
+#ifdef TIMING
+#include <time.h>
+#endif
+
+#include "mca_io.h"
+#include "mca.h"
+#include "mca_binary.h"
+
+// Write the header of the index file
+static int write_index_header(FILE *fp, const struct sweep *sweep) {
+	fprintf(fp, "point,file");
+	for(int a = 0; a < sweep->axis_count; ++a)
+		fprintf(fp, ",%s", parameters[sweep->axes[a].parameter].name);
+	return fprintf(fp, "\n") < 0;
+}
+
+// Append the row for the current point to the index file
+static int write_index_row(FILE *fp, const struct sweep *sweep, long point, char *file) {
+	char buf[FORMAT_DOUBLE_LENGTH + 1];
+	fprintf(fp, "%li,%s", point, file);
+	for(int a = 0; a < sweep->axis_count; ++a) {
+		const struct parameter *parameter = &parameters[sweep->axes[a].parameter];
+		if(parameter->is_int) {
+			fprintf(fp, ",%i", *(int*) parameter->value);
+		} else {
+			buf[format_double(buf, *(double*) parameter->value)] = '\0';
+			fprintf(fp, ",%s", buf);
+		}
+	}
+	fprintf(fp, "\n");
+	return fflush(fp) != 0;
+}
+
+int main(int argc, char* argv[]) {
+	argc = read_options(argc, argv);
+	if(argc < 0) {
+		return 1;
+	}
+	if(argc < 3) {
+		printf("Not enough arguments, expected two.\n");
+		return 1;
+	}
+	if(checkpoint_file != NULL || trajectory_file != NULL || binary_file != NULL || sensitivity_count > 0 || cube_file != NULL) {
+		printf("mca_sweep does not support --checkpoint, --trajectory, --binary, --sensitivity and --cube\n");
+		return 1;
+	}
+	char *sweep_file = argv[1];
+	char *directory = argv[2];
+	struct sweep sweep;
+	if(read_sweep(sweep_file, &sweep)) {
+		free_sweep(&sweep);
+		return 2;
+	}
+
+	char index_file[1024];
+	if(shard_count > 1)
+		snprintf(index_file, sizeof index_file, "%s/index_%i.csv", directory, shard_index);
+	else
+		snprintf(index_file, sizeof index_file, "%s/index.csv", directory);
+	FILE *index = fopen(index_file, "w");
+	if(index == NULL || write_index_header(index, &sweep)) {
+		printf("Error writing file %s\n", index_file);
+		free_sweep(&sweep);
+		return 3;
+	}
+
+	// Grid sizes of the allocated data structures, 0 if nothing is allocated
+	int allocated_W = 0, allocated_L = 0, allocated_P = 0;
+	int status = 0;
+	for(long point = shard_index; point < sweep.point_count && !status; point += shard_count) {
+		set_sweep_point(&sweep, point);
+
+		#ifdef TIMING
+		time_t start, end;
+		time(&start);
+		#endif
+
+		bool reuse = W_grid_size == allocated_W && L_grid_size == allocated_L && (!sweep.find_EP || P_grid_size == allocated_P);
+		if(!reuse && allocated_W) {
+			// Free with the grid sizes the data structures were allocated with
+			int W = W_grid_size, L = L_grid_size, Pn = P_grid_size;
+			W_grid_size = allocated_W;
+			L_grid_size = allocated_L;
+			P_grid_size = allocated_P;
+			if(sweep.find_EP)
+				clean_up_find_EP();
+			else
+				clean_up_standalone();
+			W_grid_size = W;
+			L_grid_size = L;
+			P_grid_size = Pn;
+		}
+		if(sweep.find_EP) {
+			if(reuse)
+				mca_find_EP_reuse_setup();
+			else
+				mca_find_EP_setup();
+			mca_find_EP_solve();
+		} else {
+			if(reuse)
+				mca_reuse_setup();
+			else
+				mca_initial_setup();
+			mca_standalone_solve();
+		}
+		allocated_W = W_grid_size;
+		allocated_L = L_grid_size;
+		allocated_P = P_grid_size;
+
+		#ifdef TIMING
+		time(&end);
+		printf("Point %li of %li: %.2lf seconds to run.\n", point + 1, sweep.point_count, difftime(end, start));
+		#endif
+
+		char file[64], path[1024 + 64];
+		snprintf(file, sizeof file, "point_%li.mcab", point);
+		snprintf(path, sizeof path, "%s/%s", directory, file);
+		if(sweep.find_EP)
+			status = write_find_EP_result(path);
+		else
+			status = write_standalone_result(path);
+		if(!status && write_index_row(index, &sweep, point, file)) {
+			printf("Error writing file %s\n", index_file);
+			status = 1;
+		}
+	}
+
+	if(allocated_W) {
+		W_grid_size = allocated_W;
+		L_grid_size = allocated_L;
+		P_grid_size = allocated_P;
+		if(sweep.find_EP)
+			clean_up_find_EP();
+		else
+			clean_up_standalone();
+	}
+	free_sweep(&sweep);
+	if(fclose(index)) {
+		printf("I/O error when closing file %s\n", index_file);
+		status = 1;
+	}
+	return status ? 3 : 0;
+}
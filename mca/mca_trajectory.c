@@ -0,0 +1,513 @@
+// This file defines the trajectory recorder and the reader for trajectory files, see mca_trajectory.h for the layout.
+// int open_trajectory_recorder();									-- open trajectory_file for appending and start the writer thread
+// void record_trajectory(int time_step);							-- queue a snapshot of the current state
+// int close_trajectory_recorder();									-- write the remaining snapshots and the index
+// struct trajectory* open_trajectory(const char *filename);		-- open a trajectory file for reading
+// int read_trajectory_slice(...);									-- read the k-th snapshot
+// void close_trajectory(struct trajectory *tr);
+
+// The solver only copies the state into one of a few preallocated snapshot buffers. The writer thread encodes the snapshots and appends them
+// to the file, so that the solver never waits for the disk, unless all snapshot buffers are waiting to be written.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "mca.h"
+#include "mca_trajectory.h"
+
+#define TRAJECTORY_QUEUE_LENGTH 8
+
+static const char trajectory_magic[8] = "MCATRJ";
+static const char trailer_magic[8] = "MCAIDX";
+
+// A snapshot of the state, waiting to be written
+struct snapshot {
+	int time_step;
+	int P_index;
+	double t;
+	double *equity;
+	double *investment;
+	uint64_t *defaulting;																			// Rows of FLAG_WORDS(L_grid_size) words, as in the solver
+};
+
+// State of the recorder
+static FILE *recorder_fp = NULL;
+static uint64_t recorder_offset;
+static struct trajectory_index_entry *recorder_index = NULL;
+static int recorder_count = 0;
+static int recorder_capacity = 0;
+static int recorder_error = 0;
+
+// Queue of snapshots between the solver and the writer thread
+static struct snapshot queue[TRAJECTORY_QUEUE_LENGTH];
+static int queue_head = 0;
+static int queue_count = 0;
+static bool queue_closing = false;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_not_full = PTHREAD_COND_INITIALIZER;
+static pthread_t writer;
+
+// Growable byte buffer used for encoding
+struct buffer {
+	unsigned char *data;
+	size_t size;
+	size_t capacity;
+};
+
+static void buffer_reserve(struct buffer *b, size_t extra) {
+	if(b->size + extra > b->capacity) {
+		b->capacity = 2 * (b->size + extra);
+		b->data = realloc(b->data, b->capacity);
+	}
+}
+
+static void buffer_append(struct buffer *b, const void *data, size_t size) {
+	buffer_reserve(b, size);
+	memcpy(b->data + b->size, data, size);
+	b->size += size;
+}
+
+// ENCODING
+
+static uint64_t zigzag(int64_t v) {
+	return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v) {
+	return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+// Append a block for the n doubles x (rows of length row_length). Quantized if step > 0 and all values can be represented.
+static void encode_doubles(struct buffer *b, const double *x, int n, int row_length, double step) {
+	struct trajectory_block block = {TRAJECTORY_BLOCK_RAW, 0, step, 0};
+	if(step > 0) {
+		block.encoding = TRAJECTORY_BLOCK_QUANTIZED;
+		for(int k = 0; k < n; ++k) {
+			if(!isfinite(x[k]) || fabs(x[k] / step) > 4e15) {
+				block.encoding = TRAJECTORY_BLOCK_RAW;
+				break;
+			}
+		}
+	}
+	size_t block_position = b->size;
+	buffer_append(b, &block, sizeof block);
+	if(block.encoding == TRAJECTORY_BLOCK_RAW) {
+		buffer_append(b, x, n * sizeof(double));
+	} else {
+		// Every value is encoded relative to its left neighbour, the first value of a row relative to the first value of the preceding row
+		int64_t row_start = 0;
+		int64_t previous = 0;
+		buffer_reserve(b, (size_t) n * 10);
+		for(int k = 0; k < n; ++k) {
+			int64_t q = llround(x[k] / step);
+			uint64_t v;
+			if(k % row_length == 0) {
+				v = zigzag(q - row_start);
+				row_start = q;
+			} else {
+				v = zigzag(q - previous);
+			}
+			previous = q;
+			while(v >= 0x80) {
+				b->data[b->size++] = (unsigned char) (v | 0x80);
+				v >>= 7;
+			}
+			b->data[b->size++] = (unsigned char) v;
+		}
+	}
+	((struct trajectory_block*) (b->data + block_position))->size = b->size - block_position - sizeof block;
+}
+
+// The flags are stored without padding between the rows
+static void encode_flags(struct buffer *b, const uint64_t *flags, int x, int y) {
+	int n = x * y;
+	struct trajectory_block block = {TRAJECTORY_BLOCK_RAW, 0, 0, (n + 7) / 8};
+	buffer_append(b, &block, sizeof block);
+	buffer_reserve(b, block.size);
+	memset(b->data + b->size, 0, block.size);
+	for(int i = 0; i < x; ++i) {
+		const uint64_t *row = flags + (size_t) i * FLAG_WORDS(y);
+		for(int j = 0; j < y; ++j) {
+			int k = i * y + j;
+			if((row[j >> 6] >> (j & 63)) & 1)
+				b->data[b->size + (k >> 3)] |= 1 << (k & 7);
+		}
+	}
+	b->size += block.size;
+}
+
+// Decode a block, returns the position after the block or NULL if the block is malformed
+static const unsigned char* decode_doubles(const unsigned char *src, const unsigned char *end, double *x, int n, int row_length) {
+	struct trajectory_block block;
+	if(end - src < (long) sizeof block)
+		return NULL;
+	memcpy(&block, src, sizeof block);
+	src += sizeof block;
+	if((uint64_t) (end - src) < block.size)
+		return NULL;
+	const unsigned char *block_end = src + block.size;
+	if(block.encoding == TRAJECTORY_BLOCK_RAW) {
+		if(block.size != n * sizeof(double))
+			return NULL;
+		if(x != NULL)
+			memcpy(x, src, block.size);
+		return block_end;
+	}
+	int64_t row_start = 0;
+	int64_t previous = 0;
+	for(int k = 0; k < n; ++k) {
+		uint64_t v = 0;
+		int shift = 0;
+		do {
+			if(src == block_end || shift > 63)
+				return NULL;
+			v |= (uint64_t) (*src & 0x7f) << shift;
+			shift += 7;
+		} while(*src++ & 0x80);
+		int64_t q;
+		if(k % row_length == 0) {
+			q = row_start + unzigzag(v);
+			row_start = q;
+		} else {
+			q = previous + unzigzag(v);
+		}
+		previous = q;
+		if(x != NULL)
+			x[k] = q * block.step;
+	}
+	return block_end;
+}
+
+static const unsigned char* decode_flags(const unsigned char *src, const unsigned char *end, bool *flags, int n) {
+	struct trajectory_block block;
+	if(end - src < (long) sizeof block)
+		return NULL;
+	memcpy(&block, src, sizeof block);
+	src += sizeof block;
+	if(block.size != (uint64_t) (n + 7) / 8 || (uint64_t) (end - src) < block.size)
+		return NULL;
+	if(flags != NULL) {
+		for(int k = 0; k < n; ++k)
+			flags[k] = (src[k >> 3] >> (k & 7)) & 1;
+	}
+	return src + block.size;
+}
+
+// Add an entry to the index, replacing an older snapshot of the same time step (written before resuming from a checkpoint)
+static void add_index_entry(struct trajectory_index_entry **index, int *count, int *capacity, struct trajectory_index_entry entry) {
+	for(int k = *count - 1; k >= 0; --k) {
+		if((*index)[k].time_step == entry.time_step && (*index)[k].P_index == entry.P_index) {
+			(*index)[k] = entry;
+			return;
+		}
+	}
+	if(*count == *capacity) {
+		*capacity = *capacity ? 2 * *capacity : 64;
+		*index = realloc(*index, *capacity * sizeof(struct trajectory_index_entry));
+	}
+	(*index)[(*count)++] = entry;
+}
+
+// WRITER THREAD
+
+static int write_record(struct buffer *b) {
+	if(fwrite(b->data, 1, b->size, recorder_fp) != b->size)
+		return 1;
+	recorder_offset += b->size;
+	return 0;
+}
+
+static void* write_snapshots(void *arg) {
+	(void) arg;
+	struct buffer b = {NULL, 0, 0};
+	int n = W_grid_size * L_grid_size;
+	for(;;) {
+		pthread_mutex_lock(&queue_lock);
+		while(queue_count == 0 && !queue_closing)
+			pthread_cond_wait(&queue_not_empty, &queue_lock);
+		if(queue_count == 0) {
+			pthread_mutex_unlock(&queue_lock);
+			break;
+		}
+		struct snapshot *s = &queue[queue_head];
+		pthread_mutex_unlock(&queue_lock);
+
+		struct trajectory_record record = {TRAJECTORY_RECORD_SNAPSHOT, s->time_step, s->P_index, 0, s->t, 0};
+		b.size = 0;
+		buffer_append(&b, &record, sizeof record);
+		encode_doubles(&b, s->equity, n, L_grid_size, trajectory_tolerance);
+		encode_doubles(&b, s->investment, n, L_grid_size, trajectory_tolerance);
+		encode_flags(&b, s->defaulting, W_grid_size, L_grid_size);
+		((struct trajectory_record*) b.data)->payload_size = b.size - sizeof record;
+		struct trajectory_index_entry entry = {recorder_offset, s->time_step, s->P_index, s->t};
+		if(!recorder_error) {
+			if(write_record(&b))
+				recorder_error = 1;
+			else
+				add_index_entry(&recorder_index, &recorder_count, &recorder_capacity, entry);
+		}
+
+		pthread_mutex_lock(&queue_lock);
+		queue_head = (queue_head + 1) % TRAJECTORY_QUEUE_LENGTH;
+		--queue_count;
+		pthread_cond_signal(&queue_not_full);
+		pthread_mutex_unlock(&queue_lock);
+	}
+	free(b.data);
+	return NULL;
+}
+
+// RECORDING
+
+// Open trajectory_file for appending and start the writer thread. Needs the grids to be set up.
+// If the file already holds snapshots (e.g. when resuming from a checkpoint), we append to them.
+// Returns 0 if successful, 1 otherwise.
+// Free the snapshot buffers and the index of the recorder
+static void free_recorder_buffers() {
+	for(int k = 0; k < TRAJECTORY_QUEUE_LENGTH; ++k) {
+		free(queue[k].equity);
+		free(queue[k].investment);
+		free(queue[k].defaulting);
+		queue[k].equity = queue[k].investment = NULL;
+		queue[k].defaulting = NULL;
+	}
+	free(recorder_index);
+	recorder_index = NULL;
+	recorder_capacity = 0;
+}
+
+int open_trajectory_recorder() {
+	recorder_count = 0;
+	recorder_error = 0;
+	struct trajectory *existing = open_trajectory(trajectory_file);
+	if(existing != NULL) {
+		if(existing->W_grid_size != W_grid_size || existing->L_grid_size != L_grid_size) {
+			printf("Trajectory file %s was written for a different grid.\n", trajectory_file);
+			close_trajectory(existing);
+			return 1;
+		}
+		for(int k = 0; k < existing->count; ++k)
+			add_index_entry(&recorder_index, &recorder_count, &recorder_capacity, existing->index[k]);
+		close_trajectory(existing);
+	}
+
+	recorder_fp = fopen(trajectory_file, existing != NULL ? "ab" : "wb");
+	if(recorder_fp == NULL) {
+		printf("Error, could not open trajectory file %s for writing.\n", trajectory_file);
+		free_recorder_buffers();
+		return 1;
+	}
+	fseek(recorder_fp, 0, SEEK_END);
+	recorder_offset = ftell(recorder_fp);
+	if(existing == NULL) {
+		struct trajectory_header header;
+		memset(&header, 0, sizeof header);
+		memcpy(header.magic, trajectory_magic, sizeof header.magic);
+		header.version = TRAJECTORY_VERSION;
+		header.W_grid_size = W_grid_size;
+		header.L_grid_size = L_grid_size;
+		if(fwrite(&header, sizeof header, 1, recorder_fp) != 1 || fwrite(W_grid, sizeof(double), W_grid_size, recorder_fp) != (size_t) W_grid_size ||
+		   fwrite(L_grid, sizeof(double), L_grid_size, recorder_fp) != (size_t) L_grid_size) {
+			printf("Error writing trajectory file %s\n", trajectory_file);
+			fclose(recorder_fp);
+			recorder_fp = NULL;
+			free_recorder_buffers();
+			return 1;
+		}
+		recorder_offset = sizeof header + (W_grid_size + L_grid_size) * sizeof(double);
+	}
+
+	int n = W_grid_size * L_grid_size;
+	for(int k = 0; k < TRAJECTORY_QUEUE_LENGTH; ++k) {
+		queue[k].equity = malloc(n * sizeof(double));
+		queue[k].investment = malloc(n * sizeof(double));
+		queue[k].defaulting = malloc((size_t) W_grid_size * FLAG_WORDS(L_grid_size) * sizeof(uint64_t));
+		if(queue[k].equity == NULL || queue[k].investment == NULL || queue[k].defaulting == NULL) {
+			printf("Could not allocate the snapshot buffers for trajectory file %s\n", trajectory_file);
+			fclose(recorder_fp);
+			recorder_fp = NULL;
+			free_recorder_buffers();
+			return 1;
+		}
+	}
+	queue_head = 0;
+	queue_count = 0;
+	queue_closing = false;
+	if(pthread_create(&writer, NULL, write_snapshots, NULL)) {
+		printf("Could not start thread for writing trajectory file %s\n", trajectory_file);
+		fclose(recorder_fp);
+		recorder_fp = NULL;
+		free_recorder_buffers();
+		return 1;
+	}
+	return 0;
+}
+
+// Queue a snapshot of the state after time step time_step. Only waits if all snapshot buffers are still waiting to be written.
+void record_trajectory(int time_step) {
+	if(recorder_fp == NULL)
+		return;
+	pthread_mutex_lock(&queue_lock);
+	while(queue_count == TRAJECTORY_QUEUE_LENGTH)
+		pthread_cond_wait(&queue_not_full, &queue_lock);
+	struct snapshot *s = &queue[(queue_head + queue_count) % TRAJECTORY_QUEUE_LENGTH];
+	pthread_mutex_unlock(&queue_lock);
+
+	s->time_step = time_step;
+	s->P_index = P_index;
+	s->t = T - time_step * dT;
+	for(int i = 0; i < W_grid_size; ++i) {
+		memcpy(s->equity + i * L_grid_size, equity[i], L_grid_size * sizeof(double));
+		memcpy(s->investment + i * L_grid_size, investment[i], L_grid_size * sizeof(double));
+		memcpy(s->defaulting + (size_t) i * FLAG_WORDS(L_grid_size), defaulting[i], FLAG_WORDS(L_grid_size) * sizeof(uint64_t));
+	}
+
+	pthread_mutex_lock(&queue_lock);
+	++queue_count;
+	pthread_cond_signal(&queue_not_empty);
+	pthread_mutex_unlock(&queue_lock);
+}
+
+// Wait for the writer thread, append the index and the trailer and close the file.
+// Returns 0 if successful, 1 if any snapshot could not be written.
+int close_trajectory_recorder() {
+	if(recorder_fp == NULL)
+		return 0;
+	pthread_mutex_lock(&queue_lock);
+	queue_closing = true;
+	pthread_cond_signal(&queue_not_empty);
+	pthread_mutex_unlock(&queue_lock);
+	pthread_join(writer, NULL);
+
+	if(!recorder_error) {
+		struct buffer b = {NULL, 0, 0};
+		struct trajectory_record record = {TRAJECTORY_RECORD_INDEX, 0, 0, 0, 0, recorder_count * sizeof(struct trajectory_index_entry)};
+		struct trajectory_trailer trailer = {recorder_offset, {0}};
+		memcpy(trailer.magic, trailer_magic, sizeof trailer.magic);
+		buffer_append(&b, &record, sizeof record);
+		buffer_append(&b, recorder_index, recorder_count * sizeof(struct trajectory_index_entry));
+		buffer_append(&b, &trailer, sizeof trailer);
+		recorder_error = write_record(&b);
+		free(b.data);
+	}
+	if(fclose(recorder_fp))
+		recorder_error = 1;
+	recorder_fp = NULL;
+	if(recorder_error)
+		printf("Error writing trajectory file %s\n", trajectory_file);
+	free_recorder_buffers();
+	return recorder_error;
+}
+
+// READING
+
+// Open a trajectory file and read its index. If the file has no valid trailer (the solver was killed), the index is rebuilt by scanning
+// the records. Returns NULL if the file cannot be read.
+struct trajectory* open_trajectory(const char *filename) {
+	FILE *fp = fopen(filename, "rb");
+	if(fp == NULL)
+		return NULL;
+	struct trajectory_header header;
+	if(fread(&header, sizeof header, 1, fp) != 1 || memcmp(header.magic, trajectory_magic, sizeof header.magic) ||
+	   header.version != TRAJECTORY_VERSION) {
+		fclose(fp);
+		return NULL;
+	}
+	struct trajectory *tr = calloc(1, sizeof(struct trajectory));
+	tr->fp = fp;
+	tr->W_grid_size = header.W_grid_size;
+	tr->L_grid_size = header.L_grid_size;
+	tr->W_grid = malloc(tr->W_grid_size * sizeof(double));
+	tr->L_grid = malloc(tr->L_grid_size * sizeof(double));
+	if(fread(tr->W_grid, sizeof(double), tr->W_grid_size, fp) != (size_t) tr->W_grid_size ||
+	   fread(tr->L_grid, sizeof(double), tr->L_grid_size, fp) != (size_t) tr->L_grid_size) {
+		close_trajectory(tr);
+		return NULL;
+	}
+	uint64_t first_record = ftell(fp);
+	fseek(fp, 0, SEEK_END);
+	uint64_t file_size = ftell(fp);
+	int capacity = 0;
+
+	// Index given by the trailer
+	struct trajectory_trailer trailer;
+	struct trajectory_record record;
+	if(file_size >= first_record + sizeof trailer) {
+		fseek(fp, file_size - sizeof trailer, SEEK_SET);
+		if(fread(&trailer, sizeof trailer, 1, fp) == 1 && !memcmp(trailer.magic, trailer_magic, sizeof trailer.magic) &&
+		   trailer.index_offset >= first_record && trailer.index_offset + sizeof record <= file_size) {
+			fseek(fp, trailer.index_offset, SEEK_SET);
+			if(fread(&record, sizeof record, 1, fp) == 1 && record.type == TRAJECTORY_RECORD_INDEX &&
+			   trailer.index_offset + sizeof record + record.payload_size + sizeof trailer == file_size) {
+				tr->count = record.payload_size / sizeof(struct trajectory_index_entry);
+				tr->index = malloc(tr->count * sizeof(struct trajectory_index_entry) + 1);
+				if(fread(tr->index, sizeof(struct trajectory_index_entry), tr->count, fp) == (size_t) tr->count)
+					return tr;
+				free(tr->index);
+				tr->index = NULL;
+				tr->count = 0;
+			}
+		}
+	}
+
+	// Scan the records, stop at the first incomplete record
+	uint64_t offset = first_record;
+	fseek(fp, offset, SEEK_SET);
+	while(offset + sizeof record <= file_size && fread(&record, sizeof record, 1, fp) == 1) {
+		uint64_t next = offset + sizeof record + record.payload_size;
+		if(record.type == TRAJECTORY_RECORD_INDEX)
+			next += sizeof trailer;
+		else if(record.type != TRAJECTORY_RECORD_SNAPSHOT)
+			break;
+		if(next > file_size)
+			break;
+		if(record.type == TRAJECTORY_RECORD_SNAPSHOT) {
+			struct trajectory_index_entry entry = {offset, record.time_step, record.P_index, record.t};
+			add_index_entry(&tr->index, &tr->count, &capacity, entry);
+		}
+		offset = next;
+		fseek(fp, offset, SEEK_SET);
+	}
+	return tr;
+}
+
+void close_trajectory(struct trajectory *tr) {
+	if(tr == NULL)
+		return;
+	fclose(tr->fp);
+	free(tr->W_grid);
+	free(tr->L_grid);
+	free(tr->index);
+	free(tr);
+}
+
+// Read the k-th snapshot of the index into the arrays of length W_grid_size * L_grid_size (row by row), any of which may be NULL.
+// Returns 0 if successful, 1 otherwise.
+int read_trajectory_slice(struct trajectory *tr, int k, double *equity_slice, double *investment_slice, bool *defaulting_slice) {
+	if(k < 0 || k >= tr->count)
+		return 1;
+	struct trajectory_record record;
+	fseek(tr->fp, tr->index[k].offset, SEEK_SET);
+	if(fread(&record, sizeof record, 1, tr->fp) != 1 || record.type != TRAJECTORY_RECORD_SNAPSHOT)
+		return 1;
+	unsigned char *payload = malloc(record.payload_size);
+	if(fread(payload, 1, record.payload_size, tr->fp) != record.payload_size) {
+		free(payload);
+		return 1;
+	}
+	int n = tr->W_grid_size * tr->L_grid_size;
+	const unsigned char *end = payload + record.payload_size;
+	const unsigned char *src = decode_doubles(payload, end, equity_slice, n, tr->L_grid_size);
+	if(src != NULL)
+		src = decode_doubles(src, end, investment_slice, n, tr->L_grid_size);
+	if(src != NULL)
+		src = decode_flags(src, end, defaulting_slice, n);
+	free(payload);
+	return src == NULL;
+}
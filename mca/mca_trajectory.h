@@ -0,0 +1,84 @@
+#ifndef MCA_TRAJECTORY_H
+#define MCA_TRAJECTORY_H
+
+// TRAJECTORY FILES
+// A trajectory file holds snapshots of equity, investment and defaulting at intermediate time steps, recorded while the solver marches
+// backward in time. The file is append-only:
+//
+// struct trajectory_header, followed by the W and L axes
+// records, each a struct trajectory_record followed by its payload
+//
+// A snapshot record holds three blocks, equity, investment and defaulting. The blocks for equity and investment are either raw doubles or,
+// if a tolerance was given, the values rounded to multiples of the tolerance, so that the error is at most half the tolerance. The rounded
+// values are delta-encoded along the rows and stored as variable-length integers. The defaulting flags are bit-packed.
+//
+// When the recorder is closed, an index record with the offsets of all snapshots and a trailer pointing to it are appended. If the solver
+// was killed, the reader rebuilds the index by scanning the records. Resuming a run appends to the same file.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define TRAJECTORY_VERSION 1
+#define TRAJECTORY_RECORD_SNAPSHOT 1
+#define TRAJECTORY_RECORD_INDEX 2
+#define TRAJECTORY_BLOCK_RAW 0
+#define TRAJECTORY_BLOCK_QUANTIZED 1
+
+struct trajectory_header {
+	char magic[8];																					// "MCATRJ\0\0"
+	uint32_t version;
+	int32_t W_grid_size;
+	int32_t L_grid_size;
+	uint32_t reserved;
+};
+
+struct trajectory_record {
+	uint32_t type;																					// TRAJECTORY_RECORD_SNAPSHOT or TRAJECTORY_RECORD_INDEX
+	int32_t time_step;																				// Time step after which the snapshot was taken, 0 for the terminal values
+	int32_t P_index;																				// -1 for mca_standalone
+	uint32_t reserved;
+	double t;																						// Time of the snapshot
+	uint64_t payload_size;
+};
+
+struct trajectory_block {
+	uint32_t encoding;																				// TRAJECTORY_BLOCK_RAW or TRAJECTORY_BLOCK_QUANTIZED
+	uint32_t reserved;
+	double step;																					// Quantization step (the tolerance)
+	uint64_t size;																					// Size of the data following the block header in bytes
+};
+
+struct trajectory_index_entry {
+	uint64_t offset;																				// Offset of the record header
+	int32_t time_step;
+	int32_t P_index;
+	double t;
+};
+
+struct trajectory_trailer {
+	uint64_t index_offset;																			// Offset of the record header of the index
+	char magic[8];																					// "MCAIDX\0\0"
+};
+
+// RECORDING (used by the solver)
+int open_trajectory_recorder();
+void record_trajectory(int time_step);
+int close_trajectory_recorder();
+
+// READING
+struct trajectory {
+	FILE *fp;
+	int W_grid_size;
+	int L_grid_size;
+	double *W_grid;
+	double *L_grid;
+	int count;																						// Number of snapshots
+	struct trajectory_index_entry *index;
+};
+
+struct trajectory* open_trajectory(const char *filename);
+void close_trajectory(struct trajectory *tr);
+int read_trajectory_slice(struct trajectory *tr, int k, double *equity, double *investment, bool *defaulting);
+
+#endif